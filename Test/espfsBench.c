@@ -0,0 +1,564 @@
+/*
+*   Host benchmark for espfs file lookup.
+*
+*   Usage: espfsBench [image]
+*
+*   Builds images of increasing file counts in memory, laid out the way
+*   mkespfsimage writes them, with and without the name index and trailer.
+*   Times espFsInit, which walks every header of the older layout, and
+*   espFsOpen/espFsClose over random names including misses. Every lookup
+*   is checked to find the same header through both paths, and handles
+*   held past the pool size are checked to fall back to malloc.
+*
+*   Then serves a large file the way ROUTE_FILESYSTEM does, through
+*   espFsRead into a chunk buffer, and the way cgiEspFsMapped does, from
+*   the pointer espFsAccess returns, in bytes per CPU cycle.
+*
+*   Given an image, for example the dashboard's
+*       cd html && find . | mkespfsimage > /tmp/html.espfs
+*   it also decodes every heatshrink file in it through a decoder fed 16
+*   bytes at a time, as espFsRead used to, through espFsRead in 1 kB
+*   reads, and through espFsRead of the whole file. All three must match,
+*   and match the content hash if the image stores one.
+*   Then reads 1 kB from random places, seeking in files built with
+*   mkespfsimage -b and reading up to the place in the others.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp32/rom/crc.h"
+#include "espfs.h"
+#include "espfsformat.h"
+#include "espfs_priv.h"
+#include "heatshrink_decoder.h"
+
+#define N_LOOKUPS 200000
+#define N_MOUNTS 200
+#define MAX_NAME 32
+#define SEND_BUFF_LEN 2048          // libesphttpd's HTTPD_MAX_SENDBUFF_LEN
+#define SERVE_CHUNK 1024            // ROUTE_FILESYSTEM's chunk and ESPFS_ROUTE_CHUNK
+#define SERVE_FILE_LEN 200003
+#define SERVE_ROUNDS 500
+#define DECODE_ROUNDS 20
+#define N_RANDOM_READS 64
+
+// Page aligned like the image, so host 4K aliasing between the two does
+// not depend on where malloc put them
+static char sendBuff[SEND_BUFF_LEN] __attribute__((aligned(4096)));
+static int sendLen;
+
+// Images are handed to espFsInit by address, flash is never mapped
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label)
+{
+    return NULL;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size, int memory,
+                             const void** out_ptr, spi_flash_mmap_handle_t* out_handle)
+{
+    return ESP_FAIL;
+}
+
+void spi_flash_munmap(spi_flash_mmap_handle_t handle)
+{
+}
+
+uint32_t crc32_le(uint32_t crc, uint8_t const* buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return nowSeconds() * 1e9;      // Reported per ns instead
+#endif
+}
+
+// Stands in for httpdSend, which copies into the connection's send
+// buffer. The buffer goes out on the socket after every CGI call. Kept
+// out of line like the library's, so both paths use the same memcpy
+static __attribute__((noinline)) int httpdSend(const char* data, int len)
+{
+    if (sendLen + len > SEND_BUFF_LEN) {
+        return 0;
+    }
+    memcpy(&sendBuff[sendLen], data, len);
+    sendLen += len;
+    return 1;
+}
+
+static size_t align4(size_t len)
+{
+    return (len + 3) & ~3;
+}
+
+static size_t putHeader(uint8_t* p, int8_t flags, int16_t nameLen, int32_t len)
+{
+    EspFsHeader h = {
+        .magic = ESPFS_MAGIC,
+        .flags = flags,
+        .compression = COMPRESS_NONE,
+        .nameLen = nameLen,
+        .fileLenComp = len,
+        .fileLenDecomp = len
+    };
+    memcpy(p, &h, sizeof(h));
+    return sizeof(h);
+}
+
+static uint8_t* buildImage(char names[][MAX_NAME], int n, bool indexed)
+{
+    int numBuckets = 1;
+    size_t indexLen = 0, len = 0;
+
+    while (numBuckets < n * 2) {
+        numBuckets <<= 1;
+    }
+    if (indexed) {
+        indexLen = sizeof(EspFsIndexHeader) + numBuckets * sizeof(EspFsIndexEntry);
+        len += sizeof(EspFsHeader) + indexLen;
+    }
+    for (int i = 0; i < n; i++) {
+        len += sizeof(EspFsHeader) + align4(strlen(names[i]) + 1) + align4(64 + i % 448);
+    }
+    len += sizeof(EspFsHeader) + (indexed ? sizeof(EspFsTrailer) : 0);
+
+    uint8_t* image = calloc(1, len);
+    EspFsIndexEntry* buckets = NULL;
+    size_t off = 0;
+    if (indexed) {
+        EspFsIndexHeader ih = {
+            .headerLen = sizeof(EspFsIndexHeader),
+            .numFiles = n,
+            .numBuckets = numBuckets,
+            .lastOffset = len - sizeof(EspFsHeader) - sizeof(EspFsTrailer)
+        };
+        off += putHeader(image, FLAG_INDEX, 0, indexLen);
+        memcpy(&image[off], &ih, sizeof(ih));
+        buckets = (EspFsIndexEntry*) &image[off + sizeof(ih)];
+        off += indexLen;
+    }
+    for (int i = 0; i < n; i++) {
+        size_t nameLen = align4(strlen(names[i]) + 1);
+        size_t dataLen = 64 + i % 448;
+        if (indexed) {
+            uint32_t hash = espFsHashName(names[i]);
+            int b = hash & (numBuckets - 1);
+            while (buckets[b].offset != 0) {
+                b = (b + 1) & (numBuckets - 1);
+            }
+            buckets[b].hash = hash;
+            buckets[b].offset = off;
+        }
+        off += putHeader(&image[off], 0, nameLen, dataLen);
+        strcpy((char*) &image[off], names[i]);
+        off += nameLen;
+        memset(&image[off], 'a' + i % 26, dataLen);
+        off += align4(dataLen);
+    }
+    if (indexed) {
+        EspFsTrailer t = {
+            .numFiles = n,
+            .length = len,
+            .crc32 = crc32_le(0, image, off)
+        };
+        putHeader(&image[off], FLAG_LASTFILE, 0, sizeof(t));
+        memcpy(&image[off + sizeof(EspFsHeader)], &t, sizeof(t));
+    } else {
+        putHeader(&image[off], FLAG_LASTFILE, 0, 0);
+    }
+    return image;
+}
+
+static bool serveCopied(EspFsFile* file)
+{
+    char buff[SERVE_CHUNK];
+
+    int len = espFsRead(file, buff, SERVE_CHUNK);
+    if (len > 0) {
+        httpdSend(buff, len);
+    }
+    return len == SERVE_CHUNK;
+}
+
+static bool serveMapped(EspFsFile* file)
+{
+    const char* data;
+
+    int len = espFsAccess(file, (void**) &data);
+    int pos = espFsSeek(file, 0, SEEK_CUR);
+    int n = len - pos < SERVE_CHUNK ? len - pos : SERVE_CHUNK;
+    if (n > 0 && httpdSend(&data[pos], n)) {
+        espFsSeek(file, n, SEEK_CUR);
+        pos += n;
+    }
+    return pos < len;
+}
+
+// Every CGI call is followed by a flush, checked against the file once
+static double timeServe(EspFs* fs, const uint8_t* expect, bool (*serve)(EspFsFile*), int* failures)
+{
+    uint64_t start = 0;
+
+    for (int r = -1; r < SERVE_ROUNDS; r++) {
+        if (r == 0) {
+            start = cycles();
+        }
+        EspFsFile* file = espFsOpen(fs, "index.html");
+        size_t served = 0;
+        bool more;
+        do {
+            sendLen = 0;
+            more = serve(file);
+            if (r < 0 && memcmp(sendBuff, &expect[served], sendLen) != 0) {
+                (*failures)++;
+            }
+            served += sendLen;
+        } while (more);
+        espFsClose(file);
+        if (served != SERVE_FILE_LEN) {
+            (*failures)++;
+        }
+    }
+    return (double) SERVE_FILE_LEN * SERVE_ROUNDS / (cycles() - start);
+}
+
+static double timeMounts(const uint8_t* image)
+{
+    EspFsConfig conf = {.memAddr = image};
+    double start = nowSeconds();
+
+    for (int i = 0; i < N_MOUNTS; i++) {
+        espFsDeinit(espFsInit(&conf));
+    }
+    return (nowSeconds() - start) / N_MOUNTS * 1e6;
+}
+
+static double timeLookups(EspFs* fs, char names[][MAX_NAME], const int* order, int* found)
+{
+    double start = nowSeconds();
+
+    *found = 0;
+    for (int i = 0; i < N_LOOKUPS; i++) {
+        EspFsFile* f = espFsOpen(fs, names[order[i]]);
+        if (f != NULL) {
+            (*found)++;
+            espFsClose(f);
+        }
+    }
+    return (nowSeconds() - start) / N_LOOKUPS * 1e9;
+}
+
+// The loop espFsRead used before sinking spans straight from the image
+static size_t decodeSmallSinks(const uint8_t* in, size_t inLen, uint8_t parms, uint8_t* out, size_t outLen)
+{
+    size_t inPos = 0, outPos = 0, n;
+    uint8_t ebuff[16];
+    heatshrink_decoder* dec = heatshrink_decoder_alloc(16, parms >> 4, parms & 0xf);
+
+    while (outPos < outLen) {
+        size_t elen = inLen - inPos;
+        if (elen > 0) {
+            memcpy(ebuff, &in[inPos], elen > 16 ? 16 : elen);
+            heatshrink_decoder_sink(dec, ebuff, elen > 16 ? 16 : elen, &n);
+            inPos += n;
+        }
+        size_t want = outLen - outPos;
+        heatshrink_decoder_poll(dec, &out[outPos], want > SERVE_CHUNK ? SERVE_CHUNK : want, &n);
+        outPos += n;
+        if (elen == 0 && n == 0) {
+            break;
+        }
+    }
+    heatshrink_decoder_free(dec);
+    return outPos;
+}
+
+// Files with FLAG_BLOCKS are a stream per block, each with a fresh decoder
+static size_t decodeReference(const EspFsHeader* h, uint8_t* out)
+{
+    const uint8_t* data = (const uint8_t*) (h + 1) + h->nameLen;
+
+    if (!(h->flags & FLAG_BLOCKS)) {
+        return decodeSmallSinks(&data[1], h->fileLenComp - 1, data[0], out, h->fileLenDecomp);
+    }
+
+    const EspFsBlockHeader* bh = (const EspFsBlockHeader*) data;
+    const uint32_t* offsets = (const uint32_t*) (bh + 1);
+    size_t len = 0;
+    for (int i = 0; i < bh->numBlocks; i++) {
+        size_t end = i + 1 < bh->numBlocks ? offsets[i + 1] : h->fileLenComp;
+        size_t want = h->fileLenDecomp - len < (1u << bh->blockBits) ? h->fileLenDecomp - len : 1u << bh->blockBits;
+        len += decodeSmallSinks(&data[offsets[i]], end - offsets[i], bh->parms, &out[len], want);
+    }
+    return len;
+}
+
+static size_t decodeRead(EspFs* fs, const char* name, uint8_t* out, int chunk)
+{
+    EspFsFile* file = espFsOpen(fs, name);
+    size_t len = 0;
+    int n;
+
+    while (file != NULL && (n = espFsRead(file, (char*) &out[len], chunk)) > 0) {
+        len += n;
+    }
+    espFsClose(file);
+    return len;
+}
+
+// 1 kB reads from random places. Files that can't seek are read up to them
+static uint64_t timeRandomReads(EspFs* fs, const char* name, const uint8_t* expect, size_t len, int* failures)
+{
+    char buff[SERVE_CHUNK];
+    uint64_t start = cycles();
+
+    for (int i = 0; i < N_RANDOM_READS; i++) {
+        int target = rand() % len;
+        EspFsFile* file = espFsOpen(fs, name);
+        if (espFsSeek(file, target, SEEK_SET) != target) {
+            espFsSeek(file, 0, SEEK_SET);
+            for (int pos = 0; pos < target; ) {
+                pos += espFsRead(file, buff, target - pos < SERVE_CHUNK ? target - pos : SERVE_CHUNK);
+            }
+        }
+        int n = espFsRead(file, buff, SERVE_CHUNK);
+        if (n != (len - target < SERVE_CHUNK ? len - target : SERVE_CHUNK) || memcmp(buff, &expect[target], n) != 0) {
+            printf("%s reads differently at %d\n", name, target);
+            (*failures)++;
+        }
+        espFsClose(file);
+    }
+    return (cycles() - start) / N_RANDOM_READS;
+}
+
+static int benchImage(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("Can't open %s\n", path);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    size_t len = ftell(f);
+    rewind(f);
+    uint8_t* image = calloc(1, len + 16);
+    if (fread(image, 1, len, f) != len) {
+        fclose(f);
+        return 1;
+    }
+    fclose(f);
+
+    EspFsConfig conf = {.memAddr = image};
+    EspFs* fs = espFsInit(&conf);
+    if (fs == NULL) {
+        printf("Failed to mount %s\n", path);
+        return 1;
+    }
+
+    int failures = 0;
+    uint64_t total[3] = {0, 0, 0};
+    size_t totalLen = 0;
+    printf("%-20s %8s %8s %10s %10s %10s %12s\n", "heatshrink file", "comp", "decomp", "16 B sink", "1 kB read", "whole",
+           "random 1 kB");
+    for (const uint8_t* p = image; ((const EspFsHeader*) p)->magic == ESPFS_MAGIC; ) {
+        const EspFsHeader* h = (const EspFsHeader*) p;
+        const char* name = (const char*) (h + 1);
+        p += sizeof(EspFsHeader) + align4(h->nameLen + h->fileLenComp);
+        if (h->flags & FLAG_LASTFILE) {
+            break;
+        }
+        // A link is opened by its own name but decodes the data of the file it points back to
+        int link = (h->flags & FLAG_LINK) != 0;
+        if (link) {
+            h = (const EspFsHeader*) ((const uint8_t*) h - ((const EspFsLink*) (name + h->nameLen))->back);
+        }
+        if ((h->flags & FLAG_INDEX) || h->compression != COMPRESS_HEATSHRINK) {
+            continue;
+        }
+
+        uint8_t* expect = malloc(h->fileLenDecomp);
+        uint8_t* out = malloc(h->fileLenDecomp);
+        uint64_t c[3];
+        EspFsStat st;
+        if (decodeReference(h, expect) != h->fileLenDecomp || !espFsStat(fs, name, &st) ||
+            ((h->flags & FLAG_HASH) && st.hash != espFsHashContent(expect, h->fileLenDecomp))) {
+            printf("%s doesn't match its header\n", name);
+            failures++;
+        }
+        for (int way = 0; way < 3; way++) {
+            uint64_t start = cycles();
+            for (int r = 0; r < DECODE_ROUNDS; r++) {
+                memset(out, 0, h->fileLenDecomp);
+                size_t n = way == 0 ? decodeReference(h, out) :
+                           decodeRead(fs, name, out, way == 1 ? SERVE_CHUNK : h->fileLenDecomp);
+                if (n != h->fileLenDecomp || memcmp(out, expect, n) != 0) {
+                    printf("%s decodes differently\n", name);
+                    failures++;
+                    break;
+                }
+            }
+            c[way] = cycles() - start;
+            total[way] += c[way];
+        }
+        totalLen += h->fileLenDecomp;
+        uint64_t random = timeRandomReads(fs, name, expect, h->fileLenDecomp, &failures);
+        printf("%-20s %8d %8d %10.3f %10.3f %10.3f %12llu%s%s\n", name, h->fileLenComp, h->fileLenDecomp,
+               (double) h->fileLenDecomp * DECODE_ROUNDS / c[0], (double) h->fileLenDecomp * DECODE_ROUNDS / c[1],
+               (double) h->fileLenDecomp * DECODE_ROUNDS / c[2], (unsigned long long) random,
+               (h->flags & FLAG_BLOCKS) ? " blocks" : "", link ? " link" : "");
+        free(expect);
+        free(out);
+    }
+    printf("%-20s %8s %8zu %10.3f %10.3f %10.3f bytes/cycle, cycles\n", "all", "", totalLen,
+           (double) totalLen * DECODE_ROUNDS / total[0], (double) totalLen * DECODE_ROUNDS / total[1],
+           (double) totalLen * DECODE_ROUNDS / total[2]);
+
+    espFsDeinit(fs);
+    free(image);
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+    const int counts[] = {8, 32, 128, 512, 2048};
+    const int maxFiles = counts[sizeof(counts) / sizeof(counts[0]) - 1];
+    static char names[2 * 2048][MAX_NAME];
+    static int order[N_LOOKUPS];
+    int failures = 0;
+
+    if (argc > 1) {
+        return benchImage(argv[1]);
+    }
+
+    printf("%6s %12s %12s %12s %12s\n", "files", "walk mount", "trail mount", "linear open", "index open");
+    printf("%6s %12s %12s %12s %12s\n", "", "us", "us", "ns", "ns");
+    for (int c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        int n = counts[c];
+
+        // Names past n are misses, one lookup in eight asks for one
+        for (int i = 0; i < 2 * maxFiles; i++) {
+            snprintf(names[i], MAX_NAME, "%s/chunk-%04d.%s", i % 3 ? "assets" : "static", i, i % 2 ? "js" : "css");
+        }
+        srand(n);
+        for (int i = 0; i < N_LOOKUPS; i++) {
+            order[i] = rand() % 8 ? rand() % n : n + rand() % n;
+        }
+
+        uint8_t* linearImage = buildImage(names, n, false);
+        uint8_t* indexedImage = buildImage(names, n, true);
+        EspFsConfig linearConf = {.memAddr = linearImage};
+        EspFsConfig indexedConf = {.memAddr = indexedImage};
+        EspFs* linear = espFsInit(&linearConf);
+        EspFs* indexed = espFsInit(&indexedConf);
+        if (linear == NULL || indexed == NULL || indexed->index == NULL || indexed->trailer == NULL ||
+            indexed->numFiles != n || linear->numFiles != n || indexed->length != linear->length + sizeof(EspFsHeader) +
+            indexed->index->headerLen + indexed->index->numBuckets * sizeof(EspFsIndexEntry) + sizeof(EspFsTrailer) ||
+            espFsVerify(indexed) != ESPFS_INTEGRITY_OK || espFsVerify(linear) != ESPFS_INTEGRITY_NO_CHECKSUM) {
+            printf("Failed to mount %d file images\n", n);
+            return 1;
+        }
+
+        for (int i = 0; i < 2 * n; i++) {
+            EspFsFile* a = espFsOpen(linear, names[i]);
+            EspFsFile* b = espFsOpen(indexed, names[i]);
+            if ((a == NULL) != (b == NULL) || (a != NULL) != (i < n) ||
+                (a != NULL && espFsFilesize(a) != espFsFilesize(b))) {
+                printf("Lookup of %s differs\n", names[i]);
+                failures++;
+            }
+            espFsClose(a);
+            espFsClose(b);
+        }
+
+        double walkUs = timeMounts(linearImage);
+        double trailerUs = timeMounts(indexedImage);
+        int foundLinear, foundIndexed;
+        double linearNs = timeLookups(linear, names, order, &foundLinear);
+        double indexedNs = timeLookups(indexed, names, order, &foundIndexed);
+        if (foundLinear != foundIndexed) {
+            failures++;
+        }
+        printf("%6d %12.2f %12.2f %12.1f %12.1f\n", n, walkUs, trailerUs, linearNs, indexedNs);
+
+        // Hold more handles than the pool has, every one must still open
+        EspFsFile* held[2 * CONFIG_ESPFS_FILE_POOL_SIZE];
+        EspFsPoolStats before, during, after;
+        espFsGetPoolStats(&before);
+        for (int i = 0; i < 2 * CONFIG_ESPFS_FILE_POOL_SIZE; i++) {
+            held[i] = espFsOpen(indexed, names[i % n]);
+        }
+        espFsGetPoolStats(&during);
+        for (int i = 0; i < 2 * CONFIG_ESPFS_FILE_POOL_SIZE; i++) {
+            if (held[i] == NULL) {
+                failures++;
+            }
+            espFsClose(held[i]);
+        }
+        espFsGetPoolStats(&after);
+        if (during.handlesInUse != during.handles || after.handlesInUse != 0 ||
+            during.handleFallbacks - before.handleFallbacks != 2 * CONFIG_ESPFS_FILE_POOL_SIZE - during.handles) {
+            printf("Handle pool leaked or overflowed at %d files\n", n);
+            failures++;
+        }
+
+        espFsDeinit(linear);
+        espFsDeinit(indexed);
+        free(linearImage);
+        free(indexedImage);
+    }
+
+    size_t imageLen = (3 * sizeof(EspFsHeader) + 16 + align4(SERVE_FILE_LEN) + 4095) & ~4095;
+    uint8_t* image = aligned_alloc(4096, imageLen);
+    size_t off = putHeader(image, FLAG_GZIP, 12, SERVE_FILE_LEN);
+    strcpy((char*) &image[off], "index.html");
+    off += 12;
+    for (int i = 0; i < SERVE_FILE_LEN; i++) {
+        image[off + i] = rand();
+    }
+    putHeader(&image[off + align4(SERVE_FILE_LEN)], FLAG_LASTFILE, 0, 0);
+    EspFsConfig conf = {.memAddr = image};
+    EspFs* fs = espFsInit(&conf);
+    double copied = timeServe(fs, &image[off], serveCopied, &failures);
+    double mapped = timeServe(fs, &image[off], serveMapped, &failures);
+    printf("\nServing %d bytes in %d byte calls: espFsRead %.3f, mapped %.3f bytes/cycle\n",
+           SERVE_FILE_LEN, SERVE_CHUNK, copied, mapped);
+    espFsDeinit(fs);
+    free(image);
+
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
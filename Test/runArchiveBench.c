@@ -0,0 +1,326 @@
+/*
+*   Host benchmark for run archives.
+*
+*   Usage: runArchiveBench [archive.hs]
+*
+*   Records synthetic runs into file-backed sample and archive logs split
+*   the way the runlog partition is, the same way the recorder task does,
+*   compresses them with runArchive_create and reads the archives back
+*   through a heatshrink decoder, checking every sample. Also checks that
+*   archives of runs longer than the sample log are refused, that the
+*   archive log wrapping drops whole archives, and that a block lost after
+*   an archive was opened fails the read instead of leaving a gap. The raw
+*   archive stream of the first run can be written out to test the
+*   browser decoder.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "heatshrink_decoder.h"
+#include "main.h"
+#include "tsCodec.h"
+#include "runLog.h"
+#include "runArchive.h"
+#include "runRecorder.h"
+#include "runLogFileStorage.h"
+
+#define IMAGE_SIZE (320 * 1024)
+#define SAMPLE_PERIOD_MS (1000 / CONTROL_LOOP_FREQUENCY)
+#define HOURS(h) ((h) * 3600 * 1000 / SAMPLE_PERIOD_MS)
+#define N_SAMPLES HOURS(6)
+#define N_WRAP_RUNS 12
+
+static runLog_t runLog;
+static runLog_t archiveLog;
+
+// The archiver takes the recorder's log lock, there is only one thread here
+runLog_t* runRecorder_lockLog(recorderLog_t which)
+{
+    return (which == recorderLog_archives) ? &archiveLog : &runLog;
+}
+
+void runRecorder_unlockLog(void)
+{
+}
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void synthSample(size_t i, uint32_t* time, float temps[])
+{
+    const float ambient[n_tempSensors] = {18.0, 15.0, 18.0, 15.0, 15.0};
+    const float target[n_tempSensors] = {78.3, 96.5, 24.0, 20.5, 17.0};
+    const float tau[n_tempSensors] = {2400, 3000, 1800, 1800, 1200};
+    float t_s = i * SAMPLE_PERIOD_MS / 1000.0f;
+
+    *time = 5000 + i * SAMPLE_PERIOD_MS + (i % 97 == 0 ? 13 : 0);
+    for (int c = 0; c < n_tempSensors; c++) {
+        float t = target[c] - (target[c] - ambient[c]) * expf(-t_s / tau[c]);
+        t += 0.06f * sinf(t_s / (37.0f + c));
+        temps[c] = roundf(t * 8) / 8;
+    }
+}
+
+static size_t recordRun(uint32_t runId, size_t n_samples)
+{
+    uint8_t buf[RUNLOG_BLOCK_PAYLOAD];
+    tsEncoder_t enc;
+    uint32_t time, firstTime = 0;
+    float temps[n_tempSensors];
+    size_t bytes = 0;
+
+    tsEncoder_init(&enc, buf, sizeof(buf), n_tempSensors);
+    for (size_t i = 0; i <= n_samples; i++) {
+        bool last = (i == n_samples);
+        if (!last) {
+            synthSample(i, &time, temps);
+        }
+        if (last || !tsEncoder_append(&enc, time, temps)) {
+            runLogBlockInfo_t info = {
+                .type = runLogBlock_samples,
+                .n_channels = n_tempSensors,
+                .len = tsEncoder_bytes(&enc),
+                .runId = runId,
+                .n_samples = enc.n_samples,
+                .firstTime = firstTime
+            };
+            runLog_append(&runLog, &info, buf);
+            bytes += info.len;
+            tsEncoder_init(&enc, buf, sizeof(buf), n_tempSensors);
+            if (!last) {
+                firstTime = time;
+                tsEncoder_append(&enc, time, temps);
+            }
+        } else if (enc.n_samples == 1) {
+            firstTime = time;
+        }
+    }
+    return bytes;
+}
+
+// Reads a whole archive into memory. Returns NULL if it can't be opened or
+// the read fails part way
+static uint8_t* readArchive(uint32_t runId, size_t* archiveLen)
+{
+    runArchiveReader_t reader;
+    const uint8_t* data;
+    size_t len;
+    esp_err_t err;
+
+    if (runArchive_open(&reader, runId) != ESP_OK) {
+        return NULL;
+    }
+    uint8_t* archive = malloc(reader.size);
+    *archiveLen = 0;
+    while ((err = runArchive_read(&reader, &data, &len)) == ESP_OK) {
+        memcpy(&archive[*archiveLen], data, len);
+        *archiveLen += len;
+    }
+    if (err != ESP_ERR_NOT_FOUND || *archiveLen != reader.size) {
+        free(archive);
+        return NULL;
+    }
+    return archive;
+}
+
+// Decompresses the archive and checks it against the synthetic samples
+static int verifyArchive(const uint8_t* archive, size_t len, size_t n_samples)
+{
+    heatshrink_decoder* hsd = heatshrink_decoder_alloc(256, RUNARCHIVE_WINDOW_BITS, RUNARCHIVE_LOOKAHEAD_BITS);
+    size_t capacity = 64 * 1024 + len * 16;
+    uint8_t* raw = malloc(capacity);
+    size_t rawLen = 0, sunk, polled;
+
+    for (size_t i = 0; i < len; i += sunk) {
+        heatshrink_decoder_sink(hsd, (uint8_t*) &archive[i], len - i, &sunk);
+        do {
+            heatshrink_decoder_poll(hsd, &raw[rawLen], capacity - rawLen, &polled);
+            rawLen += polled;
+        } while (polled);
+    }
+    heatshrink_decoder_finish(hsd);
+    heatshrink_decoder_free(hsd);
+
+    // Two header lines, then tsCodec blocks led by a sample count and length
+    uint8_t* p = memchr(raw, '\n', rawLen);
+    p = p ? memchr(p + 1, '\n', rawLen - (p + 1 - raw)) : NULL;
+    if (p == NULL || strncmp((char*) raw, "# run ", 6) != 0) {
+        printf("Archive header missing\n");
+        free(raw);
+        return 1;
+    }
+    p++;
+
+    size_t n = 0;
+    while (p + 4 <= raw + rawLen) {
+        uint32_t blockSamples = p[0] | p[1] << 8;
+        size_t blockLen = p[2] | p[3] << 8;
+        tsDecoder_t dec;
+        uint32_t time, expectTime;
+        float temps[n_tempSensors], expect[n_tempSensors];
+
+        p += 4;
+        tsDecoder_init(&dec, p, blockLen, n_tempSensors, blockSamples);
+        while (tsDecoder_next(&dec, &time, temps)) {
+            synthSample(n, &expectTime, expect);
+            if (time != expectTime) {
+                printf("Time mismatch at sample %zu\n", n);
+                free(raw);
+                return 1;
+            }
+            for (int c = 0; c < n_tempSensors; c++) {
+                if (fabsf(temps[c] - expect[c]) > 0.5f / TSCODEC_FIXED_SCALE) {
+                    printf("Value mismatch at sample %zu channel %d\n", n, c);
+                    free(raw);
+                    return 1;
+                }
+            }
+            n++;
+        }
+        p += blockLen;
+    }
+
+    free(raw);
+    if (n != n_samples) {
+        printf("Archive holds %zu of %zu samples\n", n, n_samples);
+        return 1;
+    }
+    return 0;
+}
+
+static void countArchive(uint32_t runId, uint32_t size, uint32_t n_samples, void* ctx)
+{
+    uint32_t* listed = ctx;
+    if (listed[0] == 0) {
+        listed[1] = runId;
+    }
+    listed[0]++;
+    listed[2] = runId;
+}
+
+int main(int argc, char** argv)
+{
+    fileStorage_t samplesFs, archivesFs;
+    runLogStorage_t storage;
+    size_t archiveLen;
+    int failed = 0;
+
+    remove("runArchiveBench.bin");
+    remove("runArchiveBench-archives.bin");
+    fileStorage_open(&samplesFs, "runArchiveBench.bin", IMAGE_SIZE - RUNLOG_ARCHIVE_SIZE, &storage);
+    runLog_mount(&runLog, &storage);
+    fileStorage_open(&archivesFs, "runArchiveBench-archives.bin", RUNLOG_ARCHIVE_SIZE, &storage);
+    runLog_mount(&archiveLog, &storage);
+
+    uint32_t runId = runLog_newRun(&runLog);
+    size_t rawBytes = recordRun(runId, N_SAMPLES);
+
+    double t0 = nowSeconds();
+    if (runArchive_create(runId) != ESP_OK) {
+        printf("Archiving failed\n");
+        return 1;
+    }
+    double archiveTime = nowSeconds() - t0;
+
+    uint8_t* archive = readArchive(runId, &archiveLen);
+    if (archive == NULL) {
+        printf("Reading the archive failed\n");
+        return 1;
+    }
+
+    size_t csvBytes = 0;
+    for (size_t i = 0; i < N_SAMPLES; i++) {
+        uint32_t time;
+        float temps[n_tempSensors];
+        char line[128];
+        synthSample(i, &time, temps);
+        csvBytes += snprintf(line, sizeof(line), "%u,%.4f,%.4f,%.4f,%.4f,%.4f\n", time,
+                             temps[0], temps[1], temps[2], temps[3], temps[4]);
+    }
+
+    printf("Samples:            %d\n", N_SAMPLES);
+    printf("Plain CSV:          %zu bytes\n", csvBytes);
+    printf("tsCodec blocks:     %zu bytes (%.2f bytes/sample)\n", rawBytes, (double) rawBytes / N_SAMPLES);
+    printf("Archive:            %zu bytes (%.2f bytes/sample, %.1f:1 vs CSV, %.1f:1 vs tsCodec)\n", archiveLen,
+           (double) archiveLen / N_SAMPLES, (double) csvBytes / archiveLen, (double) rawBytes / archiveLen);
+    printf("Archive time:       %.1f ms\n", archiveTime * 1e3);
+
+    if (argc > 1) {
+        FILE* f = fopen(argv[1], "wb");
+        fwrite(archive, 1, archiveLen, f);
+        fclose(f);
+    }
+    failed |= verifyArchive(archive, archiveLen, N_SAMPLES);
+    free(archive);
+
+    // About the longest run the sample log holds, and one it doesn't
+    runId = runLog_newRun(&runLog);
+    rawBytes = recordRun(runId, HOURS(11));
+    archive = (runArchive_create(runId) == ESP_OK) ? readArchive(runId, &archiveLen) : NULL;
+    printf("11 h run:           %s\n", archive ? "archived" : "FAILED");
+    failed |= archive == NULL || verifyArchive(archive, archiveLen, HOURS(11));
+    free(archive);
+
+    runId = runLog_newRun(&runLog);
+    rawBytes = recordRun(runId, HOURS(16));
+    esp_err_t err = runArchive_create(runId);
+    archive = readArchive(runId, &archiveLen);
+    printf("16 h run:           %zu bytes of samples, %s\n", rawBytes,
+           (err == ESP_ERR_INVALID_SIZE && archive == NULL) ? "refused" : "FAILED");
+    failed |= err != ESP_ERR_INVALID_SIZE || archive != NULL;
+    free(archive);
+
+    // Wrap the archive log, only whole archives may be listed and served
+    uint32_t firstWrapRun = runLog.lastRunId + 1;
+    for (int i = 0; i < N_WRAP_RUNS; i++) {
+        runId = runLog_newRun(&runLog);
+        recordRun(runId, HOURS(4));
+        failed |= runArchive_create(runId) != ESP_OK;
+    }
+    uint32_t listed[3] = {0, 0, 0};
+    runArchive_list(countArchive, listed);
+    int served = 0;
+    for (uint32_t id = 1; id <= runId; id++) {
+        archive = readArchive(id, &archiveLen);
+        if (archive != NULL) {
+            failed |= verifyArchive(archive, archiveLen, id < firstWrapRun ? HOURS(id == 1 ? 6 : 11) : HOURS(4));
+            served++;
+        }
+        free(archive);
+    }
+    printf("Archive log wrap:   runs %u to %u listed, %d served\n", listed[1], listed[2], served);
+    failed |= listed[0] != served || listed[2] != runId || listed[1] <= firstWrapRun;
+
+    // A block lost while an archive is being read fails the read
+    runArchiveReader_t reader;
+    const uint8_t* data;
+    size_t len;
+    runArchive_open(&reader, runId);
+    runArchive_read(&reader, &data, &len);
+    size_t addr = reader.cursor.sector * RUNLOG_SECTOR_SIZE + reader.cursor.offset + 64;
+    uint8_t byte = 0;
+    while (byte == 0) {
+        storage.read(storage.ctx, ++addr, &byte, 1);
+    }
+    byte &= byte - 1;                   // Flash writes can only clear bits
+    storage.write(storage.ctx, addr, &byte, 1);
+    while ((err = runArchive_read(&reader, &data, &len)) == ESP_OK) {
+    }
+    printf("Lost block:         %s\n", err == ESP_ERR_INVALID_STATE ? "read fails" : "FAILED");
+    failed |= err != ESP_ERR_INVALID_STATE || runArchive_open(&reader, runId) != ESP_ERR_NOT_FOUND;
+
+    printf("%s\n", failed ? "FAILED" : "OK");
+
+    fileStorage_close(&samplesFs);
+    fileStorage_close(&archivesFs);
+    remove("runArchiveBench.bin");
+    remove("runArchiveBench-archives.bin");
+    return failed;
+}
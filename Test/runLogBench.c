@@ -0,0 +1,200 @@
+/*
+*   Host benchmark and consistency check for the run log.
+*
+*   Usage: runLogBench [image.bin]
+*
+*   Records a number of synthetic runs into a flash image the size of the
+*   runlog partition, wrapping the log several times, then measures mount
+*   and lookup time, verifies every run still held reads back intact and
+*   checks that a power cut in the middle of any write leaves the log
+*   mountable with only the torn block lost.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "runLog.h"
+#include "runLogFileStorage.h"
+
+#define IMAGE_SIZE (320 * 1024)
+#define N_RUNS 60
+#define BLOCKS_PER_RUN 200
+#define PAYLOAD_LEN 480
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Payload contents derived from run and block number so reads can be verified
+static void fillPayload(uint8_t* buf, uint32_t runId, uint32_t block)
+{
+    uint32_t x = runId * 2654435761u ^ block * 40503u;
+    for (int i = 0; i < PAYLOAD_LEN; i++) {
+        x = x * 1103515245 + 12345;
+        buf[i] = x >> 16;
+    }
+}
+
+static void appendBlock(runLog_t* log, uint32_t runId, uint32_t block, esp_err_t* err)
+{
+    uint8_t payload[PAYLOAD_LEN];
+    runLogBlockInfo_t info = {
+        .type = runLogBlock_samples,
+        .n_channels = 5,
+        .len = PAYLOAD_LEN,
+        .runId = runId,
+        .n_samples = 150,
+        .firstTime = block * 60000
+    };
+
+    fillPayload(payload, runId, block);
+    *err = runLog_append(log, &info, payload);
+}
+
+// Reads a run back, returns the number of blocks or -1 on a mismatch
+static int verifyRun(runLog_t* log, uint32_t runId)
+{
+    runLogCursor_t cursor;
+    runLogBlockInfo_t info;
+    uint8_t payload[RUNLOG_MAX_PAYLOAD];
+    uint8_t expected[PAYLOAD_LEN];
+    int n = 0;
+
+    if (runLog_findRun(log, runId, &cursor) != ESP_OK) {
+        return 0;
+    }
+    while (runLog_nextBlock(log, &cursor, &info, payload) == ESP_OK) {
+        uint32_t block = info.firstTime / 60000;
+        fillPayload(expected, runId, block);
+        if (info.runId != runId || info.len != PAYLOAD_LEN || memcmp(payload, expected, PAYLOAD_LEN)) {
+            return -1;
+        }
+        n++;
+    }
+    return n;
+}
+
+static int crashTest(const char* path)
+{
+    int failures = 0;
+
+    // Cut power at a range of points within one block append
+    for (long budget = 0; budget < PAYLOAD_LEN + 64; budget += 4) {
+        fileStorage_t fs;
+        runLogStorage_t storage;
+        runLog_t log;
+        esp_err_t err;
+
+        remove(path);
+        fileStorage_open(&fs, path, 16 * RUNLOG_SECTOR_SIZE, &storage);
+        runLog_mount(&log, &storage);
+        uint32_t runId = runLog_newRun(&log);
+        for (uint32_t b = 0; b < 7; b++) {
+            appendBlock(&log, runId, b, &err);
+        }
+
+        fs.writeBudget = budget;
+        appendBlock(&log, runId, 7, &err);
+        fs.writeBudget = -1;
+
+        if (runLog_mount(&log, &storage) != ESP_OK) {
+            printf("  budget %ld: mount failed\n", budget);
+            failures++;
+        } else {
+            int n = verifyRun(&log, runId);
+            if (n != 7 && n != 8) {
+                printf("  budget %ld: read back %d blocks\n", budget, n);
+                failures++;
+            }
+            // The log must keep accepting blocks after the cut
+            appendBlock(&log, runId, 9, &err);
+            if (err != ESP_OK || verifyRun(&log, runId) < 8) {
+                printf("  budget %ld: append after crash failed\n", budget);
+                failures++;
+            }
+        }
+        fileStorage_close(&fs);
+    }
+    remove(path);
+    return failures;
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = argc > 1 ? argv[1] : "runLogBench.bin";
+    fileStorage_t fs;
+    runLogStorage_t storage;
+    runLog_t log;
+    esp_err_t err = ESP_OK;
+    int failures = 0;
+
+    remove(path);
+    fileStorage_open(&fs, path, IMAGE_SIZE, &storage);
+    if (runLog_mount(&log, &storage) != ESP_OK) {
+        printf("Format failed\n");
+        return 1;
+    }
+
+    double t0 = nowSeconds();
+    for (int r = 0; r < N_RUNS; r++) {
+        uint32_t runId = runLog_newRun(&log);
+        for (uint32_t b = 0; b < BLOCKS_PER_RUN && err == ESP_OK; b++) {
+            appendBlock(&log, runId, b, &err);
+        }
+    }
+    double appendTime = nowSeconds() - t0;
+    if (err != ESP_OK) {
+        printf("Append failed (%d)\n", err);
+        return 1;
+    }
+
+    size_t bytes = (size_t) N_RUNS * BLOCKS_PER_RUN * PAYLOAD_LEN;
+    printf("Appended %d blocks (%zu KB) in %.3f s, %.1f MB/s\n", N_RUNS * BLOCKS_PER_RUN,
+           bytes / 1024, appendTime, bytes / appendTime / 1e6);
+
+    uint32_t minErase = UINT32_MAX, maxErase = 0;
+    for (int i = 0; i < IMAGE_SIZE / RUNLOG_SECTOR_SIZE; i++) {
+        minErase = fs.erases[i] < minErase ? fs.erases[i] : minErase;
+        maxErase = fs.erases[i] > maxErase ? fs.erases[i] : maxErase;
+    }
+    printf("Sector erase counts: min %u max %u\n", minErase, maxErase);
+
+    t0 = nowSeconds();
+    runLog_mount(&log, &storage);
+    printf("Mount: %.1f us\n", (nowSeconds() - t0) * 1e6);
+
+    uint32_t oldest = runLog_oldestRun(&log);
+    printf("Runs held: %u to %u\n", oldest, log.lastRunId);
+
+    t0 = nowSeconds();
+    runLogCursor_t cursor;
+    for (uint32_t r = oldest; r <= log.lastRunId; r++) {
+        runLog_findRun(&log, r, &cursor);
+    }
+    printf("findRun: %.2f us per run\n", (nowSeconds() - t0) * 1e6 / (log.lastRunId - oldest + 1));
+
+    // Every run but the oldest (which may be partly overwritten) must be complete
+    for (uint32_t r = oldest; r <= log.lastRunId; r++) {
+        int n = verifyRun(&log, r);
+        if (n < 0 || (r != oldest && n != BLOCKS_PER_RUN)) {
+            printf("Run %u: read back %d blocks\n", r, n);
+            failures++;
+        }
+    }
+    if (verifyRun(&log, oldest - 1) != 0) {
+        printf("Overwritten run %u still found\n", oldest - 1);
+        failures++;
+    }
+    fileStorage_close(&fs);
+    remove(path);
+
+    printf("Crash consistency...\n");
+    failures += crashTest(path);
+
+    printf("%s\n", failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,100 @@
+#include <string.h>
+#include "runLogFileStorage.h"
+
+static esp_err_t fileRead(void* ctx, size_t offset, void* dst, size_t len)
+{
+    fileStorage_t* fs = ctx;
+    if (offset + len > fs->size || fseek(fs->f, offset, SEEK_SET) != 0) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return fread(dst, 1, len, fs->f) == len ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t fileWrite(void* ctx, size_t offset, const void* src, size_t len)
+{
+    fileStorage_t* fs = ctx;
+    uint8_t buf[RUNLOG_SECTOR_SIZE];
+    esp_err_t err = ESP_OK;
+
+    if (len > sizeof(buf) || fileRead(ctx, offset, buf, len) != ESP_OK) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Simulated power cut, only the first part of the write reaches flash
+    if (fs->writeBudget >= 0 && (long) len > fs->writeBudget) {
+        len = fs->writeBudget;
+        err = ESP_FAIL;
+    }
+    if (fs->writeBudget >= 0) {
+        fs->writeBudget -= len;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        buf[i] &= ((const uint8_t*) src)[i];
+    }
+
+    fseek(fs->f, offset, SEEK_SET);
+    if (fwrite(buf, 1, len, fs->f) != len) {
+        return ESP_FAIL;
+    }
+    return err;
+}
+
+static esp_err_t fileErase(void* ctx, size_t offset, size_t len)
+{
+    fileStorage_t* fs = ctx;
+    uint8_t blank[RUNLOG_SECTOR_SIZE];
+
+    if (offset % RUNLOG_SECTOR_SIZE || len % RUNLOG_SECTOR_SIZE || offset + len > fs->size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (fs->writeBudget == 0) {
+        return ESP_FAIL;
+    }
+
+    memset(blank, 0xFF, sizeof(blank));
+    fseek(fs->f, offset, SEEK_SET);
+    for (size_t i = 0; i < len; i += RUNLOG_SECTOR_SIZE) {
+        fs->erases[(offset + i) / RUNLOG_SECTOR_SIZE]++;
+        if (fwrite(blank, 1, sizeof(blank), fs->f) != sizeof(blank)) {
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t fileStorage_open(fileStorage_t* fs, const char* path, size_t size, runLogStorage_t* storage)
+{
+    memset(fs, 0, sizeof(fileStorage_t));
+    fs->size = size;
+    fs->writeBudget = -1;
+    fs->f = fopen(path, "r+b");
+
+    if (fs->f == NULL) {
+        // New image, start from erased flash
+        uint8_t blank[RUNLOG_SECTOR_SIZE];
+        memset(blank, 0xFF, sizeof(blank));
+        fs->f = fopen(path, "w+b");
+        if (fs->f == NULL) {
+            return ESP_FAIL;
+        }
+        for (size_t i = 0; i < size; i += sizeof(blank)) {
+            fwrite(blank, 1, sizeof(blank), fs->f);
+        }
+    }
+
+    storage->read = fileRead;
+    storage->write = fileWrite;
+    storage->erase = fileErase;
+    storage->size = size;
+    storage->ctx = fs;
+    return ESP_OK;
+}
+
+void fileStorage_close(fileStorage_t* fs)
+{
+    if (fs->f) {
+        fclose(fs->f);
+        fs->f = NULL;
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdio.h>
+#include "runLog.h"
+
+/*
+*   Host backend for the run log, backed by a file holding a flash image.
+*   Writes are ANDed into the existing contents and erases fill with 0xFF
+*   so the file behaves like the NOR flash of the runlog partition.
+*/
+
+typedef struct {
+    FILE* f;
+    size_t size;
+    long writeBudget;                   // Bytes left before a simulated power cut, -1 for no limit
+    uint32_t erases[RUNLOG_MAX_SECTORS];
+} fileStorage_t;
+
+/*
+*   --------------------------------------------------------------------
+*   fileStorage_open
+*   --------------------------------------------------------------------
+*   Opens (creating if needed) a flash image of the given size and fills
+*   in the storage callbacks for runLog_mount
+*/
+esp_err_t fileStorage_open(fileStorage_t* fs, const char* path, size_t size, runLogStorage_t* storage);
+
+void fileStorage_close(fileStorage_t* fs);
@@ -0,0 +1,157 @@
+/*
+*   Host benchmark for the temperature time series codec.
+*
+*   Usage: tsCodecBench [trace.csv]
+*
+*   The trace is a CSV of "time_ms,T0,T1,T2,T3,T4" lines as recorded from
+*   the controller. If no trace is given a synthetic 6 hour run sampled
+*   at the sensor rate is generated instead.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "tsCodec.h"
+
+#define N_CHANNELS 5
+#define SAMPLE_PERIOD_MS 400
+#define SYNTH_SAMPLES (6 * 3600 * 1000 / SAMPLE_PERIOD_MS)
+#define BENCH_REPEATS 20
+
+typedef struct {
+    uint32_t time;
+    float temps[N_CHANNELS];
+} sample_t;
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Quantise to the 0.125 degC step of an 11 bit DS18B20 read
+static float quantise(float t)
+{
+    return roundf(t * 8) / 8;
+}
+
+static size_t loadTrace(const char* path, sample_t** samples)
+{
+    size_t n = 0, cap = 1024;
+    char line[256];
+    FILE* f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    *samples = malloc(cap * sizeof(sample_t));
+    while (fgets(line, sizeof(line), f)) {
+        sample_t s;
+        if (sscanf(line, "%u,%f,%f,%f,%f,%f", &s.time, &s.temps[0], &s.temps[1],
+                   &s.temps[2], &s.temps[3], &s.temps[4]) != 1 + N_CHANNELS) {
+            continue;       // Skip headers and malformed lines
+        }
+        if (n == cap) {
+            cap *= 2;
+            *samples = realloc(*samples, cap * sizeof(sample_t));
+        }
+        (*samples)[n++] = s;
+    }
+
+    fclose(f);
+    return n;
+}
+
+static size_t synthTrace(sample_t** samples)
+{
+    const float ambient[N_CHANNELS] = {18.0, 18.0, 15.0, 15.0, 15.0};
+    const float target[N_CHANNELS] = {78.3, 96.5, 24.0, 20.5, 17.0};
+    const float tau[N_CHANNELS] = {2400, 3000, 1800, 1800, 1200};
+    uint32_t jitter = 12345;
+
+    *samples = malloc(SYNTH_SAMPLES * sizeof(sample_t));
+    for (size_t i = 0; i < SYNTH_SAMPLES; i++) {
+        sample_t* s = &(*samples)[i];
+        float t_s = i * SAMPLE_PERIOD_MS / 1000.0f;
+
+        // Occasional late samples, as seen when the sensor task is preempted
+        jitter = jitter * 1103515245 + 12345;
+        s->time = i * SAMPLE_PERIOD_MS + ((jitter >> 16) % 50 == 0 ? (jitter >> 8) % 30 : 0);
+
+        for (int c = 0; c < N_CHANNELS; c++) {
+            float t = target[c] - (target[c] - ambient[c]) * expf(-t_s / tau[c]);
+            t += 0.06f * sinf(t_s / (37.0f + c));
+            s->temps[c] = quantise(t);
+        }
+    }
+
+    return SYNTH_SAMPLES;
+}
+
+int main(int argc, char* argv[])
+{
+    sample_t* samples;
+    size_t n = argc > 1 ? loadTrace(argv[1], &samples) : synthTrace(&samples);
+    size_t capacity = n * TSCODEC_MAX_SAMPLE_BYTES(N_CHANNELS);
+    uint8_t* buf = malloc(capacity);
+    tsEncoder_t enc;
+    tsDecoder_t dec;
+    double t0, encTime, decTime;
+
+    if (n == 0) {
+        fprintf(stderr, "No samples in trace\n");
+        return 1;
+    }
+
+    t0 = nowSeconds();
+    for (int r = 0; r < BENCH_REPEATS; r++) {
+        tsEncoder_init(&enc, buf, capacity, N_CHANNELS);
+        for (size_t i = 0; i < n; i++) {
+            tsEncoder_append(&enc, samples[i].time, samples[i].temps);
+        }
+    }
+    encTime = (nowSeconds() - t0) / BENCH_REPEATS;
+
+    // Verify round trip before timing decode
+    tsDecoder_init(&dec, buf, tsEncoder_bytes(&enc), N_CHANNELS, enc.n_samples);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t time;
+        float temps[N_CHANNELS];
+        if (!tsDecoder_next(&dec, &time, temps) || time != samples[i].time) {
+            fprintf(stderr, "Round trip failed at sample %zu\n", i);
+            return 1;
+        }
+        for (int c = 0; c < N_CHANNELS; c++) {
+            if (fabsf(temps[c] - samples[i].temps[c]) > 0.5f / TSCODEC_FIXED_SCALE) {
+                fprintf(stderr, "Value mismatch at sample %zu channel %d\n", i, c);
+                return 1;
+            }
+        }
+    }
+
+    t0 = nowSeconds();
+    for (int r = 0; r < BENCH_REPEATS; r++) {
+        uint32_t time;
+        float temps[N_CHANNELS];
+        tsDecoder_init(&dec, buf, tsEncoder_bytes(&enc), N_CHANNELS, enc.n_samples);
+        while (tsDecoder_next(&dec, &time, temps));
+    }
+    decTime = (nowSeconds() - t0) / BENCH_REPEATS;
+
+    size_t rawBytes = n * (sizeof(uint32_t) + N_CHANNELS * sizeof(float));
+    size_t encBytes = tsEncoder_bytes(&enc);
+    printf("Samples:            %zu (%s)\n", n, argc > 1 ? argv[1] : "synthetic");
+    printf("Raw size:           %zu bytes\n", rawBytes);
+    printf("Encoded size:       %zu bytes (%.2f bits/sample)\n", encBytes, encBytes * 8.0 / n);
+    printf("Compression ratio:  %.1f:1\n", (double) rawBytes / encBytes);
+    printf("Encode throughput:  %.2f Msamples/s\n", n / encTime / 1e6);
+    printf("Decode throughput:  %.2f Msamples/s\n", n / decTime / 1e6);
+
+    free(buf);
+    free(samples);
+    return 0;
+}
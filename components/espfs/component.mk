@@ -1,7 +1,7 @@
-COMPONENT_ADD_INCLUDEDIRS := include
-COMPONENT_PRIV_INCLUDEDIRS := src heatshrink/src heatshrink/include
+COMPONENT_ADD_INCLUDEDIRS := include heatshrink/include heatshrink/src
+COMPONENT_PRIV_INCLUDEDIRS := src
 COMPONENT_SRCDIRS := src heatshrink/src
-COMPONENT_OBJS := src/espfs.o src/espfs_vfs.o heatshrink/src/heatshrink_decoder.o
+COMPONENT_OBJS := src/espfs.o src/espfs_vfs.o heatshrink/src/heatshrink_decoder.o heatshrink/src/heatshrink_encoder.o
 COMPONENT_EXTRA_CLEAN := mkespfsimage/*
 
 IMAGEROOTDIR := $(subst ",,$(CONFIG_ESPFS_IMAGEROOTDIR))
@@ -23,4 +23,17 @@
 /* Use indexing for faster compression. (This requires additional space.) */
 #define HEATSHRINK_USE_INDEX 1
 
+/* Chain the index on a hash of the shortest match worth encoding instead
+ * of on single bytes, and look at no more than HEATSHRINK_HASH_CHAIN_DEPTH
+ * earlier positions per match. Much faster with large windows, at the cost
+ * of 2 << HEATSHRINK_HASH_BITS bytes of stack while indexing. Requires
+ * HEATSHRINK_USE_INDEX. */
+#ifndef HEATSHRINK_USE_HASH_CHAIN
+#define HEATSHRINK_USE_HASH_CHAIN 0
+#endif
+#define HEATSHRINK_HASH_BITS 12
+#ifndef HEATSHRINK_HASH_CHAIN_DEPTH
+#define HEATSHRINK_HASH_CHAIN_DEPTH 4096
+#endif
+
 #endif
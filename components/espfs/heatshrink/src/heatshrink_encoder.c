@@ -52,6 +52,13 @@ typedef struct {
 
 #define MATCH_NOT_FOUND ((uint16_t)-1)
 
+#if HEATSHRINK_USE_HASH_CHAIN
+#if !HEATSHRINK_USE_INDEX
+#error "HEATSHRINK_USE_HASH_CHAIN requires HEATSHRINK_USE_INDEX"
+#endif
+#define HASH_CHAIN_END ((uint16_t)-1)
+#endif
+
 static uint16_t get_input_offset(heatshrink_encoder *hse);
 static uint16_t get_input_buffer_size(heatshrink_encoder *hse);
 static uint16_t get_lookahead_size(heatshrink_encoder *hse);
@@ -400,8 +407,54 @@ static uint16_t get_lookahead_size(heatshrink_encoder *hse) {
     (void)hse;
 }
 
+#if HEATSHRINK_USE_HASH_CHAIN
+/* Matches shorter than this cost more bits than the literals they
+ * replace, so find_longest_match never uses them. It is 2 up to
+ * window + lookahead bits of 14, 3 up to 22, and 4 from 23 (e.g. 15/8). */
+static uint16_t get_min_match_length(heatshrink_encoder *hse) {
+    return (1 + HEATSHRINK_ENCODER_WINDOW_BITS(hse) +
+        HEATSHRINK_ENCODER_LOOKAHEAD_BITS(hse)) / 8 + 1;
+}
+
+/* Hashes at most 3 bytes. When min_len is 4 the chains link positions
+ * whose first 3 bytes match, a superset of those that can start a useful
+ * match, and find_longest_match drops the extra ones by length. */
+static uint16_t hash_bytes(const uint8_t *p, uint16_t min_len) {
+    uint32_t v = p[0] | (p[1] << 8);
+    if (min_len > 2) { v |= p[2] << 16; }
+    return (uint16_t)((v * 2654435761u) >> (32 - HEATSHRINK_HASH_BITS));
+}
+#endif
+
 static void do_indexing(heatshrink_encoder *hse) {
-#if HEATSHRINK_USE_INDEX
+#if HEATSHRINK_USE_HASH_CHAIN
+    /* As below, but each position is linked to the previous one whose
+     * first min_len bytes (at most 3) hash the same, so a chain holds the
+     * positions that can start a useful match (and the odd other one,
+     * from collisions or a min_len of 4). Positions
+     * are unsigned so 15 bit windows work, HASH_CHAIN_END ends a chain.
+     * The last min_len - 1 positions are never searched from, and any
+     * match starting there would be too short, so they aren't chained. */
+    struct hs_index *hsi = HEATSHRINK_ENCODER_INDEX(hse);
+    uint16_t last[1 << HEATSHRINK_HASH_BITS];
+    memset(last, 0xFF, sizeof(last));
+
+    const uint8_t * const data = hse->buffer;
+    uint16_t * const index = (uint16_t *)hsi->index;
+    const uint16_t min_len = get_min_match_length(hse);
+
+    const uint32_t end = (uint32_t)get_input_offset(hse) + hse->input_size;
+
+    for (uint32_t i=0; i<end; i++) {
+        if (i + min_len > end) {
+            index[i] = HASH_CHAIN_END;
+            continue;
+        }
+        uint16_t h = hash_bytes(&data[i], min_len);
+        index[i] = last[h];
+        last[h] = i;
+    }
+#elif HEATSHRINK_USE_INDEX
     /* Build an index array I that contains flattened linked lists
      * for the previous instances of every byte in the buffer.
      * 
@@ -426,9 +479,10 @@ static void do_indexing(heatshrink_encoder *hse) {
     int16_t * const index = hsi->index;
 
     const uint16_t input_offset = get_input_offset(hse);
-    const uint16_t end = input_offset + hse->input_size;
+    /* Wider than the offsets, a full buffer of a 15 bit window ends at 1 << 16 */
+    const uint32_t end = (uint32_t)input_offset + hse->input_size;
 
-    for (uint16_t i=0; i<end; i++) {
+    for (uint32_t i=0; i<end; i++) {
         uint8_t v = data[i];
         int16_t lv = last[v];
         index[i] = lv;
@@ -460,7 +514,30 @@ static uint16_t find_longest_match(heatshrink_encoder *hse, uint16_t start,
 
     uint16_t len = 0;
     uint8_t * const needlepoint = &buf[end];
-#if HEATSHRINK_USE_INDEX
+#if HEATSHRINK_USE_HASH_CHAIN
+    struct hs_index *hsi = HEATSHRINK_ENCODER_INDEX(hse);
+    const uint16_t * const index = (const uint16_t *)hsi->index;
+    uint16_t pos = maxlen < get_min_match_length(hse) ? HASH_CHAIN_END : index[end];
+    uint16_t depth = HEATSHRINK_HASH_CHAIN_DEPTH;
+
+    while (pos != HASH_CHAIN_END && pos >= start && depth-- > 0) {
+        uint8_t * const pospoint = &buf[pos];
+
+        /* Chained positions can differ in the first bytes on a hash
+         * collision, so compare from the start. */
+        if (pospoint[match_maxlen] == needlepoint[match_maxlen]) {
+            for (len = 0; len < maxlen; len++) {
+                if (pospoint[len] != needlepoint[len]) break;
+            }
+            if (len > match_maxlen) {
+                match_maxlen = len;
+                match_index = pos;
+                if (len == maxlen) { break; } /* won't find better */
+            }
+        }
+        pos = index[pos];
+    }
+#elif HEATSHRINK_USE_INDEX
     struct hs_index *hsi = HEATSHRINK_ENCODER_INDEX(hse);
     int16_t pos = hsi->index[end];
 
@@ -22,15 +22,37 @@ struct EspFsStat {
     enum EspFsStatType type;
     int32_t size;
     int8_t flags;
+    uint64_t hash;                  // Of the contents, 0 if the image stores none
+};
+
+enum EspFsIntegrity {
+    ESPFS_INTEGRITY_UNCHECKED,
+    ESPFS_INTEGRITY_OK,
+    ESPFS_INTEGRITY_BAD,
+    ESPFS_INTEGRITY_NO_CHECKSUM,    // Image predates trailers
+};
+
+struct EspFsPoolStats {
+    uint16_t handles;               // Pool sizes, from Kconfig
+    uint16_t handlesInUse;
+    uint16_t handlesPeak;
+    uint32_t handleFallbacks;       // Opens that had to malloc a handle
+    uint16_t decoders;
+    uint16_t decodersInUse;
+    uint16_t decodersPeak;
+    uint32_t decoderFallbacks;      // Pool empty, or the file needs a larger window
 };
 
 typedef struct EspFsConfig EspFsConfig;
 typedef struct EspFs EspFs;
 typedef struct EspFsFile EspFsFile;
 typedef struct EspFsStat EspFsStat;
+typedef struct EspFsPoolStats EspFsPoolStats;
 
 EspFs* espFsInit(EspFsConfig* conf);
 void espFsDeinit(EspFs* fs);
+enum EspFsIntegrity espFsVerify(EspFs* fs);
+enum EspFsIntegrity espFsIntegrity(EspFs* fs);
 EspFsFile* espFsOpen(EspFs* fs, const char *fileName);
 int espFsStat(EspFs *fs, const char *fileName, EspFsStat *s);
 int espFsFlags(EspFsFile *fh);
@@ -40,6 +62,7 @@ bool espFsIsCompressed(EspFsFile *fh);
 int espFsAccess(EspFsFile *fh, void **buf);
 int espFsFilesize(EspFsFile *fh);
 void espFsClose(EspFsFile *fh);
+void espFsGetPoolStats(EspFsPoolStats *stats);
 
 #ifdef __cplusplus
 }
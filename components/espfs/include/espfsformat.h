@@ -17,6 +17,10 @@ with the FLAG_LASTFILE flag set.
 
 #define FLAG_LASTFILE (1<<0)
 #define FLAG_GZIP (1<<1)
+#define FLAG_INDEX (1<<2)
+#define FLAG_BLOCKS (1<<3)
+#define FLAG_HASH (1<<4)
+#define FLAG_LINK (1<<5)
 #define COMPRESS_NONE 0
 #define COMPRESS_HEATSHRINK 1
 #define ESPFS_MAGIC 0x73665345
@@ -30,4 +34,91 @@ typedef struct {
 	int32_t fileLenDecomp;
 } __attribute__((packed)) EspFsHeader;
 
+/*
+An image can start with a name index so files are found without walking the image. It is an
+entry with FLAG_INDEX set and no name, whose data is an EspFsIndexHeader followed by numBuckets
+EspFsIndexEntry. The buckets are an open addressed hash table on espFsHashName() of the file
+name, probed linearly. numBuckets is a power of two of at least twice the number of files, and
+an offset of 0 marks an empty bucket. Readers that don't know the index skip it like a file.
+*/
+
+typedef struct {
+	int16_t headerLen; //Buckets start this far into the index data, for later additions
+	int16_t reserved;
+	int32_t numFiles;
+	int32_t numBuckets;
+	int32_t lastOffset; //Of the FLAG_LASTFILE header, if headerLen covers it
+} __attribute__((packed)) EspFsIndexHeader;
+
+typedef struct {
+	uint32_t hash;
+	uint32_t offset; //From the start of the image to the file's EspFsHeader
+} __attribute__((packed)) EspFsIndexEntry;
+
+/*
+The FLAG_LASTFILE header carries an EspFsTrailer as its data. With lastOffset from the index a
+reader can check an image at mount without walking it, and verify the checksum at leisure.
+Images without a trailer end in a data-less FLAG_LASTFILE header.
+*/
+
+typedef struct {
+	int32_t numFiles;
+	int32_t length; //Of the whole image, including this trailer
+	uint32_t crc32; //CRC-32 (as zlib) of everything before the FLAG_LASTFILE header
+} __attribute__((packed)) EspFsTrailer;
+
+/*
+A heatshrink file with FLAG_BLOCKS set is compressed as blocks that each decode on their own,
+so it can be read from any block rather than only from the start. Its data is an
+EspFsBlockHeader, numBlocks offsets of the blocks from the start of the data, then the blocks.
+Every block but the last decodes to 1<<blockBits bytes.
+*/
+
+typedef struct {
+	uint8_t parms; //Heatshrink window and lookahead bits, as the first byte of other heatshrink files
+	uint8_t blockBits;
+	int16_t reserved;
+	int32_t numBlocks;
+} __attribute__((packed)) EspFsBlockHeader;
+
+/*
+A file with FLAG_HASH set ends its name area with ESPFS_HASH_LEN bytes of espFsHashContent() of
+the file as it was before compression, little endian, after the name's NUL and padding. nameLen
+counts them, so readers that don't know the hash still find the data and the name.
+*/
+
+#define ESPFS_HASH_LEN 8
+
+/*
+A file with FLAG_LINK set has the same contents as a file stored before it and shares its data.
+Its own data is an EspFsLink, and readers serve the other file's header and data in its place.
+The linked file is never a link itself.
+*/
+
+typedef struct {
+	int32_t back; //From this file's EspFsHeader back to the EspFsHeader of the file with the data
+} __attribute__((packed)) EspFsLink;
+
+//64-bit FNV-1a of a file's contents
+static inline uint64_t espFsHashContent(const uint8_t *data, size_t len)
+{
+	uint64_t hash = 14695981039346656037ull;
+	while (len--) {
+		hash ^= *data++;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+//32-bit FNV-1a of a file name as stored in the image, without a leading slash
+static inline uint32_t espFsHashName(const char *name)
+{
+	uint32_t hash = 2166136261u;
+	while (*name) {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
 #endif
\ No newline at end of file
@@ -10,6 +10,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
 #ifdef __MINGW32__
 #include <io.h>
 #endif
@@ -37,6 +40,69 @@
 #define O_BINARY 0
 #endif
 
+//Files are compressed by worker threads, then assembled in memory in input order so the
+//name index can go in front of them
+typedef struct IndexedFile {
+	char *name;
+	char *path;
+	size_t offset; //Of the file's header from the start of the files
+	//Filled in by compressFile
+	uint8_t *data; //Compressed as stored in the image
+	size_t size, csize;
+	uint64_t hash;
+	int8_t flags;
+	int8_t compression;
+	uint8_t parms; //Heatshrink window and lookahead bits, or the gzip level
+	char cached;
+	size_t baseSize; //With the level's parameters capped to the window limit, when searching for the best ones
+	struct IndexedFile *link; //Earlier file with the same data, stored as a link to it if set
+} IndexedFile;
+
+static uint8_t *outBuf = NULL;
+static size_t outLen = 0, outCap = 0;
+static IndexedFile *files = NULL;
+static int numFiles = 0, filesCap = 0;
+
+static int compType; //Default compression type
+static int compLvl = 9; //Z_BEST_COMPRESSION
+static char *cacheDir = NULL; //Keep compressed files here, keyed on their contents, if set
+static int bestWindowBits = 0; //Keep the smallest of all parameters with windows up to this, if set
+
+static int nextFile = 0;
+static pthread_mutex_t nextFileMutex = PTHREAD_MUTEX_INITIALIZER;
+
+void emit(const void *data, size_t len) {
+	if (outLen + len > outCap) {
+		outCap = (outLen + len) * 2;
+		outBuf = realloc(outBuf, outCap);
+		if (outBuf == NULL) {
+			perror("allocating image buffer");
+			exit(1);
+		}
+	}
+	memcpy(outBuf + outLen, data, len);
+	outLen += len;
+}
+
+//Pad the image out to a 32bit boundary
+void emitPadding() {
+	static const uint8_t zeros[4] = {0};
+	emit(zeros, (4 - (outLen & 3)) & 3);
+}
+
+void writeOut(const void *data, size_t len) {
+	const uint8_t *p = data;
+	while (len > 0) {
+		ssize_t r = write(1, p, len);
+		if (r <= 0) {
+			perror("writing image");
+			exit(1);
+		}
+		p += r;
+		len -= r;
+	}
+}
+
 //Routines to convert host format to the endianness used in the xtensa
 short htoxs(short in) {
 	char r[2];
@@ -55,27 +121,33 @@ int htoxl(int in) {
 }
 
 #ifdef ESPFS_HEATSHRINK
-size_t compressHeatshrink(uint8_t *in, int insize, uint8_t *out, int outsize, int level) {
+int blockBits = 0; //Compress files larger than a block of 1<<blockBits bytes in blocks, if set
+
+//Window and lookahead bits for compression levels 1..9
+void heatshrinkParms(int level, int *windowBits, int *lookaheadBits) {
+	int ws[]={5, 6, 8, 11, 13};
+	int ls[]={3, 3, 4, 4, 4};
+	if (level==-1) level=8;
+	level=(level-1)/2; //level is now 0, 1, 2, 3, 4
+	*windowBits=ws[level];
+	*lookaheadBits=ls[level];
+}
+
+//Compress in to a heatshrink stream without the parameter byte, return its length
+size_t heatshrinkStream(uint8_t *in, int insize, uint8_t *out, int outsize, int windowBits, int lookaheadBits) {
 	uint8_t *inp=in;
 	uint8_t *outp=out;
 	size_t len;
-	int ws[]={5, 6, 8, 11, 13};
-	int ls[]={3, 3, 4, 4, 4};
 	HSE_poll_res pres;
 	HSE_sink_res sres;
 	size_t r;
-	if (level==-1) level=8;
-	level=(level-1)/2; //level is now 0, 1, 2, 3, 4
-	heatshrink_encoder *enc=heatshrink_encoder_alloc(ws[level], ls[level]);
+	heatshrink_encoder *enc=heatshrink_encoder_alloc(windowBits, lookaheadBits);
 	if (enc==NULL) {
 		perror("allocating mem for heatshrink");
 		exit(1);
 	}
-	//Save encoder parms as first byte
-	*outp=(ws[level]<<4)|ls[level];
-	outp++; outsize--;
 
-	r=1;
+	r=0;
 	do {
 		if (insize>0) {
 			sres=heatshrink_encoder_sink(enc, inp, insize, &len);
@@ -99,6 +171,76 @@ size_t compressHeatshrink(uint8_t *in, int insize, uint8_t *out, int outsize, in
 	heatshrink_encoder_free(enc);
 	return r;
 }
+
+//Compress each block of 1<<blockBits bytes as its own stream, behind a table of where they start
+size_t compressHeatshrinkBlocks(uint8_t *in, int insize, uint8_t *out, int outsize, int windowBits, int lookaheadBits) {
+	EspFsBlockHeader bh;
+	int blockLen=1<<blockBits;
+	int numBlocks=(insize+blockLen-1)>>blockBits;
+	uint32_t *offsets=(uint32_t *)(out+sizeof(EspFsBlockHeader));
+	size_t r=sizeof(EspFsBlockHeader)+numBlocks*sizeof(uint32_t);
+
+	bh.parms=(windowBits<<4)|lookaheadBits;
+	bh.blockBits=blockBits;
+	bh.reserved=0;
+	bh.numBlocks=htoxl(numBlocks);
+	memcpy(out, &bh, sizeof(EspFsBlockHeader));
+	for (int i=0; i<numBlocks; i++) {
+		int len=(i==numBlocks-1) ? insize-(i<<blockBits) : blockLen;
+		offsets[i]=htoxl(r);
+		r+=heatshrinkStream(in+(i<<blockBits), len, out+r, outsize-r, windowBits, lookaheadBits);
+	}
+	return r;
+}
+
+//Compress in blocks if the file is large enough, else as one stream. out needs insize*2+64 bytes.
+size_t compressHeatshrink(uint8_t *in, int insize, uint8_t *out, int windowBits, int lookaheadBits, int8_t *flags) {
+	int outsize=insize*2+64;
+	if (blockBits && insize>(1<<blockBits)) {
+		*flags=FLAG_BLOCKS;
+		return compressHeatshrinkBlocks(in, insize, out, outsize, windowBits, lookaheadBits);
+	}
+	*flags=0;
+	//Save encoder parms as first byte
+	*out=(windowBits<<4)|lookaheadBits;
+	return 1+heatshrinkStream(in, insize, out+1, outsize-1, windowBits, lookaheadBits);
+}
+
+/*
+Try every window up to 1<<maxWindowBits bytes and keep the smallest output in *out. The window
+is what decoding costs in RAM, so on a tie the smaller one wins. Windows that already cover the
+file (or a block) all give the same output, so the search stops there. The output shrinks and
+then grows with the lookahead, so lookaheads stop once two in a row did worse.
+*/
+size_t compressHeatshrinkBest(uint8_t *in, int insize, uint8_t **out, int maxWindowBits, int8_t *flags) {
+	uint8_t *trial=malloc(insize*2+64);
+	size_t best=0;
+	int span=(blockBits && insize>(1<<blockBits)) ? (1<<blockBits) : insize;
+	for (int w=HEATSHRINK_MIN_WINDOW_BITS; w<=maxWindowBits; w++) {
+		size_t bestOfWindow=0;
+		int worse=0;
+		for (int l=HEATSHRINK_MIN_LOOKAHEAD_BITS; l<w && worse<2; l++) {
+			int8_t trialFlags;
+			size_t len=compressHeatshrink(in, insize, trial, w, l, &trialFlags);
+			if (bestOfWindow==0 || len<bestOfWindow) {
+				bestOfWindow=len;
+				worse=0;
+			} else {
+				worse++;
+			}
+			if (best==0 || len<best) {
+				uint8_t *t=*out;
+				*out=trial;
+				trial=t;
+				best=len;
+				*flags=trialFlags;
+			}
+		}
+		if ((1<<w)>=span) break;
+	}
+	free(trial);
+	return best;
+}
 #endif
 
 #ifdef ESPFS_GZIP
@@ -135,6 +277,24 @@ size_t compressGzip(uint8_t *in, int insize, uint8_t *out, int outsize, int leve
 	return stream.total_out;
 }
 
+//Try every level and keep the smallest output in *out, which needs outsize bytes
+size_t compressGzipBest(uint8_t *in, int insize, uint8_t **out, int outsize, int *level) {
+	uint8_t *trial=malloc(outsize);
+	size_t best=0;
+	for (int l=1; l<=9; l++) {
+		size_t len=compressGzip(in, insize, trial, outsize, l);
+		if (best==0 || len<best) {
+			uint8_t *t=*out;
+			*out=trial;
+			trial=t;
+			best=len;
+			*level=l;
+		}
+	}
+	free(trial);
+	return best;
+}
+
 char **gzipExtensions = NULL;
 
 int shouldCompressGzip(char *name) {
@@ -186,27 +346,139 @@ int parseGzipExtensions(char *input) {
 }
 #endif
 
-int handleFile(int f, char *name, int compression, int level, char **compName) {
+/*
+Compressed files are cached as a CacheHeader followed by the data, in a file whose name holds
+the content hash and size and every option that affects the output. Bump CACHE_VERSION when the
+compressors change what they produce.
+*/
+#define CACHE_VERSION 4
+
+typedef struct {
+	uint32_t version;
+	int8_t flags;
+	int8_t compression;
+	uint8_t parms;
+	int8_t reserved;
+	uint32_t size;
+	uint32_t csize;
+	uint32_t baseSize;
+} CacheHeader;
+
+void cachePath(char *path, size_t len, IndexedFile *file, int gzip) {
+	int bits = 0;
+#ifdef ESPFS_HEATSHRINK
+	bits = blockBits;
+#endif
+	snprintf(path, len, "%s/%016llx-%zu-c%dl%db%do%d%s", cacheDir, (unsigned long long)file->hash,
+			file->size, compType, compLvl, bits, bestWindowBits, gzip ? "g" : "");
+}
+
+int cacheLoad(IndexedFile *file, int gzip) {
+	char path[1200];
+	CacheHeader ch;
+	FILE *f;
+	cachePath(path, sizeof(path), file, gzip);
+	f = fopen(path, "rb");
+	if (f == NULL) return 0;
+	if (fread(&ch, sizeof(ch), 1, f) != 1 || ch.version != CACHE_VERSION ||
+			ch.size != file->size || ch.csize > file->size) {
+		fclose(f);
+		return 0;
+	}
+	file->data = malloc(ch.csize ? ch.csize : 1);
+	if (fread(file->data, 1, ch.csize, f) != ch.csize) {
+		free(file->data);
+		fclose(f);
+		return 0;
+	}
+	fclose(f);
+	file->csize = ch.csize;
+	file->flags = ch.flags;
+	file->compression = ch.compression;
+	file->parms = ch.parms;
+	file->baseSize = ch.baseSize;
+	return 1;
+}
+
+//Written under a temporary name and renamed, so builds sharing a cache never see half a file
+void cacheStore(IndexedFile *file, int gzip, int worker) {
+	char path[1200], tmp[1220];
+	CacheHeader ch = {CACHE_VERSION, file->flags, file->compression, file->parms, 0,
+			file->size, file->csize, file->baseSize};
+	FILE *f;
+	cachePath(path, sizeof(path), file, gzip);
+	snprintf(tmp, sizeof(tmp), "%s.%d-%d.tmp", path, (int)getpid(), worker);
+	f = fopen(tmp, "wb");
+	if (f == NULL) return;
+	if (fwrite(&ch, sizeof(ch), 1, f) != 1 || fwrite(file->data, 1, file->csize, f) != file->csize) {
+		fclose(f);
+		unlink(tmp);
+		return;
+	}
+	fclose(f);
+#ifdef __MINGW32__
+	unlink(path); //rename doesn't replace files here
+#endif
+	if (rename(tmp, path) != 0) unlink(tmp);
+}
+
+//Read and compress one file, or take it from the cache. Runs on the worker threads.
+void compressFile(IndexedFile *file, int worker) {
 	uint8_t *fdat, *cdat;
-	off_t size, csize;
-	EspFsHeader h;
-	int nameLen;
+	size_t size, csize;
+	int compression = compType;
 	int8_t flags = 0;
-	size=lseek(f, 0, SEEK_END);
-	fdat=malloc(size);
-	lseek(f, 0, SEEK_SET);
-	read(f, fdat, size);
+	int gzip = 0;
+	FILE *f;
 
+	f = fopen(file->path, "rb");
+	if (f == NULL) {
+		perror(file->path);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	fdat = malloc(size ? size : 1);
+	if (fread(fdat, 1, size, f) != size) {
+		perror(file->path);
+		exit(1);
+	}
+	fclose(f);
+	file->size = size;
+	file->hash = espFsHashContent(fdat, size);
+
+#ifdef ESPFS_GZIP
+	gzip = shouldCompressGzip(file->name);
+#endif
+	if (cacheDir != NULL && cacheLoad(file, gzip)) {
+		file->cached = 1;
+		if (file->compression == COMPRESS_NONE && !(file->flags & FLAG_GZIP)) {
+			//Stored uncompressed, so the cache only holds the header
+			free(file->data);
+			file->data = fdat;
+			file->csize = size;
+		} else {
+			free(fdat);
+		}
+		return;
+	}
 
 #ifdef ESPFS_GZIP
-	if (shouldCompressGzip(name)) {
-		csize = size*3;
-		if (csize<100) // gzip has some headers that do not fit when trying to compress small files
-			csize = 100; // enlarge buffer if this is the case
-		cdat=malloc(csize);
-		csize=compressGzip(fdat, size, cdat, csize, level);
+	if (gzip) {
+		size_t cap = size*3;
+		int level = compLvl;
+		if (cap<100) // gzip has some headers that do not fit when trying to compress small files
+			cap = 100; // enlarge buffer if this is the case
+		cdat=malloc(cap);
+		csize=compressGzip(fdat, size, cdat, cap, compLvl);
+		if (bestWindowBits) {
+			file->baseSize=csize;
+			csize=compressGzipBest(fdat, size, &cdat, cap, &level);
+		}
 		compression = COMPRESS_NONE;
 		flags = FLAG_GZIP;
+		file->parms = level;
 	} else
 #endif
 	if (compression==COMPRESS_NONE) {
@@ -214,8 +486,20 @@ int handleFile(int f, char *name, int compression, int level, char **compName) {
 		cdat=fdat;
 #ifdef ESPFS_HEATSHRINK
 	} else if (compression==COMPRESS_HEATSHRINK) {
-		cdat=malloc(size*2);
-		csize=compressHeatshrink(fdat, size, cdat, size*2, level);
+		int windowBits, lookaheadBits;
+		heatshrinkParms(compLvl, &windowBits, &lookaheadBits);
+		if (bestWindowBits && windowBits>bestWindowBits) {
+			//Compare the search with what the level gives under the same window cap
+			windowBits=bestWindowBits;
+			if (lookaheadBits>=windowBits) lookaheadBits=windowBits-1;
+		}
+		cdat=malloc(size*2+64);
+		csize=compressHeatshrink(fdat, size, cdat, windowBits, lookaheadBits, &flags);
+		if (bestWindowBits) {
+			file->baseSize=csize;
+			csize=compressHeatshrinkBest(fdat, size, &cdat, bestWindowBits, &flags);
+		}
+		file->parms = cdat[0]; //Also the first byte of an EspFsBlockHeader
 #endif
 	} else {
 		fprintf(stderr, "Unknown compression - %d\n", compression);
@@ -224,62 +508,211 @@ int handleFile(int f, char *name, int compression, int level, char **compName) {
 
 	if (csize>size) {
 		//Compressing enbiggened this file. Revert to uncompressed store.
+		free(cdat);
 		compression=COMPRESS_NONE;
 		csize=size;
 		cdat=fdat;
 		flags=0;
+		file->parms=0;
+	}
+	if (cdat != fdat) free(fdat);
+	if (file->baseSize>size) file->baseSize=size;
+
+	file->data = cdat;
+	file->csize = csize;
+	file->flags = flags;
+	file->compression = compression;
+	if (cacheDir != NULL) {
+		//Uncompressed files are cached as a header alone, to remember not to try again
+		size_t len = file->csize;
+		if (compression == COMPRESS_NONE && !(flags & FLAG_GZIP)) file->csize = 0;
+		cacheStore(file, gzip, worker);
+		file->csize = len;
 	}
+}
+
+void *compressWorker(void *arg) {
+	int worker = (int)(intptr_t)arg;
+	for (;;) {
+		int i;
+		pthread_mutex_lock(&nextFileMutex);
+		i = nextFile++;
+		pthread_mutex_unlock(&nextFileMutex);
+		if (i >= numFiles) break;
+		compressFile(&files[i], worker);
+	}
+	return NULL;
+}
+
+void compressFiles(int numThreads) {
+	pthread_t *threads = malloc(numThreads * sizeof(pthread_t));
+	for (int i = 0; i < numThreads; i++) {
+		if (pthread_create(&threads[i], NULL, compressWorker, (void *)(intptr_t)i) != 0) {
+			perror("starting compression threads");
+			exit(1);
+		}
+	}
+	for (int i = 0; i < numThreads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	free(threads);
+}
+
+//An earlier file stored with the same data, which is only worth linking to if larger than a link
+IndexedFile *findDuplicate(IndexedFile *file) {
+	if (file->csize <= sizeof(EspFsLink)) return NULL;
+	for (IndexedFile *f = files; f < file; f++) {
+		if (f->link == NULL && f->hash == file->hash && f->size == file->size &&
+				f->csize == file->csize && f->flags == file->flags &&
+				f->compression == file->compression && memcmp(f->data, file->data, f->csize) == 0) {
+			return f;
+		}
+	}
+	return NULL;
+}
+
+//Append a compressed file, or a link to the earlier file it duplicates, to the image. Returns
+//its compression rate.
+int emitFile(IndexedFile *file) {
+	EspFsHeader h;
+	EspFsLink link;
+	int nameLen;
 
 	//Fill header data
 	h.magic=('E'<<0)+('S'<<8)+('f'<<16)+('s'<<24);
-	h.flags=flags;
-	h.compression=compression;
-	h.nameLen=nameLen=strlen(name)+1;
+	h.flags=file->flags|FLAG_HASH;
+	h.compression=file->compression;
+	h.nameLen=nameLen=strlen(file->name)+1;
 	if (h.nameLen&3) h.nameLen+=4-(h.nameLen&3); //Round to next 32bit boundary
-	h.nameLen=htoxs(h.nameLen);
-	h.fileLenComp=htoxl(csize);
-	h.fileLenDecomp=htoxl(size);
-
-	write(1, &h, sizeof(EspFsHeader));
-	write(1, name, nameLen);
-	while (nameLen&3) {
-		write(1, "\000", 1);
-		nameLen++;
-	}
-	write(1, cdat, csize);
-	//Pad out to 32bit boundary
-	while (csize&3) {
-		write(1, "\000", 1);
-		csize++;
-	}
-	free(fdat);
-
-	if (compName != NULL) {
-		if (h.compression==COMPRESS_HEATSHRINK) {
-			*compName = "heatshrink";
-		} else if (h.compression==COMPRESS_NONE) {
-			if (h.flags & FLAG_GZIP) {
-				*compName = "gzip";
-			} else {
-				*compName = "none";
-			}
+	h.nameLen=htoxs(h.nameLen+ESPFS_HASH_LEN);
+	h.fileLenComp=htoxl(file->csize);
+	h.fileLenDecomp=htoxl(file->size);
+	if (file->link != NULL) {
+		h.flags=FLAG_LINK|FLAG_HASH;
+		h.compression=COMPRESS_NONE;
+		h.fileLenComp=htoxl(sizeof(EspFsLink));
+		h.fileLenDecomp=htoxl(sizeof(EspFsLink));
+		link.back=htoxl(outLen - file->link->offset);
+	}
+
+	file->offset = outLen;
+	emit(&h, sizeof(EspFsHeader));
+	emit(file->name, nameLen);
+	emitPadding();
+	for (int i=0; i<ESPFS_HASH_LEN; i++) {
+		uint8_t b=file->hash>>(i*8);
+		emit(&b, 1);
+	}
+	if (file->link != NULL) {
+		emit(&link, sizeof(EspFsLink));
+	} else {
+		emit(file->data, file->csize);
+	}
+	emitPadding();
+	return file->size ? (file->csize*100)/file->size : 100;
+}
+
+void describeCompression(IndexedFile *file, char *buf, size_t len) {
+	if (file->compression==COMPRESS_HEATSHRINK) {
+		snprintf(buf, len, "%s %d/%d", (file->flags & FLAG_BLOCKS) ? "heatshrink blocks" : "heatshrink",
+				file->parms>>4, file->parms&0xf);
+	} else if (file->compression==COMPRESS_NONE) {
+		if (file->flags & FLAG_GZIP) {
+			snprintf(buf, len, "gzip %d", file->parms);
 		} else {
-			*compName = "unknown";
+			snprintf(buf, len, "none");
+		}
+	} else {
+		snprintf(buf, len, "unknown");
+	}
+}
+
+long msSince(struct timeval *start) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_usec - start->tv_usec) / 1000;
+}
+
+//CRC-32 as computed by zlib and the ESP32 ROM's crc32_le
+uint32_t crc32Update(uint32_t crc, const uint8_t *p, size_t len) {
+	crc = ~crc;
+	while (len--) {
+		crc ^= *p++;
+		for (int i = 0; i < 8; i++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+
+//Build the name index entry, which goes before the files. Returns its length.
+size_t buildIndex(uint8_t **indexEntry) {
+	EspFsHeader h;
+	EspFsIndexHeader ih;
+	EspFsIndexEntry *buckets;
+	int numBuckets = 1;
+	size_t indexLen, entryLen;
+
+	while (numBuckets < numFiles * 2) {
+		numBuckets <<= 1;
+	}
+	indexLen = sizeof(EspFsIndexHeader) + numBuckets * sizeof(EspFsIndexEntry);
+	entryLen = sizeof(EspFsHeader) + indexLen;
+	*indexEntry = calloc(1, entryLen);
+	buckets = (EspFsIndexEntry *)(*indexEntry + sizeof(EspFsHeader) + sizeof(EspFsIndexHeader));
+
+	//File offsets in the image are shifted by the index entry itself
+	for (int i = 0; i < numFiles; i++) {
+		uint32_t hash = espFsHashName(files[i].name);
+		int b = hash & (numBuckets - 1);
+		while (buckets[b].offset != 0) {
+			b = (b + 1) & (numBuckets - 1);
 		}
+		buckets[b].hash = htoxl(hash);
+		buckets[b].offset = htoxl(entryLen + files[i].offset);
 	}
-	return size ? (csize*100)/size : 100;
+
+	h.magic=('E'<<0)+('S'<<8)+('f'<<16)+('s'<<24);
+	h.flags=FLAG_INDEX;
+	h.compression=COMPRESS_NONE;
+	h.nameLen=htoxs(0);
+	h.fileLenComp=htoxl(indexLen);
+	h.fileLenDecomp=htoxl(indexLen);
+	ih.headerLen=htoxs(sizeof(EspFsIndexHeader));
+	ih.reserved=0;
+	ih.numFiles=htoxl(numFiles);
+	ih.numBuckets=htoxl(numBuckets);
+	ih.lastOffset=htoxl(entryLen + outLen); //The last header goes straight after the files
+	memcpy(*indexEntry, &h, sizeof(EspFsHeader));
+	memcpy(*indexEntry + sizeof(EspFsHeader), &ih, sizeof(EspFsIndexHeader));
+	return entryLen;
 }
 
-//Write final dummy header with FLAG_LASTFILE set.
-void finishArchive() {
+//Write the index, the files and a final header with FLAG_LASTFILE set, carrying the trailer.
+//Returns the length of the image.
+size_t finishArchive() {
 	EspFsHeader h;
+	EspFsTrailer t;
+	uint8_t *indexEntry;
+	size_t indexLen = buildIndex(&indexEntry);
+
+	t.numFiles=htoxl(numFiles);
+	t.length=htoxl(indexLen + outLen + sizeof(EspFsHeader) + sizeof(EspFsTrailer));
+	t.crc32=htoxl(crc32Update(crc32Update(0, indexEntry, indexLen), outBuf, outLen));
+
 	h.magic=('E'<<0)+('S'<<8)+('f'<<16)+('s'<<24);
 	h.flags=FLAG_LASTFILE;
 	h.compression=COMPRESS_NONE;
 	h.nameLen=htoxs(0);
-	h.fileLenComp=htoxl(0);
-	h.fileLenDecomp=htoxl(0);
-	write(1, &h, sizeof(EspFsHeader));
+	h.fileLenComp=htoxl(sizeof(EspFsTrailer));
+	h.fileLenDecomp=htoxl(sizeof(EspFsTrailer));
+	emit(&h, sizeof(EspFsHeader));
+	emit(&t, sizeof(EspFsTrailer));
+
+	writeOut(indexEntry, indexLen);
+	writeOut(outBuf, outLen);
+	free(indexEntry);
+	return indexLen + outLen;
 }
 
 int main(int argc, char **argv) {
@@ -290,8 +723,17 @@ int main(int argc, char **argv) {
 	int serr;
 	int rate;
 	int err=0;
-	int compType;  //default compression type - heatshrink
-	int compLvl = 9; // Z_BEST_COMPRESSION
+	int numThreads=1;
+	int numCached=0;
+	size_t len, baseTotal=0, bestTotal=0, linkSaved=0;
+	int numLinks=0;
+	struct timeval start;
+
+	gettimeofday(&start, NULL);
+#ifdef _SC_NPROCESSORS_ONLN
+	numThreads=sysconf(_SC_NPROCESSORS_ONLN);
+	if (numThreads<1) numThreads=1;
+#endif
 
 #ifdef __MINGW32__
 	setmode(fileno(stdout), O_BINARY);
@@ -310,6 +752,23 @@ int main(int argc, char **argv) {
 			compLvl=atoi(argv[x+1]);
 			if (compLvl<1 || compLvl>9) err=1;
 			x++;
+		} else if (strcmp(argv[x], "-j")==0 && argc>=x-2) {
+			numThreads=atoi(argv[x+1]);
+			if (numThreads<1) err=1;
+			x++;
+		} else if (strcmp(argv[x], "-O")==0 && argc>=x-2) {
+			bestWindowBits=atoi(argv[x+1]);
+			if (bestWindowBits<4 || bestWindowBits>15) err=1;
+			x++;
+		} else if (strcmp(argv[x], "-C")==0 && argc>=x-2) {
+			cacheDir=argv[x+1];
+			x++;
+#ifdef ESPFS_HEATSHRINK
+		} else if (strcmp(argv[x], "-b")==0 && argc>=x-2) {
+			blockBits=atoi(argv[x+1]);
+			if (blockBits<8 || blockBits>16) err=1;
+			x++;
+#endif
 #ifdef ESPFS_GZIP
 		} else if (strcmp(argv[x], "-g")==0 && argc>=x-2) {
 			if (!parseGzipExtensions(argv[x+1])) err=1;
@@ -328,7 +787,10 @@ int main(int argc, char **argv) {
 
 	if (err) {
 		fprintf(stderr, "%s - Program to create espfs images\n", argv[0]);
-		fprintf(stderr, "Usage: \nfind | %s [-c compressor] [-l compression_level] ", argv[0]);
+		fprintf(stderr, "Usage: \nfind | %s [-c compressor] [-l compression_level] [-O max_window_bits] [-j threads] [-C cache_dir] ", argv[0]);
+#ifdef ESPFS_HEATSHRINK
+		fprintf(stderr, "[-b block_bits] ");
+#endif
 #ifdef ESPFS_GZIP
 		fprintf(stderr, "[-g gzipped_extensions] ");
 #endif
@@ -340,12 +802,30 @@ int main(int argc, char **argv) {
 		fprintf(stderr, "0 - None(default)\n");
 #endif
 		fprintf(stderr, "\nCompression level: 1 is worst but low RAM usage, higher is better compression \nbut uses more ram on decompression. -1 = compressors default.\n");
+		fprintf(stderr, "\nMax window bits: try every heatshrink window of up to 2^bits bytes (4 to 15) with \nevery lookahead, and every gzip level, and keep the smallest result of each file. \nThe window is the RAM a decoder needs. A limit below the window of the compression \nlevel trades image size for decoder RAM.\n");
+		fprintf(stderr, "\nThreads: files are compressed this many at a time. Defaults to the number of CPUs.\n");
+		fprintf(stderr, "\nCache dir: keep compressed files here and reuse them while the file contents \nand options stay the same. Created if missing.\n");
+#ifdef ESPFS_HEATSHRINK
+		fprintf(stderr, "\nBlock bits: heatshrink files larger than 2^bits bytes (8 to 16) are compressed \nin blocks of that size, so they can be seeked in. Costs some compression.\n");
+#endif
 #ifdef ESPFS_GZIP
 		fprintf(stderr, "\nGzipped extensions: list of comma separated, case sensitive file extensions \nthat will be gzipped. Defaults to 'html,css,js,svg'\n");
 #endif
 		exit(0);
 	}
 
+	if (cacheDir != NULL) {
+#ifdef __MINGW32__
+		serr=mkdir(cacheDir);
+#else
+		serr=mkdir(cacheDir, 0777);
+#endif
+		if (serr!=0 && errno!=EEXIST) {
+			perror(cacheDir);
+			cacheDir=NULL;
+		}
+	}
+
 	while(fgets(fileName, sizeof(fileName), stdin)) {
 		//Kill off '\n' at the end
 		fileName[strlen(fileName)-1]=0;
@@ -358,10 +838,15 @@ int main(int argc, char **argv) {
 			if (realName[0]=='/') realName++;
 			f=open(fileName, O_RDONLY|O_BINARY);
 			if (f>0) {
-				char *compName = "unknown";
-				rate=handleFile(f, realName, compType, compLvl, &compName);
-				fprintf(stderr, "%s (%d%%, %s)\n", realName, rate, compName);
 				close(f);
+				if (numFiles == filesCap) {
+					filesCap = filesCap ? filesCap * 2 : 64;
+					files = realloc(files, filesCap * sizeof(IndexedFile));
+				}
+				memset(&files[numFiles], 0, sizeof(IndexedFile));
+				files[numFiles].name = strdup(realName);
+				files[numFiles].path = strdup(fileName);
+				numFiles++;
 			} else {
 				perror(fileName);
 			}
@@ -371,7 +856,52 @@ int main(int argc, char **argv) {
 			}
 		}
 	}
-	finishArchive();
+
+	if (numThreads>numFiles) numThreads=numFiles;
+	compressFiles(numThreads);
+	for (x=0; x<numFiles; x++) {
+		char desc[64];
+		size_t csize=files[x].csize;
+		describeCompression(&files[x], desc, sizeof(desc));
+		files[x].link=findDuplicate(&files[x]);
+		rate=emitFile(&files[x]);
+		numCached+=files[x].cached;
+		if (bestWindowBits) {
+			baseTotal+=files[x].baseSize;
+			bestTotal+=csize;
+		}
+		if (files[x].link != NULL) {
+			//The header, name and hash stay, only the data is replaced by the link
+			linkSaved+=((csize+3)&~3)-sizeof(EspFsLink);
+			numLinks++;
+			fprintf(stderr, "%s (link to %s)\n", files[x].name, files[x].link->name);
+		} else if (bestWindowBits) {
+			fprintf(stderr, "%s (%d%%, %s, %+ld bytes%s)\n", files[x].name, rate, desc,
+					(long)csize-(long)files[x].baseSize, files[x].cached ? ", cached" : "");
+		} else {
+			fprintf(stderr, "%s (%d%%, %s%s)\n", files[x].name, rate, desc, files[x].cached ? ", cached" : "");
+		}
+	}
+	if (bestWindowBits) {
+		fprintf(stderr, "Best parameters with windows up to %d bits: %zu bytes of data instead of %zu at level %d with the same cap, %ld saved\n",
+				bestWindowBits, bestTotal, baseTotal, compLvl, (long)baseTotal-(long)bestTotal);
+#ifdef ESPFS_HEATSHRINK
+		int windowBits, lookaheadBits;
+		heatshrinkParms(compLvl, &windowBits, &lookaheadBits);
+		if (compType==COMPRESS_HEATSHRINK && bestWindowBits<windowBits) {
+			fprintf(stderr, "Level %d uses a %d bit window, so -O %d trades image size for decoder RAM\n",
+					compLvl, windowBits, bestWindowBits);
+		}
+#endif
+	}
+	len=finishArchive();
+	if (numLinks) {
+		fprintf(stderr, "%d duplicate files stored as links, %zu bytes instead of %zu\n", numLinks, len, len+linkSaved);
+	}
+	fprintf(stderr, "%d files, %d from cache, %zu bytes, %ld ms on %d threads\n", numFiles, numCached,
+			len, msSince(&start), numThreads);
+	for (x=0; x<numFiles; x++) {
+		free(files[x].data);
+	}
 	return 0;
 }
-
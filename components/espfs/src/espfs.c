@@ -17,11 +17,18 @@ It's written for use with httpd, but doesn't need to be used as such.
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 
 #include "esp_log.h"
 #include "esp_partition.h"
 #include "esp_spi_flash.h"
 #include "sdkconfig.h"
+#include "esp32/rom/crc.h"
+
+#if CONFIG_ESPFS_VERIFY_IN_BACKGROUND
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
 
 #include "espfsformat.h"
 #include "espfs.h"
@@ -30,16 +37,438 @@ It's written for use with httpd, but doesn't need to be used as such.
 
 #if CONFIG_ESPFS_USE_HEATSHRINK
 #include "heatshrink_config_custom.h"
-#include "heatshrink_decoder.h"
+#include "heatshrink_common.h"
 #endif
 
 const static char* TAG = "espfs";
 
+// File handles and heatshrink decoders come from fixed pools allocated at
+// the first mount, so a page load doesn't churn the heap. Files are opened
+// from the httpd task and through the VFS, so slots are claimed lock free
+// from a bitmask. Opens beyond a pool fall back to malloc.
+typedef struct {
+	volatile uint32_t inUse;
+	uint16_t size;
+	uint16_t peak;
+	uint32_t fallbacks;
+} Pool;
+
+static Pool handlePool = {.size = CONFIG_ESPFS_FILE_POOL_SIZE};
+static EspFsFile *handles = NULL;
+#if CONFIG_ESPFS_USE_HEATSHRINK
+typedef struct {
+	const uint8_t *in;
+	const uint8_t *end;
+	uint32_t bits;
+	int count;
+} BitReader;
+
+// A heatshrink stream being read through espFsRead. Input comes straight
+// from the mapped image, and the window keeps the last 1 << windowBits bytes
+// returned for back references that reach behind the current read.
+typedef struct {
+	BitReader br;
+	uint32_t pos; //Bytes decoded since the start of the stream
+	uint16_t refDist; //Back reference cut short by the end of the last read
+	uint16_t refLeft;
+	uint8_t windowBits;
+	uint8_t lookaheadBits;
+	uint8_t window[];
+} Decoder;
+
+#define DECODER_STRIDE ((sizeof(Decoder) + (1 << CONFIG_ESPFS_DECODER_POOL_WINDOW_BITS) + 3) & ~3)
+static Pool decoderPool = {.size = CONFIG_ESPFS_DECODER_POOL_SIZE};
+static uint8_t *decoders = NULL;
+#endif
+
+static void poolInit(void)
+{
+	if (handles == NULL && handlePool.size > 0) {
+		handles = malloc(handlePool.size * sizeof(EspFsFile));
+		if (handles == NULL) {
+			handlePool.size = 0;
+		}
+	}
+#if CONFIG_ESPFS_USE_HEATSHRINK
+	if (decoders == NULL && decoderPool.size > 0) {
+		decoders = malloc(decoderPool.size * DECODER_STRIDE);
+		if (decoders == NULL) {
+			decoderPool.size = 0;
+		}
+	}
+#endif
+}
+
+static int poolClaim(Pool *pool)
+{
+	uint32_t used = __atomic_load_n(&pool->inUse, __ATOMIC_RELAXED);
+	uint32_t all = pool->size >= 32 ? 0xffffffff : (1u << pool->size) - 1;
+
+	while (1) {
+		uint32_t avail = ~used & all;
+		if (avail == 0) {
+			pool->fallbacks++;
+			return -1;
+		}
+		int slot = __builtin_ctz(avail);
+		if (__atomic_compare_exchange_n(&pool->inUse, &used, used | (1u << slot), false,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			int n = __builtin_popcount(used) + 1;
+			if (n > pool->peak) {
+				pool->peak = n;
+			}
+			return slot;
+		}
+	}
+}
+
+static void poolRelease(Pool *pool, int slot)
+{
+	__atomic_fetch_and(&pool->inUse, ~(1u << slot), __ATOMIC_RELEASE);
+}
+
+#if CONFIG_ESPFS_USE_HEATSHRINK
+// Takes a decoder from the pool if its window is large enough, else mallocs one
+static Decoder *decoderOpen(EspFsFile *r, uint8_t windowBits, uint8_t lookaheadBits)
+{
+	Decoder *dec;
+
+	r->decoderSlot = -1;
+	if (windowBits < HEATSHRINK_MIN_WINDOW_BITS || windowBits > HEATSHRINK_MAX_WINDOW_BITS ||
+			lookaheadBits < HEATSHRINK_MIN_LOOKAHEAD_BITS || lookaheadBits >= windowBits) {
+		return NULL;
+	}
+	if (windowBits <= CONFIG_ESPFS_DECODER_POOL_WINDOW_BITS) {
+		r->decoderSlot = poolClaim(&decoderPool);
+	} else {
+		decoderPool.fallbacks++;
+	}
+	if (r->decoderSlot < 0) {
+		dec = malloc(sizeof(Decoder) + (1 << windowBits));
+	} else {
+		dec = (Decoder *)&decoders[r->decoderSlot * DECODER_STRIDE];
+	}
+	if (dec != NULL) {
+		dec->windowBits = windowBits;
+		dec->lookaheadBits = lookaheadBits;
+	}
+	return dec;
+}
+
+static void decoderClose(EspFsFile *fh)
+{
+	if (fh->decoderSlot >= 0) {
+		poolRelease(&decoderPool, fh->decoderSlot);
+	} else {
+		free(fh->decompData);
+	}
+}
+
+// Points the decoder at the start of a stream. The window isn't cleared,
+// back references before the start of the stream are decoded as zeros.
+static void decoderStart(Decoder *dec, const char *in, const char *end)
+{
+	dec->br = (BitReader){.in = (const uint8_t *)in, .end = (const uint8_t *)end};
+	dec->pos = 0;
+	dec->refLeft = 0;
+}
+
+// Heatshrink fields are MSB first and at most 15 bits, -1 past the input
+static inline int32_t readBits(BitReader *br, int n)
+{
+	while (br->count < n) {
+		if (br->in == br->end) {
+			return -1;
+		}
+		br->bits = (br->bits << 8) | *br->in++;
+		br->count += 8;
+	}
+	br->count -= n;
+	return (br->bits >> br->count) & ((1u << n) - 1);
+}
+
+// Decodes up to outLen bytes of the stream into out. Back references within
+// out are copied a word at a time when they reach back 4 bytes or more, those
+// behind it come from the window. A back reference that doesn't fit is
+// finished by the next call. Returns the bytes decoded, short of outLen if
+// the input ran out.
+static size_t decode(Decoder *dec, uint8_t *out, size_t outLen)
+{
+	const uint32_t start = dec->pos;
+	const uint32_t mask = (1u << dec->windowBits) - 1;
+	const int windowBits = dec->windowBits, lookaheadBits = dec->lookaheadBits;
+	BitReader br = dec->br; //Kept local, stores to out could alias it
+	uint32_t dist = dec->refDist;
+	size_t left = dec->refLeft;
+	size_t n = 0;
+
+	while (1) {
+		while (left > 0 && n < outLen) {
+			uint32_t p = start + n;
+			size_t k = left < outLen - n ? left : outLen - n;
+			uint8_t *d = &out[n];
+			if (n >= dist) {
+				const uint8_t *s = d - dist;
+				size_t i = 0;
+				if (dist >= 4) {
+					for (; i + 4 <= k; i += 4) {
+						memcpy(&d[i], &s[i], 4);
+					}
+				}
+				for (; i < k; i++) {
+					d[i] = s[i];
+				}
+			} else if (p < dist) {
+				// The encoder's window starts out zeroed and may be matched into
+				if (k > dist - p) k = dist - p;
+				memset(d, 0, k);
+			} else {
+				// Behind this read, in the window
+				uint32_t at = (p - dist) & mask;
+				if (k > dist - n) k = dist - n;
+				if (k > mask + 1 - at) k = mask + 1 - at;
+				memcpy(d, &dec->window[at], k);
+			}
+			n += k;
+			left -= k;
+		}
+		if (left > 0 || n == outLen) {
+			break;
+		}
+
+		int32_t tag = readBits(&br, 1);
+		if (tag < 0) {
+			break;
+		}
+		if (tag) {
+			int32_t literal = readBits(&br, 8);
+			if (literal < 0) {
+				break;
+			}
+			out[n++] = literal;
+			continue;
+		}
+		int32_t index = readBits(&br, windowBits);
+		int32_t count = readBits(&br, lookaheadBits);
+		if (index < 0 || count < 0) {
+			break;
+		}
+		dist = index + 1;
+		left = count + 1;
+	}
+	dec->br = br;
+	dec->refDist = dist;
+	dec->refLeft = left;
+	dec->pos += n;
+	return n;
+}
+
+// As decode, then keeps the tail of what was decoded in the window
+static size_t decoderRead(Decoder *dec, uint8_t *out, size_t outLen)
+{
+	size_t n = decode(dec, out, outLen);
+	size_t size = 1 << dec->windowBits;
+	size_t keep = n < size ? n : size;
+	size_t at = (dec->pos - keep) & (size - 1);
+	size_t first = size - at < keep ? size - at : keep;
+
+	memcpy(&dec->window[at], &out[n - keep], first);
+	memcpy(dec->window, &out[n - keep + first], keep - first);
+	return n;
+}
+
+// Decodes a whole heatshrink stream into out, which holds all of it, so no
+// window is needed. Returns the bytes decoded, short of outLen if the stream
+// is corrupt or truncated.
+static int decodeWhole(const uint8_t *in, size_t inLen, uint8_t *out, size_t outLen,
+		int windowBits, int lookaheadBits)
+{
+	Decoder dec = {.windowBits = windowBits, .lookaheadBits = lookaheadBits};
+
+	decoderStart(&dec, (const char *)in, (const char *)in + inLen);
+	size_t n = decode(&dec, out, outLen);
+	return dec.refLeft ? -1 : n;
+}
+
+// Start of a block in the mapped image, or the end of the file for numBlocks
+static char *blockStart(EspFsFile *fh, int block)
+{
+	const uint32_t *offsets = (const uint32_t *)(fh->blocks + 1);
+
+	if (block >= fh->blocks->numBlocks) {
+		return fh->posStart + fh->header->fileLenComp;
+	}
+	return fh->posStart + offsets[block];
+}
+
+// Reads a file compressed in blocks, restarting the decoder at every block.
+// Blocks that fit in what is left of buff are decoded whole.
+static int readBlocks(EspFsFile *fh, char *buff, int len)
+{
+	Decoder *dec = (Decoder *)fh->decompData;
+	int bits = fh->blocks->blockBits;
+	int fdlen = fh->header->fileLenDecomp;
+	int decoded = 0;
+
+	while (decoded < len && fh->posDecomp < fdlen) {
+		int block = fh->posDecomp >> bits;
+		int blockEnd = ((block + 1) << bits) < fdlen ? (block + 1) << bits : fdlen;
+		int want = len - decoded < blockEnd - fh->posDecomp ? len - decoded : blockEnd - fh->posDecomp;
+		char *compEnd = blockStart(fh, block + 1);
+		int polled;
+
+		if (fh->posDecomp == block << bits && want == blockEnd - fh->posDecomp) {
+			polled = decodeWhole((uint8_t *)fh->posComp, compEnd - fh->posComp, (uint8_t *)&buff[decoded],
+					want, fh->blocks->parms >> 4, fh->blocks->parms & 0xf);
+			if (polled != want) {
+				ESP_LOGE(TAG, "Corrupt heatshrink block %d at %p", block, fh->posStart);
+				break;
+			}
+			fh->posComp = compEnd;
+		} else {
+			if (fh->posDecomp == block << bits) {
+				decoderStart(dec, fh->posComp, compEnd);
+			}
+			polled = decoderRead(dec, (uint8_t *)&buff[decoded], want);
+			fh->posComp = (char *)dec->br.in;
+			if (polled != want) {
+				ESP_LOGE(TAG, "Corrupt heatshrink block %d at %p", block, fh->posStart);
+				break;
+			}
+			if (fh->posDecomp + polled == blockEnd) {
+				fh->posComp = compEnd;
+			}
+		}
+		fh->posDecomp += polled;
+		decoded += polled;
+	}
+	return decoded;
+}
+
+// Moves to target by restarting the decoder, at the block holding target when
+// the file has blocks, and decoding up to it. Other compressed files can only
+// be rewound.
+static int seekHeatshrink(EspFsFile *fh, int32_t target)
+{
+	char skip[64];
+
+	if (fh->blocks == NULL && target != 0) {
+		return -1;
+	}
+
+	// The decoder restarts when the next read begins a block, or the file
+	int block = fh->blocks ? target >> fh->blocks->blockBits : 0;
+	if (fh->blocks) {
+		fh->posComp = blockStart(fh, block);
+		fh->posDecomp = block << fh->blocks->blockBits;
+	} else {
+		fh->posComp = fh->posStart + 1;
+		fh->posDecomp = 0;
+	}
+	while (fh->posDecomp < target) {
+		int n = target - fh->posDecomp < sizeof(skip) ? target - fh->posDecomp : sizeof(skip);
+		if (readBlocks(fh, skip, n) != n) {
+			return -1;
+		}
+	}
+	return fh->posDecomp;
+}
+#endif
+
+static EspFsFile *handleAlloc(void)
+{
+	int slot = poolClaim(&handlePool);
+	EspFsFile *r = slot >= 0 ? &handles[slot] : malloc(sizeof(EspFsFile));
+
+	if (r != NULL) {
+		r->poolSlot = slot;
+	}
+	return r;
+}
+
+static void handleFree(EspFsFile *fh)
+{
+	if (fh->poolSlot >= 0) {
+		poolRelease(&handlePool, fh->poolSlot);
+	} else {
+		free(fh);
+	}
+}
+
+void espFsGetPoolStats(EspFsPoolStats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->handles = handlePool.size;
+	stats->handlesInUse = __builtin_popcount(handlePool.inUse);
+	stats->handlesPeak = handlePool.peak;
+	stats->handleFallbacks = handlePool.fallbacks;
+#if CONFIG_ESPFS_USE_HEATSHRINK
+	stats->decoders = decoderPool.size;
+	stats->decodersInUse = __builtin_popcount(decoderPool.inUse);
+	stats->decodersPeak = decoderPool.peak;
+	stats->decoderFallbacks = decoderPool.fallbacks;
+#endif
+}
+
+
+// Drops one reference. The last one out unmaps and frees the image, so
+// espFsDeinit can't pull it from under the background check.
+static void release(EspFs* fs)
+{
+	if (__atomic_sub_fetch(&fs->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+		if (fs->mmapHandle) {
+			spi_flash_munmap(fs->mmapHandle);
+		}
+		free(fs);
+	}
+}
+
+#if CONFIG_ESPFS_VERIFY_IN_BACKGROUND
+static void verifyTask(void *arg)
+{
+	EspFs *fs = arg;
+
+	if (espFsVerify(fs) == ESPFS_INTEGRITY_BAD) {
+		ESP_LOGE(TAG, "Image at %p fails its checksum", fs->memAddr);
+	}
+	release(fs);
+	vTaskDelete(NULL);
+}
+#endif
+
+// Takes the file count and length from the trailer that the index points to,
+// instead of walking every header. maxLen is 0 when the mapping size is unknown.
+static bool mountFromTrailer(EspFs* fs, size_t maxLen)
+{
+	const EspFsIndexHeader *ih = fs->index;
+
+	if (ih == NULL || ih->headerLen < offsetof(EspFsIndexHeader, lastOffset) + sizeof(ih->lastOffset) ||
+			ih->lastOffset <= 0 || (ih->lastOffset & 3)) {
+		return false;
+	}
+	if (maxLen && ih->lastOffset + sizeof(EspFsHeader) + sizeof(EspFsTrailer) > maxLen) {
+		return false;
+	}
+
+	const EspFsHeader *h = fs->memAddr + ih->lastOffset;
+	const EspFsTrailer *t = (const void *)(h + 1);
+	if (h->magic != ESPFS_MAGIC || !(h->flags & FLAG_LASTFILE) || h->fileLenComp != sizeof(EspFsTrailer) ||
+			t->numFiles != ih->numFiles ||
+			t->length != ih->lastOffset + sizeof(EspFsHeader) + sizeof(EspFsTrailer)) {
+		ESP_LOGW(TAG, "Image trailer doesn't match its index");
+		return false;
+	}
+	fs->trailer = t;
+	fs->numFiles = t->numFiles;
+	fs->length = t->length;
+	return true;
+}
 
 EspFs* espFsInit(EspFsConfig* conf)
 {
 	spi_flash_mmap_handle_t mmapHandle = 0;
 	const void* memAddr = conf->memAddr;
+	size_t maxLen = 0;
 
 	if (!memAddr) {
 		esp_partition_subtype_t subtype = conf->partLabel ?
@@ -55,6 +484,7 @@ EspFs* espFsInit(EspFsConfig* conf)
 		if (err) {
 			return NULL;
 		}
+		maxLen = partition->size;
 	}
 
 	const EspFsHeader *h = memAddr;
@@ -74,43 +504,165 @@ EspFs* espFsInit(EspFsConfig* conf)
 		}
 		return NULL;
 	}
+	poolInit();
+	fs->memAddr = memAddr;
+	fs->mmapHandle = mmapHandle;
+	fs->index = NULL;
+	fs->trailer = NULL;
+	fs->integrity = ESPFS_INTEGRITY_UNCHECKED;
+	fs->refs = 1;
+
+	// The index entry is first if the image has one. It is not a file.
+	if (h->flags & FLAG_INDEX) {
+		const EspFsIndexHeader *ih = (const void *)(h + 1);
+		if (ih->headerLen >= offsetof(EspFsIndexHeader, lastOffset) && ih->numBuckets > 0 &&
+				(ih->numBuckets & (ih->numBuckets - 1)) == 0 &&
+				ih->headerLen + ih->numBuckets * sizeof(EspFsIndexEntry) <= h->fileLenComp) {
+			fs->index = ih;
+			ESP_LOGD(TAG, "Name index of %d buckets for %d files", ih->numBuckets, ih->numFiles);
+		} else {
+			ESP_LOGW(TAG, "Ignoring malformed name index");
+		}
+	}
 
-	uint32_t entry_length = sizeof(*h) + h->nameLen + h->fileLenComp;
-	if (entry_length & 3) {
-		entry_length += 4 - (entry_length & 3);
+	if (!mountFromTrailer(fs, maxLen)) {
+		uint32_t entry_length = sizeof(*h) + h->nameLen + h->fileLenComp;
+		if (entry_length & 3) {
+			entry_length += 4 - (entry_length & 3);
+		}
+		fs->length = entry_length;
+		fs->numFiles = 0;
+
+		do {
+			fs->numFiles++;
+			h = (void*)h + entry_length;
+			if (h->magic != ESPFS_MAGIC) {
+				ESP_LOGE(TAG, "Magic not found while walking EspFs");
+				free(fs);
+				if (mmapHandle) {
+					spi_flash_munmap(mmapHandle);
+				}
+				return NULL;
+			}
+			entry_length = sizeof(*h) + h->nameLen + h->fileLenComp;
+			if (entry_length & 3) {
+				entry_length += 4 - (entry_length & 3);
+			}
+			fs->length += entry_length;
+		} while (!(h->flags & FLAG_LASTFILE));
+		if (fs->index) {
+			fs->numFiles--;
+		}
+		fs->integrity = ESPFS_INTEGRITY_NO_CHECKSUM;
 	}
-	fs->length = entry_length;
-	fs->numFiles = 0;
 
-	do {
-		fs->numFiles++;
-		h = (void*)h + entry_length;
-		if (h->magic != ESPFS_MAGIC) {
-			ESP_LOGE(TAG, "Magic not found while walking EspFs");
-			free(fs);
-			if (mmapHandle) {
-				spi_flash_munmap(mmapHandle);
+#if CONFIG_ESPFS_VERIFY_IN_BACKGROUND
+	if (fs->trailer) {
+		fs->refs++; //Held by verifyTask
+		if (xTaskCreate(verifyTask, "espfs verify", 2048, fs, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+			fs->refs--;
+			ESP_LOGW(TAG, "Could not start the background image check");
+		}
+	}
+#endif
+	return fs;
+}
+
+// Checksums the whole image. Reads every byte of it, so it is left out of
+// espFsInit and can run from a low priority task instead.
+enum EspFsIntegrity espFsVerify(EspFs* fs)
+{
+	if (fs->trailer == NULL) {
+		fs->integrity = ESPFS_INTEGRITY_NO_CHECKSUM;
+	} else {
+		uint32_t crc = crc32_le(0, fs->memAddr, fs->index->lastOffset);
+		fs->integrity = crc == fs->trailer->crc32 ? ESPFS_INTEGRITY_OK : ESPFS_INTEGRITY_BAD;
+	}
+	return fs->integrity;
+}
+
+enum EspFsIntegrity espFsIntegrity(EspFs* fs)
+{
+	return fs->integrity;
+}
+
+// Constant time lookup through the name index. Hash collisions are settled
+// by comparing the name in the header the bucket points to.
+static const EspFsHeader *findIndexed(EspFs* fs, const char *fileName)
+{
+	const EspFsIndexHeader *ih = fs->index;
+	const EspFsIndexEntry *buckets = (const void *)ih + ih->headerLen;
+	uint32_t mask = ih->numBuckets - 1;
+	uint32_t hash = espFsHashName(fileName);
+
+	for (uint32_t i = 0; i <= mask; i++) {
+		const EspFsIndexEntry *e = &buckets[(hash + i) & mask];
+		if (e->offset == 0) {
+			return NULL;
+		}
+		if (e->hash == hash && e->offset < fs->length) {
+			const EspFsHeader *h = fs->memAddr + e->offset;
+			if (h->magic == ESPFS_MAGIC && strcmp((const char *)(h + 1), fileName) == 0) {
+				return h;
 			}
+		}
+	}
+	return NULL;
+}
+
+// Walks the image header by header, for images built without an index.
+static const EspFsHeader *findLinear(EspFs* fs, const char *fileName)
+{
+	const char *p = fs->memAddr;
+	const EspFsHeader *h;
+
+	while(1) {
+		h = (const EspFsHeader*)p;
+		if (h->magic != ESPFS_MAGIC) {
+			ESP_LOGE(TAG, "Magic mismatch. EspFS image broken.");
 			return NULL;
 		}
-		entry_length = sizeof(*h) + h->nameLen + h->fileLenComp;
-		if (entry_length & 3) {
-			entry_length += 4 - (entry_length & 3);
+		if (h->flags & FLAG_LASTFILE) {
+			ESP_LOGD(TAG, "End of image");
+			return NULL;
+		}
+		// Names are compared in place, mapped flash is byte addressable
+		p += sizeof(EspFsHeader);
+		if (!(h->flags & FLAG_INDEX) && strcmp(p, fileName) == 0) {
+			return h;
+		}
+		p += h->nameLen + h->fileLenComp;
+		if ((uintptr_t)p & 3) {
+		    p += 4 - ((uintptr_t)p & 3); // align to next 32bit val
 		}
-		fs->length += entry_length;
-	} while (!(h->flags & FLAG_LASTFILE));
+	}
+}
 
-	fs->memAddr = memAddr;
-	fs->mmapHandle = mmapHandle;
-	return fs;
+// Files with FLAG_LINK are served from the header and data of the file they link to.
+static const EspFsHeader *resolveLink(EspFs* fs, const EspFsHeader *h)
+{
+	if (h == NULL || !(h->flags & FLAG_LINK)) {
+		return h;
+	}
+	const EspFsLink *link = (const void *)(h + 1) + h->nameLen;
+	const EspFsHeader *target = (const void *)h - link->back;
+	if (h->fileLenComp != sizeof(EspFsLink) || link->back <= 0 || (link->back & 3) ||
+			link->back > (const void *)h - fs->memAddr || target->magic != ESPFS_MAGIC ||
+			(target->flags & (FLAG_LINK | FLAG_INDEX | FLAG_LASTFILE))) {
+		ESP_LOGE(TAG, "Broken link in '%s'", (const char *)(h + 1));
+		return NULL;
+	}
+	return target;
+}
+
+static const EspFsHeader *findHeader(EspFs* fs, const char *fileName)
+{
+	return resolveLink(fs, fs->index ? findIndexed(fs, fileName) : findLinear(fs, fileName));
 }
 
 void espFsDeinit(EspFs* fs)
 {
-	if (fs->mmapHandle) {
-		spi_flash_munmap(fs->mmapHandle);
-	}
-	free(fs);
+	release(fs);
 }
 
 // Returns flags of opened file.
@@ -132,8 +684,7 @@ EspFsFile *espFsOpen(EspFs* fs, const char *fileName)
 		return NULL;
 	}
 
-	char *p = (char *)fs->memAddr;
-	char namebuf[256];
+	char *p;
 	EspFsHeader *h;
 	EspFsFile *r;
 
@@ -145,59 +696,58 @@ EspFsFile *espFsOpen(EspFs* fs, const char *fileName)
 	ESP_LOGD(TAG, "looking for file '%s'.", fileName);
 
 	// Go find that file!
-	while(1) {
-		h = (EspFsHeader*)p;
-		if (h->magic != ESPFS_MAGIC) {
-			ESP_LOGE(TAG, "Magic mismatch. EspFS image broken.");
-			return NULL;
-		}
-		if (h->flags & FLAG_LASTFILE) {
-			ESP_LOGD(TAG, "End of image");
-			return NULL;
-		}
-		// Grab the name of the file.
-		p += sizeof(EspFsHeader);
-		memcpy((uint32_t*)&namebuf, (uintptr_t*)p, sizeof(namebuf));
-		if (strcmp(namebuf, fileName) == 0) {
-			ESP_LOGD(TAG, "Found file '%s'. Namelen=%x fileLenComp=%x, compr=%d flags=%d",
-					namebuf, (unsigned int)h->nameLen, (unsigned int)h->fileLenComp, h->compression, h->flags);
-			// Yay, this is the file we need!
-			p += h->nameLen; //Skip to content.
-			r = (EspFsFile *)malloc(sizeof(EspFsFile)); // Alloc file desc mem
-			ESP_LOGV(TAG, "Alloc %p", r);
-			if (r == NULL) return NULL;
-			r->header = h;
-			r->decompressor = h->compression;
-			r->posComp = p;
-			r->posStart = p;
-			r->posDecomp = 0;
-			if (h->compression == COMPRESS_NONE) {
-				r->decompData = NULL;
+	h = (EspFsHeader *)findHeader(fs, fileName);
+	if (h == NULL) {
+		return NULL;
+	}
+	ESP_LOGD(TAG, "Found file '%s'. Namelen=%x fileLenComp=%x, compr=%d flags=%d",
+			fileName, (unsigned int)h->nameLen, (unsigned int)h->fileLenComp, h->compression, h->flags);
+	// Yay, this is the file we need!
+	p = (char *)(h + 1) + h->nameLen; //Skip to content.
+	r = handleAlloc();
+	ESP_LOGV(TAG, "Alloc %p", r);
+	if (r == NULL) return NULL;
+	r->header = h;
+	r->decompressor = h->compression;
+	r->posComp = p;
+	r->posStart = p;
+	r->posDecomp = 0;
+	r->decompData = NULL;
+	r->blocks = NULL;
+	r->decoderSlot = -1;
+	if (h->compression == COMPRESS_NONE) {
 #if CONFIG_ESPFS_USE_HEATSHRINK
-			} else if (h->compression == COMPRESS_HEATSHRINK) {
-				// File is compressed with Heatshrink.
-				char parm;
-				heatshrink_decoder *dec;
-				// Decoder params are stored in 1st byte.
-				memcpy(&parm, r->posComp, 1);
-				r->posComp++;
-				ESP_LOGD(TAG, "Heatshrink compressed file; decode parms = %x", parm);
-				dec = heatshrink_decoder_alloc(16, (parm >> 4) & 0xf, parm & 0xf);
-				r->decompData=dec;
-#endif
-			} else {
-				ESP_LOGE(TAG, "Invalid compression: %d", h->compression);
-				free(r);
+	} else if (h->compression == COMPRESS_HEATSHRINK) {
+		// File is compressed with Heatshrink.
+		char parm;
+		Decoder *dec;
+		// Decoder params are stored in 1st byte.
+		memcpy(&parm, r->posComp, 1);
+		r->posComp++;
+		ESP_LOGD(TAG, "Heatshrink compressed file; decode parms = %x", parm);
+		if (h->flags & FLAG_BLOCKS) {
+			r->blocks = (const EspFsBlockHeader *)r->posStart;
+			if (r->blocks->numBlocks < 1 || r->blocks->blockBits < 8 || r->blocks->blockBits > 16) {
+				ESP_LOGE(TAG, "Invalid block header in '%s'", fileName);
+				handleFree(r);
 				return NULL;
 			}
-			return r;
+			r->posComp = blockStart(r, 0);
 		}
-		// We don't need this file. Skip name and file
-		p += h->nameLen + h->fileLenComp;
-		if ((uintptr_t)p & 3) {
-		    p += 4 - ((uintptr_t)p & 3); // align to next 32bit val
+		dec = decoderOpen(r, (parm >> 4) & 0xf, parm & 0xf);
+		if (dec == NULL) {
+			ESP_LOGE(TAG, "No decoder for parms %x", parm);
+			handleFree(r);
+			return NULL;
 		}
+		r->decompData=dec;
+#endif
+	} else {
+		ESP_LOGE(TAG, "Invalid compression: %d", h->compression);
+		handleFree(r);
+		return NULL;
 	}
+	return r;
 }
 
 int espFsStat(EspFs* fs, const char *fileName, EspFsStat *s)
@@ -207,55 +757,30 @@ int espFsStat(EspFs* fs, const char *fileName, EspFsStat *s)
 		return 0;
 	}
 
-	char *p = (char *)fs->memAddr;
-	EspFsHeader *h;
+	const EspFsHeader *h;
 
 	if(fileName[0]=='/') fileName++;
 	ESP_LOGD(TAG, "looking for file '%s'.", fileName);
 
-	size_t fileNameLen = strlen(fileName);
-	size_t dirNameLen;
-	char dirName[256];
-	if (fileName[fileNameLen - 1] != '/') {
-		strlcpy(dirName, fileName, sizeof(dirName) - 2);
-	    strcat(dirName, "/");
-		dirNameLen = fileNameLen + 1;
-	} else {
-		strlcpy(dirName, fileName, sizeof(dirName) - 1);
-		dirNameLen = fileNameLen + 1;
-	}
-
 	s->type = ESPFS_TYPE_MISSING;
 	s->size = 0;
 	s->flags = 0;
+	s->hash = 0;
 
-	while(1) {
-		h = (EspFsHeader*)p;
-		if (h->magic != ESPFS_MAGIC) {
-			ESP_LOGE(TAG, "Magic mismatch. EspFS image broken.");
-			return 0;
-		}
-		if (h->flags & FLAG_LASTFILE) {
-			ESP_LOGD(TAG, "End of image");
-			return 0;
-		}
-		p += sizeof(EspFsHeader);
-		if (strcmp((const char *)p, fileName) == 0) {
-			s->type = ESPFS_TYPE_FILE;
-			s->size = h->fileLenDecomp;
-			s->flags = h->flags;
-			return 1;
-		}
-		if (strncmp((const char *)p, dirName, dirNameLen)) {
-			s->type = ESPFS_TYPE_DIR;
-		}
-		p += h->nameLen + h->fileLenComp;
-		if ((uintptr_t)p & 3) {
-		    p += 4 - ((uintptr_t)p & 3); // align to next 32bit val
+	h = findHeader(fs, fileName);
+	if (h == NULL) {
+		return 0;
+	}
+	s->type = ESPFS_TYPE_FILE;
+	s->size = h->fileLenDecomp;
+	s->flags = h->flags;
+	if (h->flags & FLAG_HASH) {
+		const uint8_t *p = (const uint8_t *)(h + 1) + h->nameLen - ESPFS_HASH_LEN;
+		for (int i = ESPFS_HASH_LEN - 1; i >= 0; i--) {
+			s->hash = (s->hash << 8) | p[i];
 		}
 	}
-
-	return s->type != ESPFS_TYPE_MISSING;
+	return 1;
 }
 
 // Read len bytes from the given file into buff. Returns the actual amount of bytes read.
@@ -283,45 +808,43 @@ int espFsRead(EspFsFile *fh, char *buff, int len)
 #if CONFIG_ESPFS_USE_HEATSHRINK
 	} else if (fh->decompressor==COMPRESS_HEATSHRINK) {
 		memcpy((char*)&fdlen, (char*)&fh->header->fileLenDecomp, 4);
-		int decoded = 0;
-		size_t elen, rlen;
-		char ebuff[16];
-		heatshrink_decoder *dec = (heatshrink_decoder *)fh->decompData;
-		ESP_LOGV(TAG, "Alloc %p", dec);
+		int decoded;
+		Decoder *dec = (Decoder *)fh->decompData;
 		if (fh->posDecomp == fdlen) {
 			return 0;
 		}
 
-		// We must ensure that whole file is decompressed and written to output buffer.
-		// This means even when there is no input data (elen==0) try to poll decoder until
-		// posDecomp equals decompressed file length
+		if (fh->blocks) {
+			return readBlocks(fh, buff, len);
+		}
 
-		while(decoded < len) {
-			// Feed data into the decompressor
-			// ToDo: Check ret val of heatshrink fns for errors
-			elen = flen - (fh->posComp - fh->posStart);
-			if (elen>0) {
-				memcpy(ebuff, fh->posComp, 16);
-				heatshrink_decoder_sink(dec, (uint8_t *)ebuff, (elen > 16) ? 16 : elen, &rlen);
-				fh->posComp += rlen;
-			}
-			// Grab decompressed data and put into buff
-			heatshrink_decoder_poll(dec, (uint8_t *)buff, len - decoded, &rlen);
-			fh->posDecomp += rlen;
-			buff += rlen;
-			decoded += rlen;
-
-			ESP_LOGV(TAG, "Elen %d rlen %d d %d pd %d fdl %d", elen, rlen, decoded, fh->posDecomp, fdlen);
-
-			if (elen == 0) {
-				if (fh->posDecomp == fdlen) {
-					ESP_LOGD(TAG, "Decoder finish");
-					heatshrink_decoder_finish(dec);
-				}
-				return decoded;
+		// Reading the whole file at once needs no window
+		if (fh->posDecomp == 0 && len >= fdlen) {
+			uint8_t parm = *(uint8_t *)fh->posStart;
+			decoded = decodeWhole((uint8_t *)fh->posComp, flen - (fh->posComp - fh->posStart),
+					(uint8_t *)buff, fdlen, (parm >> 4) & 0xf, parm & 0xf);
+			if (decoded != fdlen) {
+				ESP_LOGE(TAG, "Corrupt heatshrink data at %p", fh->posStart);
+				return 0;
 			}
+			fh->posComp = fh->posStart + flen;
+			fh->posDecomp = fdlen;
+			return decoded;
 		}
-		return len;
+
+		if (fh->posDecomp == 0) {
+			decoderStart(dec, fh->posComp, fh->posStart + flen);
+		}
+		if (len > fdlen - fh->posDecomp) {
+			len = fdlen - fh->posDecomp;
+		}
+		decoded = decoderRead(dec, (uint8_t *)buff, len);
+		fh->posComp = (char *)dec->br.in;
+		fh->posDecomp += decoded;
+		if (decoded != len) {
+			ESP_LOGE(TAG, "Corrupt heatshrink data at %p", fh->posStart);
+		}
+		return decoded;
 #endif
 	}
 	return 0;
@@ -334,6 +857,23 @@ int espFsSeek(EspFsFile *fh, long offset, int mode)
 		return -1;
 	}
 
+#if CONFIG_ESPFS_USE_HEATSHRINK
+	if (fh->decompressor == COMPRESS_HEATSHRINK && !(mode == SEEK_CUR && offset == 0)) {
+		long target = mode == SEEK_SET ? offset : mode == SEEK_CUR ? fh->posDecomp + offset :
+				fh->header->fileLenDecomp + offset;
+		if ((mode == SEEK_SET && offset < 0) || (mode == SEEK_END && offset > 0) ||
+				(mode != SEEK_SET && mode != SEEK_CUR && mode != SEEK_END)) {
+			return -1;
+		}
+		if (target < 0) {
+			target = 0;
+		} else if (target > fh->header->fileLenDecomp) {
+			target = fh->header->fileLenDecomp;
+		}
+		return seekHeatshrink(fh, target);
+	}
+#endif
+
 	if (mode == SEEK_SET) {
 		if (offset < 0) {
 			return -1;
@@ -419,12 +959,11 @@ void espFsClose(EspFsFile *fh)
 	if (fh == NULL) return;
 #if CONFIG_ESPFS_USE_HEATSHRINK
 	if (fh->decompressor == COMPRESS_HEATSHRINK) {
-		heatshrink_decoder *dec = (heatshrink_decoder *)fh->decompData;
-		heatshrink_decoder_free(dec);
-		ESP_LOGV(TAG, "Freed %p", dec);
+		decoderClose(fh);
+		ESP_LOGV(TAG, "Freed %p", fh->decompData);
 	}
 #endif
 
 	ESP_LOGV(TAG, "Freed %p", fh);
-	free(fh);
+	handleFree(fh);
 }
\ No newline at end of file
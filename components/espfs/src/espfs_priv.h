@@ -3,12 +3,17 @@
 #include <stddef.h>
 #include "esp_partition.h"
 #include "espfsformat.h"
+#include "espfs.h"
 
 struct EspFs {
 	const void *memAddr;
 	spi_flash_mmap_handle_t mmapHandle;
 	size_t length;
 	size_t numFiles;
+	const EspFsIndexHeader *index; //NULL for images without a name index
+	const EspFsTrailer *trailer; //NULL for images without a trailer
+	volatile enum EspFsIntegrity integrity;
+	uint8_t refs; //Owner plus a running background check, see release()
 };
 
 struct EspFsFile {
@@ -18,4 +23,7 @@ struct EspFsFile {
 	char *posStart;
 	char *posComp;
 	void *decompData;
+	const EspFsBlockHeader *blocks; //NULL unless compressed in blocks
+	int8_t poolSlot; //-1 when malloc'd
+	int8_t decoderSlot; //-1 when the decoder was malloc'd
 };
\ No newline at end of file
@@ -1,9 +1,12 @@
 #!/usr/bin/env python
 
+import hashlib
 import os
 import shutil
 import subprocess
 import sys
+import time
+from multiprocessing.pool import ThreadPool
 
 ESPFS_IMAGEROOTDIR = sys.argv[1]
 
@@ -14,6 +17,9 @@ CONFIG_ESPFS_HTML_MINIFY_HTMLMINIFIER = os.environ.get('CONFIG_ESPFS_HTML_MINIFY
 CONFIG_ESPFS_JS_CONVERT_BABEL = os.environ.get('CONFIG_ESPFS_JS_CONVERT_BABEL')
 CONFIG_ESPFS_JS_MINIFY_BABEL = os.environ.get('CONFIG_ESPFS_JS_MINIFY_BABEL')
 CONFIG_ESPFS_JS_MINIFY_UGLIFYJS = os.environ.get('CONFIG_ESPFS_JS_MINIFY_UGLIFYJS')
+CONFIG_ESPFS_HEATSHRINK_BLOCK_BITS = os.environ.get('CONFIG_ESPFS_HEATSHRINK_BLOCK_BITS') or '0'
+CONFIG_ESPFS_BEST_COMPRESSION = os.environ.get('CONFIG_ESPFS_BEST_COMPRESSION')
+CONFIG_ESPFS_DECODER_POOL_WINDOW_BITS = os.environ.get('CONFIG_ESPFS_DECODER_POOL_WINDOW_BITS') or '15'
 
 CONFIG_ESPFS_UGLIFYCSS_PATH = os.environ.get('CONFIG_ESPFS_UGLIFYCSS_PATH}') or 'uglifycss'
 if CONFIG_ESPFS_UGLIFYCSS_PATH == 'uglifycss':
@@ -35,9 +41,74 @@ if CONFIG_ESPFS_UGLIFYJS_PATH == 'uglifyjs':
 os.chdir(BUILD_DIR)
 os.environ["PATH"] += os.pathsep + os.path.join(BUILD_DIR, 'mkespfsimage')
 
+CACHE_DIR = os.path.join(BUILD_DIR, 'espfs_cache')
+MINIFY_CACHE_DIR = os.path.join(CACHE_DIR, 'minified')
+
+# The commands whose output, piped from one to the next, replaces the file, or None to copy it
+def preprocess_commands(source):
+    _, ext = os.path.splitext(source)
+    if ext == '.css' and CONFIG_ESPFS_CSS_MINIFY_UGLIFYCSS == 'y':
+        return [['node', CONFIG_ESPFS_UGLIFYCSS_PATH, source]]
+    elif ext in ['.html', '.htm'] and CONFIG_ESPFS_HTML_MINIFY_HTMLMINIFIER == 'y':
+        return [['node', CONFIG_ESPFS_HTMLMINIFIER_PATH,
+            '--collapse-whitespace', '--remove-comments',
+            '--use-short-doctype', '--minify-css true',
+            '--minify-js', 'true', source]]
+    elif ext == '.js':
+        if CONFIG_ESPFS_JS_CONVERT_BABEL == 'y' and CONFIG_ESPFS_JS_MINIFY_BABEL == 'y':
+            return [['node', CONFIG_ESPFS_BABEL_PATH, '--presets', '@babel/preset-env,minify', source]]
+        elif CONFIG_ESPFS_JS_CONVERT_BABEL == 'y' and CONFIG_ESPFS_JS_MINIFY_UGLIFYJS == 'y':
+            return [['node', CONFIG_ESPFS_BABEL_PATH, '--presets', '@babel/preset-env', source],
+                ['node', CONFIG_ESPFS_UGLIFYJS_PATH]]
+        elif CONFIG_ESPFS_JS_CONVERT_BABEL == 'y':
+            return [['node', CONFIG_ESPFS_BABEL_PATH, '--presets', '@babel/preset-env', source]]
+        elif CONFIG_ESPFS_JS_MINIFY_BABEL == 'y':
+            return [['node', CONFIG_ESPFS_BABEL_PATH, '--presets', 'minify', source]]
+        elif CONFIG_ESPFS_JS_MINIFY_UGLIFYJS == 'y':
+            return [['node', CONFIG_ESPFS_UGLIFYJS_PATH, source]]
+    return None
+
+# Minifier output is cached on the source contents and the commands, without the path
+def preprocess(job):
+    source, destfile = job
+    commands = preprocess_commands(source)
+    if commands is None:
+        shutil.copy2(source, destfile)
+        return False
+    key = hashlib.sha1()
+    with open(source, 'rb') as f:
+        key.update(f.read())
+    key.update(repr([[arg for arg in command if arg != source] for command in commands]).encode('utf-8'))
+    cached = os.path.join(MINIFY_CACHE_DIR, key.hexdigest())
+    if os.path.exists(cached):
+        shutil.copyfile(cached, destfile)
+        return True
+    with open(destfile, 'wb') as f:
+        processes = []
+        for i, command in enumerate(commands):
+            stdin = processes[-1].stdout if processes else None
+            stdout = f if i == len(commands) - 1 else subprocess.PIPE
+            processes.append(subprocess.Popen(command, stdin=stdin, stdout=stdout))
+            if stdin is not None:
+                stdin.close()
+        for command, process in zip(commands, processes):
+            if process.wait() != 0:
+                raise subprocess.CalledProcessError(process.returncode, command)
+    tmp = '{}.{}.tmp'.format(cached, os.getpid())
+    shutil.copyfile(destfile, tmp)
+    try:
+        os.rename(tmp, cached)
+    except OSError:
+        os.remove(tmp)
+    return False
+
 if CONFIG_ESPFS_PREPROCESS_FILES == 'y':
+    start = time.time()
     build = os.path.join(BUILD_DIR, 'espfs')
     shutil.rmtree(build, ignore_errors=True)
+    if not os.path.isdir(MINIFY_CACHE_DIR):
+        os.makedirs(MINIFY_CACHE_DIR)
+    jobs = []
     for root, _, files in os.walk(ESPFS_IMAGEROOTDIR):
         dest = os.path.relpath(root, ESPFS_IMAGEROOTDIR)
         if dest == '.':
@@ -47,40 +118,11 @@ if CONFIG_ESPFS_PREPROCESS_FILES == 'y':
         if not os.path.isdir(dest):
             os.mkdir(dest)
         for filename in files:
-            source = os.path.join(root, filename)
-            destfile = os.path.join(dest, filename)
-            _, ext = os.path.splitext(source)
-            if ext == '.css' and CONFIG_ESPFS_CSS_MINIFY_UGLIFYCSS == 'y':
-                with open(destfile, 'w') as f:
-                    subprocess.check_call(['node', CONFIG_ESPFS_UGLIFYCSS_PATH, source], stdout=f)
-            elif ext in ['.html', '.htm'] and CONFIG_ESPFS_HTML_MINIFY_HTMLMINIFIER == 'y':
-                with open(destfile, 'w') as f:
-                    subprocess.check_call(['node', CONFIG_ESPFS_HTMLMINIFIER_PATH,
-                        '--collapse-whitespace', '--remove-comments',
-                        '--use-short-doctype', '--minify-css true',
-                        '--minify-js', 'true', source], stdout=f)
-            elif ext == '.js' and (CONFIG_ESPFS_JS_CONVERT_BABEL == 'y' or \
-                    CONFIG_ESPFS_JS_MINIFY_BABEL == 'y' or \
-                    CONFIG_ESPFS_JS_MINIFY_UGLIFYJS == 'y'):
-                with open(destfile, 'w') as f:
-                    if CONFIG_ESPFS_JS_CONVERT_BABEL == 'y' and CONFIG_ESPFS_JS_MINIFY_BABEL == 'y':
-                        subprocess.check_call(['node', CONFIG_ESPFS_BABEL_PATH, '--presets',
-                            '@babel/preset-env,minify', source], stdout=f)
-                    elif CONFIG_ESPFS_JS_CONVERT_BABEL == 'y' and CONFIG_ESPFS_JS_MINIFY_UGLIFYJS == 'y':
-                        babel = subprocess.check_call(['node', CONFIG_ESPFS_BABEL_PATH, '--presets',
-                            '@babel/preset-env', source], stdout=subprocess.PIPE)
-                        subprocess.check_call(['node', CONFIG_ESPFS_UGLIFYJS_PATH], stdin=babel.stdout, stdout=f)
-                    elif CONFIG_ESPFS_JS_CONVERT_BABEL == 'y':
-                        subprocess.check_call(['node', CONFIG_ESPFS_BABEL_PATH, '--presets',
-                            '@babel/preset-env', source], stdout=f)
-                    elif CONFIG_ESPFS_JS_MINIFY_BABEL == 'y':
-                        subprocess.check_call(['node', CONFIG_ESPFS_BABEL_PATH, '--presets',
-                            'minify', source], stdout=f)
-                    elif CONFIG_ESPFS_JS_MINIFY_UGLIFYJS == 'y':
-                        with open(source, 'r') as infile:
-                            subprocess.check_call(['node', CONFIG_ESPFS_UGLIFYJS_PATH], stdin=infile, stdout=f)
-            else:
-                shutil.copy2(source, dest)
+            jobs.append((os.path.join(root, filename), os.path.join(dest, filename)))
+    pool = ThreadPool()
+    cached = pool.map(preprocess, jobs)
+    pool.close()
+    print('Preprocessed {} files, {} from cache, in {:.2f} s'.format(len(jobs), sum(cached), time.time() - start))
     ESPFS_IMAGEROOTDIR = build
 
 os.chdir(ESPFS_IMAGEROOTDIR)
@@ -94,8 +136,15 @@ for root, _, files in os.walk(ESPFS_IMAGEROOTDIR):
 
 espfs_image_path = os.path.join(BUILD_DIR, 'espfs_image.bin')
 with open(espfs_image_path, 'wb') as f:
-    mkespfsimage = subprocess.Popen(['mkespfsimage'], stdin=subprocess.PIPE, stdout=f)
+    args = ['mkespfsimage', '-C', os.path.join(CACHE_DIR, 'compressed')]
+    if CONFIG_ESPFS_HEATSHRINK_BLOCK_BITS != '0':
+        args += ['-b', CONFIG_ESPFS_HEATSHRINK_BLOCK_BITS]
+    if CONFIG_ESPFS_BEST_COMPRESSION == 'y':
+        args += ['-O', CONFIG_ESPFS_DECODER_POOL_WINDOW_BITS]
+    start = time.time()
+    mkespfsimage = subprocess.Popen(args, stdin=subprocess.PIPE, stdout=f)
     mkespfsimage.communicate(('\n'.join(filelist) + '\n').encode('utf-8'))
+    print('Built espfs image in {:.2f} s'.format(time.time() - start))
 
 os.chdir(BUILD_DIR)
 if not os.path.exists('include'):
@@ -0,0 +1,186 @@
+/*
+ * Heatshrink decoder and run archive helpers.
+ *
+ * Archives served by /runs/archive are heatshrink streams written by the
+ * bundled encoder. Bits are read MSB first: a 1 tag bit is followed by a
+ * literal byte, a 0 tag bit by a back reference of (offset - 1) in
+ * windowBits bits and (count - 1) in lookaheadBits bits.
+ */
+var heatshrink = (function () {
+    function decode(input, windowBits, lookaheadBits) {
+        var out = new Uint8Array(Math.max(1024, input.length * 4));
+        var outLen = 0;
+        var bytePos = 0;
+        var bitMask = 0;
+        var current = 0;
+        var bitsLeft = input.length * 8;
+
+        function getBits(count) {
+            if (count > bitsLeft) {
+                return -1;
+            }
+            bitsLeft -= count;
+            var value = 0;
+            while (count--) {
+                if (bitMask === 0) {
+                    current = input[bytePos++];
+                    bitMask = 0x80;
+                }
+                value = (value << 1) | ((current & bitMask) ? 1 : 0);
+                bitMask >>= 1;
+            }
+            return value;
+        }
+
+        function push(byte) {
+            if (outLen === out.length) {
+                var grown = new Uint8Array(out.length * 2);
+                grown.set(out);
+                out = grown;
+            }
+            out[outLen++] = byte;
+        }
+
+        while (true) {
+            var tag = getBits(1);
+            if (tag < 0) {
+                break;
+            }
+            if (tag) {
+                var literal = getBits(8);
+                if (literal < 0) {
+                    break;
+                }
+                push(literal);
+            } else {
+                var index = getBits(windowBits);
+                var count = getBits(lookaheadBits);
+                if (index < 0 || count < 0) {
+                    break;      // Zero padding at the end of the stream
+                }
+                for (var i = 0; i <= count; i++) {
+                    push(out[outLen - index - 1]);
+                }
+            }
+        }
+        return out.subarray(0, outLen);
+    }
+
+    // Reads back the tsCodec blocks of a run archive. Mirrors tsDecoder_next
+    // in main/tsCodec.c: timestamps are delta-of-delta and temperatures
+    // deltas, each in the smallest of a few unary-prefixed buckets
+    var TIME_BUCKETS = [0, 7, 9, 12, 32];
+    var VALUE_BUCKETS = [0, 3, 6, 12, 32];
+
+    function decodeBlock(data, start, len, nChannels, nSamples, scale, rows) {
+        var bitPos = start * 8;
+        var bitEnd = (start + len) * 8;
+        var time = 0;
+        var timeDelta = 0;
+        var values = [];
+
+        function readBits(count) {
+            if (bitPos + count > bitEnd) {
+                throw new Error('Truncated tsCodec block');
+            }
+            var value = 0;
+            while (count--) {
+                value = value * 2 + ((data[bitPos >> 3] >> (7 - (bitPos & 7))) & 1);
+                bitPos++;
+            }
+            return value;
+        }
+
+        // Returns the delta, or null for the escape bucket holding an absolute value
+        function readBucketed(buckets) {
+            var bucket = 0;
+            while (bucket < buckets.length - 1 && readBits(1)) {
+                bucket++;
+            }
+            var payload = readBits(buckets[bucket]);
+            if (bucket === buckets.length - 1) {
+                return {absolute: payload | 0};
+            }
+            return {delta: (payload % 2) ? -(payload + 1) / 2 : payload / 2};
+        }
+
+        for (var i = 0; i < nChannels; i++) {
+            values.push(0);
+        }
+        for (var n = 0; n < nSamples; n++) {
+            if (n === 0) {
+                time = readBits(32);
+            } else {
+                var dod = readBucketed(TIME_BUCKETS);
+                timeDelta += ('absolute' in dod) ? dod.absolute : dod.delta;
+                time = (time + timeDelta) >>> 0;
+            }
+            var row = [time];
+            for (i = 0; i < nChannels; i++) {
+                var v = readBucketed(VALUE_BUCKETS);
+                values[i] = ('absolute' in v) ? v.absolute : values[i] + v.delta;
+                row.push(values[i] / scale);
+            }
+            rows.push(row.join(','));
+        }
+    }
+
+    // Turns a decompressed run archive, two CSV header lines followed by
+    // tsCodec blocks each led by a 16 bit sample count and length, into a
+    // CSV of absolute times (ms) and temperatures (degC)
+    function archiveToCsv(data) {
+        var lineEnd = data.indexOf(10);
+        var headerEnd = data.indexOf(10, lineEnd + 1);
+        var comment = new TextDecoder().decode(data.subarray(0, lineEnd));
+        var header = new TextDecoder().decode(data.subarray(lineEnd + 1, headerEnd));
+        var m = /tsCodec blocks, 1\/(\d+) degC/.exec(comment);
+        if (lineEnd < 0 || headerEnd < 0 || !m) {
+            throw new Error('Unknown run archive format');
+        }
+
+        var scale = parseInt(m[1], 10);
+        var nChannels = header.split(',').length - 1;
+        var rows = [header];
+        var pos = headerEnd + 1;
+        while (pos + 4 <= data.length) {
+            var nSamples = data[pos] | (data[pos + 1] << 8);
+            var len = data[pos + 2] | (data[pos + 3] << 8);
+            pos += 4;
+            if (pos + len > data.length) {
+                throw new Error('Truncated run archive');
+            }
+            decodeBlock(data, pos, len, nChannels, nSamples, scale, rows);
+            pos += len;
+        }
+        return rows.join('\n') + '\n';
+    }
+
+    function downloadRun(id) {
+        return fetch('/runs/archive?id=' + id).then(function (response) {
+            if (!response.ok) {
+                throw new Error('No archive for run ' + id);
+            }
+            var windowBits = parseInt(response.headers.get('X-Heatshrink-Window') || '8', 10);
+            var lookaheadBits = parseInt(response.headers.get('X-Heatshrink-Lookahead') || '4', 10);
+            return response.arrayBuffer().then(function (buffer) {
+                var raw = decode(new Uint8Array(buffer), windowBits, lookaheadBits);
+                var blob = new Blob([archiveToCsv(raw)], {type: 'text/csv'});
+                var link = document.createElement('a');
+                link.href = URL.createObjectURL(blob);
+                link.download = 'run' + id + '.csv';
+                link.click();
+                URL.revokeObjectURL(link.href);
+            });
+        });
+    }
+
+    return {
+        decode: decode,
+        archiveToCsv: archiveToCsv,
+        downloadRun: downloadRun
+    };
+})();
+
+if (typeof module !== 'undefined') {
+    module.exports = heatshrink;
+}
@@ -18,6 +18,7 @@ extern "C" {
 #include "input.h"
 #include "networking.h"
 #include "sensors.h"
+#include "profiler.h"
 
 static char tag[] = "LCD test";
 static menuStack_t menuStack;
@@ -249,8 +250,9 @@ void mainScreen(int btn)
         initScreen = true;
     }
 
-    updateTemperatures(temps);
-        
+    get_latest_temperatures(temps);
+
+    PROFILE_BEGIN(prof_lcdRedraw);
     LCD_setCursor(4, 1);
     snprintf(txtBuf, 6, "%.2f", getTemperature(temps, T_refluxHot));
     LCD_writeStr(txtBuf);
@@ -270,6 +272,7 @@ void mainScreen(int btn)
     LCD_setCursor(8, 3);
     snprintf(txtBuf, 6, "%.2f", getTemperature(temps, T_boiler));
     LCD_writeStr(txtBuf);
+    PROFILE_END(prof_lcdRedraw);
 }
 
 static void loadControllerSettings(void)
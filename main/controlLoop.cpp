@@ -18,6 +18,10 @@ extern "C" {
 #include "driver/gpio.h"
 #include "messages.h"
 #include "pinDefs.h"
+#include "runRecorder.h"
+#include "profiler.h"
+#include "latencyTrace.h"
+#include "telemetry.h"
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
@@ -42,6 +46,9 @@ static bool element1_status = 0, element2_status = 0, flushSystem = 0, prodManua
 static int fanState = 0;
 
 static Data controllerSettings;
+static loopTiming_t loopTiming;
+static float latestTemps[n_tempSensors];
+static uint16_t refluxPumpSpeed = 0, productPumpSpeed = 0;
 xQueueHandle dataQueue;
 xQueueHandle cmdQueue;
 uint16_t ctrl_loop_period_ms;
@@ -141,17 +148,52 @@ Data getSettingsFromNVM(void)
     return settings;
 }
 
+static void recordLoopPeriod(int64_t periodUs)
+{
+    int32_t jitter = periodUs - ctrl_loop_period_ms * 1000;
+    uint32_t magnitude = abs(jitter);
+    int bucket = magnitude ? 32 - __builtin_clz(magnitude) : 0;
+
+    loopTiming.iterations++;
+    loopTiming.lastPeriodUs = periodUs;
+    loopTiming.jitterHist[bucket < LOOP_JITTER_BUCKETS ? bucket : LOOP_JITTER_BUCKETS - 1]++;
+    if (jitter > loopTiming.maxLateUs) {
+        loopTiming.maxLateUs = jitter;
+    } else if (jitter < loopTiming.maxEarlyUs) {
+        loopTiming.maxEarlyUs = jitter;
+    }
+}
+
+static void recordLoopWork(int64_t workUs)
+{
+    if (workUs > ctrl_loop_period_ms * 1000) {
+        loopTiming.deadlineMisses++;
+    }
+    if (workUs > loopTiming.maxWorkUs) {
+        loopTiming.maxWorkUs = workUs;
+    }
+}
+
 void control_loop(void* params)
 {
     float temperatures[n_tempSensors] = {0};
+    tempSample_t sample;
     Data settings = getSettingsFromNVM();
     controllerSettings= settings;
     Cmd_t cmdSettings;
     Controller Ctrl = Controller(CONTROL_LOOP_FREQUENCY, settings, REFLUX_PUMP, LEDC_CHANNEL_0, LEDC_TIMER_0, PROD_PUMP, LEDC_CHANNEL_1, LEDC_TIMER_1, FAN_SWITCH, ELEMENT_1, ELEMENT_2);
     portTickType xLastWakeTime = xTaskGetTickCount();
+    int64_t lastWakeUs = 0;
     ESP_LOGI(tag, "Control loop active");
     
     while (true) {
+        PROFILE_BEGIN(prof_controlTick);
+        int64_t wakeUs = esp_timer_get_time();
+        if (lastWakeUs != 0) {
+            recordLoopPeriod(wakeUs - lastWakeUs);
+        }
+        lastWakeUs = wakeUs;
+
         if (uxQueueMessagesWaiting(dataQueue)) {
             xQueueReceive(dataQueue, &controllerSettings, 50 / portTICK_PERIOD_MS);
             flash_pin(LED_PIN, 100);
@@ -164,29 +206,54 @@ void control_loop(void* params)
             flash_pin(LED_PIN, 100);
             Ctrl.processCommand(cmdSettings);
             fanState = Ctrl.getFanState();
+
+            // A run lasts for as long as the main element is on
+            if (Ctrl.getElem24State() != element1_status) {
+                Ctrl.getElem24State() ? runRecorder_startRun() : runRecorder_endRun();
+            }
             element1_status = Ctrl.getElem24State();
             element2_status = Ctrl.getElem3State();
             flushSystem = Ctrl.getFlush();
             prodManual = Ctrl.getProdManual();
         }
         
-        updateTemperatures(temperatures);
+        updateTemperatureSample(&sample);
+        memcpy(temperatures, sample.temps, sizeof(temperatures));
+        runRecorder_logSample(temperatures);
         checkFan(getTemperature(temperatures, T_refluxHot));
 
-        Ctrl.updatePumpSpeed(temperatures[0]);
+        {
+            PROFILE_ZONE(prof_pumpUpdate);
+#if CONTROL_LOOP_MEASURED_DT
+            Ctrl.updatePumpSpeed(temperatures[0], loopTiming.lastPeriodUs / 1e6);
+#else
+            Ctrl.updatePumpSpeed(temperatures[0]);
+#endif
+        }
+        memcpy(latestTemps, temperatures, sizeof(latestTemps));
+        refluxPumpSpeed = Ctrl.getRefluxSpeed();
+        productPumpSpeed = Ctrl.getProductSpeed();
+        latency_recordActuation(&sample, esp_timer_get_time());
+        recordLoopWork(esp_timer_get_time() - wakeUs);
+        telemetry_notifyTick();
+        PROFILE_END(prof_controlTick);
         vTaskDelayUntil(&xLastWakeTime, 200 / portTICK_PERIOD_MS);
     }
 }
 
-esp_err_t updateTemperatures(float tempArray[])
+esp_err_t updateTemperatureSample(tempSample_t* sample)
 {
-    static float temperatures[n_tempSensors] = {0};
-    if (xQueueReceive(tempQueue, temperatures, 100 / portTICK_PERIOD_MS)) {
-        memcpy(tempArray, temperatures, n_tempSensors * sizeof(float));
+    static tempSample_t lastSample = {0};
+    tempSample_t newSample;
+
+    if (xQueueReceive(tempQueue, &newSample, 100 / portTICK_PERIOD_MS)) {
+        newSample.dequeueUs = esp_timer_get_time();
+        lastSample = newSample;
+        *sample = newSample;
         return ESP_OK;
     }
 
-    memcpy(tempArray, temperatures, n_tempSensors * sizeof(float));     // If no new temps in queue, copy most recent reading
+    *sample = lastSample;       // If no new temps in queue, copy most recent reading
     return ESP_ERR_NOT_FOUND;
 }
 
@@ -232,6 +299,26 @@ bool get_fan_state(void)
     return fanState;
 }
 
+loopTiming_t get_loop_timing(void)
+{
+    return loopTiming;
+}
+
+void get_latest_temperatures(float tempArray[])
+{
+    memcpy(tempArray, latestTemps, sizeof(latestTemps));
+}
+
+uint16_t get_refluxPumpSpeed(void)
+{
+    return refluxPumpSpeed;
+}
+
+uint16_t get_productPumpSpeed(void)
+{
+    return productPumpSpeed;
+}
+
 bool getFlush(void)
 {
     return flushSystem;
@@ -6,15 +6,31 @@ extern "C" {
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
+#include "sensors.h"
 
 #define CONTROL_LOOP_RATE 5.0f
 #define CONTROL_LOOP_PERIOD 1.0f / CONTROL_LOOP_RATE
 #define SENSOR_SAMPLE_RATE 5.0f
 #define SENSOR_SAMPLE_PERIOD 1.0f / SENSOR_SAMPLE_RATE
+#define CONTROL_LOOP_MEASURED_DT 0          // Set to 1 to run the PID on the measured loop period
+#define LOOP_JITTER_BUCKETS 20
 
 extern xQueueHandle dataQueue;
 extern xQueueHandle cmdQueue;
 
+// Control loop timing. Jitter is the measured period minus the nominal
+// period. Bucket 0 counts jitter under 1 us, bucket i counts jitter of
+// [2^(i-1), 2^i) us in either direction
+typedef struct {
+    uint32_t iterations;
+    uint32_t deadlineMisses;            // Iterations whose work overran the period
+    uint32_t lastPeriodUs;
+    int32_t maxLateUs;
+    int32_t maxEarlyUs;
+    uint32_t maxWorkUs;
+    uint32_t jitterHist[LOOP_JITTER_BUCKETS];
+} loopTiming_t;
+
 // Controller Settings
 // Must remain in this header so other C files can include it
 typedef struct { 
@@ -25,13 +41,15 @@ typedef struct {
 } Data;
 
 /*
-*   --------------------------------------------------------------------  
-*   updateTemperatures
 *   --------------------------------------------------------------------
-*   Retrieves the most recently read temperatures and writes them into
-*   tempArray
+*   updateTemperatureSample
+*   --------------------------------------------------------------------
+*   Takes the next reading off tempQueue, with its trace id and
+*   timestamps. If no new reading arrived the previous sample is
+*   returned unchanged. The control loop is the only consumer; other
+*   tasks use get_latest_temperatures
 */
-esp_err_t updateTemperatures(float tempArray[]);
+esp_err_t updateTemperatureSample(tempSample_t* sample);
 
 /*
 *   --------------------------------------------------------------------  
@@ -166,6 +184,34 @@ float getVapourConcentration(float vapourTemp);
 
 Data getSettingsFromNVM(void);
 
+/*
+*   --------------------------------------------------------------------
+*   get_loop_timing
+*   --------------------------------------------------------------------
+*   Returns the control loop period jitter and deadline statistics
+*/
+loopTiming_t get_loop_timing(void);
+
+/*
+*   --------------------------------------------------------------------
+*   get_latest_temperatures
+*   --------------------------------------------------------------------
+*   Copies the temperatures used by the most recent control loop
+*   iteration. Unlike updateTemperatureSample this does not consume tempQueue
+*/
+void get_latest_temperatures(float tempArray[]);
+
+/*
+*   --------------------------------------------------------------------
+*   get_refluxPumpSpeed
+*   --------------------------------------------------------------------
+*   Pump duties commanded by the most recent control loop iteration, in
+*   the range 0 to PUMP_MAX_OUTPUT
+*/
+uint16_t get_refluxPumpSpeed(void);
+
+uint16_t get_productPumpSpeed(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -55,9 +55,21 @@ void Controller::_initPumps(gpio_num_t P1_pin, ledc_channel_t P1_channel, ledc_t
 
 void Controller::updatePumpSpeed(double temp)
 {
+    updatePumpSpeed(temp, _updatePeriod);
+}
+
+void Controller::updatePumpSpeed(double temp, double dt)
+{
+    // A stalled or bunched up iteration must not kick the derivative term
+    if (dt < 0.5 * _updatePeriod) {
+        dt = 0.5 * _updatePeriod;
+    } else if (dt > 2 * _updatePeriod) {
+        dt = 2 * _updatePeriod;
+    }
+
     uint16_t pumpSpeed = _refluxPump.getSpeed();
     double err = temp - _settings.setpoint;
-    double d_error = (err - _prevError) / _updatePeriod;
+    double d_error = (err - _prevError) / dt;
     _prevError = err;
 
     // Basic anti integral windup strategy
@@ -66,7 +78,7 @@ void Controller::updatePumpSpeed(double temp)
     } else if (pumpSpeed < PUMP_MIN_OUTPUT) {
         _integral = (PUMP_MIN_OUTPUT - _settings.P_gain * err - _settings.D_gain * d_error) / _settings.I_gain;
     } else {
-        _integral += err * _updatePeriod;
+        _integral += err * dt;
     }
 
     double output = _settings.P_gain * err + _settings.D_gain * d_error + _settings.I_gain * _integral;
@@ -22,6 +22,7 @@ class Controller
         Controller();
 
         void updatePumpSpeed(double temp);
+        void updatePumpSpeed(double temp, double dt);
         void updateComponents();
         void processCommand(Cmd_t cmd);
 
@@ -0,0 +1,135 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include "libesphttpd/httpd.h"
+#include "espfs.h"
+#include "espfsformat.h"
+#include "espfsRoute.h"
+
+static EspFs* fs = NULL;
+static espfsRouteStats_t stats;
+
+void espfsRoute_init(EspFs* pFs)
+{
+    fs = pFs;
+}
+
+static bool etagMatches(HttpdConnData* connData, const char* etag)
+{
+    // The header may list several tags, or be * for any version
+    char buff[128];
+
+    return httpdGetHeader(connData, "If-None-Match", buff, sizeof(buff)) &&
+           (strcmp(buff, "*") == 0 || strstr(buff, etag) != NULL);
+}
+
+CgiStatus cgiEspFs(HttpdConnData* connData)
+{
+    EspFsFile* file = connData->cgiData;
+    char path[ESPFS_ROUTE_PATH_LEN];
+    char chunk[ESPFS_ROUTE_CHUNK];
+    char etag[20];
+    char buff[64];
+    const char* data;
+    EspFsStat st;
+
+    if (connData->isConnectionClosed) {
+        espFsClose(file);
+        connData->cgiData = NULL;
+        return HTTPD_CGI_DONE;
+    }
+
+    if (file == NULL) {
+        if (fs == NULL || connData->requestType != HTTPD_METHOD_GET) {
+            return HTTPD_CGI_NOTFOUND;
+        }
+
+        // Directories are served by their index.html, as ROUTE_FILESYSTEM does
+        int len = snprintf(path, sizeof(path), "%s%s", connData->url,
+                           connData->url[strlen(connData->url) - 1] == '/' ? "index.html" : "");
+        if (len >= sizeof(path) || !espFsStat(fs, path, &st)) {
+            return HTTPD_CGI_NOTFOUND;
+        }
+        // Leaves the reply for clients without gzip to ROUTE_FILESYSTEM
+        if ((st.flags & FLAG_GZIP) &&
+            (httpdGetHeader(connData, "Accept-Encoding", buff, sizeof(buff)) == 0 || strstr(buff, "gzip") == NULL)) {
+            return HTTPD_CGI_NOTFOUND;
+        }
+
+        if (st.hash != 0) {
+            snprintf(etag, sizeof(etag), "\"%08x%08x\"", (uint32_t) (st.hash >> 32), (uint32_t) st.hash);
+            if (etagMatches(connData, etag)) {
+                stats.notModified++;
+                httpdStartResponse(connData, 304);
+                httpdHeader(connData, "ETag", etag);
+                httpdHeader(connData, "Cache-Control", "no-cache");
+                httpdEndHeaders(connData);
+                return HTTPD_CGI_DONE;
+            }
+        }
+
+        file = espFsOpen(fs, path);
+        if (file == NULL) {
+            return HTTPD_CGI_NOTFOUND;
+        }
+        connData->cgiData = file;
+        stats.served++;
+
+        httpdStartResponse(connData, 200);
+        httpdHeader(connData, "Content-Type", httpdGetMimetype(connData->url));
+        snprintf(buff, sizeof(buff), "%d", st.size);
+        httpdHeader(connData, "Content-Length", buff);
+        if (st.flags & FLAG_GZIP) {
+            httpdHeader(connData, "Content-Encoding", "gzip");
+        }
+        if (st.hash != 0) {
+            // Revalidated on every load, which costs a 304 while unchanged
+            httpdHeader(connData, "ETag", etag);
+            httpdHeader(connData, "Cache-Control", "no-cache");
+        } else if (st.flags & FLAG_GZIP) {
+            httpdHeader(connData, "Cache-Control", "max-age=3600, must-revalidate");
+        }
+        httpdEndHeaders(connData);
+        return HTTPD_CGI_MORE;
+    }
+
+    // Mapped files use the file position as the send cursor, data is the
+    // start of the file. Heatshrink files are decompressed a chunk a call
+    int len = espFsAccess(file, (void**) &data);
+    int pos = espFsSeek(file, 0, SEEK_CUR);
+    int n = 0;
+    if (len < 0) {
+        len = espFsFilesize(file);
+        n = espFsRead(file, chunk, ESPFS_ROUTE_CHUNK);
+        if (n > 0) {
+            httpdSend(connData, chunk, n);
+        }
+    } else {
+        n = len - pos < ESPFS_ROUTE_CHUNK ? len - pos : ESPFS_ROUTE_CHUNK;
+        if (n > 0 && httpdSend(connData, &data[pos], n)) {
+            espFsSeek(file, n, SEEK_CUR);
+        } else {
+            n = 0;
+        }
+    }
+    stats.bytesSent += n;
+
+    if (pos + n >= len || (n <= 0 && espFsIsCompressed(file))) {
+        espFsClose(file);
+        connData->cgiData = NULL;
+        return HTTPD_CGI_DONE;
+    }
+    return HTTPD_CGI_MORE;
+}
+
+espfsRouteStats_t espfsRoute_getStats(void)
+{
+    return stats;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "libesphttpd/httpd.h"
+#include "espfs.h"
+
+#define ESPFS_ROUTE_CHUNK 1024          // Per CGI call, half of libesphttpd's send buffer
+#define ESPFS_ROUTE_PATH_LEN 128
+
+typedef struct {
+    uint32_t served;                    // 200s, mapped or decompressed
+    uint32_t notModified;               // 304s answered from the stored hash
+    uint32_t bytesSent;                 // Bodies only
+} espfsRouteStats_t;
+
+/*
+*   --------------------------------------------------------------------
+*   espfsRoute_init
+*   --------------------------------------------------------------------
+*   Sets the image cgiEspFs serves from
+*/
+void espfsRoute_init(EspFs* pFs);
+
+/*
+*   --------------------------------------------------------------------
+*   cgiEspFs
+*   --------------------------------------------------------------------
+*   Serves files from the image. Uncompressed and gzip files are sent
+*   from pointers into the mapped image, heatshrink files through
+*   espFsRead. Files with a stored content hash get it as a strong ETag,
+*   and a matching If-None-Match is answered 304 without opening the
+*   file. Clients without gzip, missing files and anything but GET fall
+*   through to the ROUTE_FILESYSTEM handler routed after it
+*/
+CgiStatus cgiEspFs(HttpdConnData* connData);
+
+espfsRouteStats_t espfsRoute_getStats(void);
+
+#ifdef __cplusplus
+}
+#endif
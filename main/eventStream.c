@@ -0,0 +1,191 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "libesphttpd/httpd.h"
+#include "telemetry.h"
+#include "eventStream.h"
+
+typedef struct {
+    HttpdConnData* conn;            // NULL when the slot is free
+    uint32_t nextSeq;
+    bool live;                      // Caught up, events are pushed by eventStream_task
+} subscriber_t;
+
+typedef struct {
+    uint32_t seq;
+    uint16_t len;
+    char text[EVENTSTREAM_EVENT_LEN];
+} replayEvent_t;
+
+static const char* tag = "Event stream";
+
+static HttpdInstance* instance = NULL;
+static subscriber_t subscribers[EVENTSTREAM_MAX_CLIENTS];
+static replayEvent_t* replay = NULL;
+static SemaphoreHandle_t replayMutex = NULL;
+static volatile uint32_t latestSeq = 0;
+
+esp_err_t eventStream_init(HttpdInstance* pInstance)
+{
+    instance = pInstance;
+    replayMutex = xSemaphoreCreateMutex();
+    replay = heap_caps_calloc(EVENTSTREAM_REPLAY_EVENTS, sizeof(replayEvent_t), MALLOC_CAP_SPIRAM);
+    if (replay == NULL) {
+        replay = calloc(EVENTSTREAM_REPLAY_EVENTS, sizeof(replayEvent_t));
+    }
+    if (replayMutex == NULL || replay == NULL) {
+        ESP_LOGE(tag, "Failed to allocate replay ring");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void eventStream_task(void* params)
+{
+    const telemetryFrame_t* frame;
+
+    if (replay == NULL) {
+        vTaskDelete(NULL);
+    }
+
+    telemetry_addListener(xTaskGetCurrentTaskHandle());
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        frame = telemetry_lockFrame();
+        if (frame == NULL) {
+            continue;
+        }
+
+        // Serialise the event once, every subscriber is sent the same bytes
+        replayEvent_t* event = &replay[frame->seq % EVENTSTREAM_REPLAY_EVENTS];
+        xSemaphoreTake(replayMutex, portMAX_DELAY);
+        event->seq = frame->seq;
+        event->len = snprintf(event->text, EVENTSTREAM_EVENT_LEN, "id: %u\ndata: %.*s\n\n",
+                              frame->seq, (int) frame->len, frame->json);
+        latestSeq = frame->seq;
+        xSemaphoreGive(replayMutex);
+        telemetry_unlockFrame();
+
+        for (int i = 0; i < EVENTSTREAM_MAX_CLIENTS; i++) {
+            subscriber_t* sub = &subscribers[i];
+            HttpdConnData* conn = sub->conn;
+            if (conn == NULL || !sub->live || !httpdConnSendStart(instance, conn)) {
+                continue;
+            }
+
+            // Slots are released by the CGI under the server lock, so check
+            // the slot again now that the lock is held
+            if (sub->conn == conn && sub->live && sub->nextSeq <= event->seq) {
+                httpdSend(conn, event->text, event->len);
+                sub->nextSeq = event->seq + 1;
+            }
+            httpdConnSendFinish(instance, conn);
+        }
+    }
+}
+
+static void sendReplayed(HttpdConnData* connData, subscriber_t* sub)
+{
+    // One missed event per call. The next call only comes once something
+    // has been sent, so sequences the ring never held (frames merged while
+    // eventStream_task was behind) are skipped in the same call
+    xSemaphoreTake(replayMutex, portMAX_DELAY);
+    uint32_t oldest = latestSeq >= EVENTSTREAM_REPLAY_EVENTS ? latestSeq - EVENTSTREAM_REPLAY_EVENTS + 1 : 1;
+    if (sub->nextSeq < oldest) {
+        sub->nextSeq = oldest;
+    }
+
+    while (sub->nextSeq <= latestSeq) {
+        replayEvent_t* event = &replay[sub->nextSeq % EVENTSTREAM_REPLAY_EVENTS];
+        bool held = (event->seq == sub->nextSeq);
+        sub->nextSeq++;
+        if (held) {
+            httpdSend(connData, event->text, event->len);
+            break;
+        }
+    }
+    if (sub->nextSeq > latestSeq) {
+        sub->live = true;
+    }
+    xSemaphoreGive(replayMutex);
+}
+
+CgiStatus cgiEventStream(HttpdConnData* connData)
+{
+    subscriber_t* sub = connData->cgiData;
+    char buff[16];
+
+    if (connData->isConnectionClosed) {
+        if (sub != NULL) {
+            sub->live = false;
+            sub->conn = NULL;
+            connData->cgiData = NULL;
+        }
+        return HTTPD_CGI_DONE;
+    }
+
+    if (sub == NULL) {
+        for (int i = 0; i < EVENTSTREAM_MAX_CLIENTS && sub == NULL; i++) {
+            if (subscribers[i].conn == NULL) {
+                sub = &subscribers[i];
+            }
+        }
+        if (sub == NULL || replay == NULL) {
+            httpdStartResponse(connData, 503);
+            httpdEndHeaders(connData);
+            return HTTPD_CGI_DONE;
+        }
+
+        // New clients start with the latest frame. An id from before a
+        // reboot is ahead of the current sequence and is treated the same
+        uint32_t latest = latestSeq;
+        sub->nextSeq = latest ? latest : 1;
+        if (httpdGetHeader(connData, "Last-Event-ID", buff, sizeof(buff))) {
+            uint32_t lastId = strtoul(buff, NULL, 10);
+            if (lastId <= latest) {
+                sub->nextSeq = lastId + 1;
+            }
+        }
+        sub->live = false;
+        sub->conn = connData;
+        connData->cgiData = sub;
+
+        httpdStartResponse(connData, 200);
+        httpdHeader(connData, "Content-Type", "text/event-stream");
+        httpdHeader(connData, "Cache-Control", "no-cache");
+        httpdEndHeaders(connData);
+        snprintf(buff, sizeof(buff), "retry: %d\n\n", EVENTSTREAM_RETRY_MS);
+        httpdSend(connData, buff, strlen(buff));
+        return HTTPD_CGI_MORE;
+    }
+
+    if (!sub->live) {
+        sendReplayed(connData, sub);
+    }
+    return HTTPD_CGI_MORE;
+}
+
+int eventStream_getClientCount(void)
+{
+    int n = 0;
+
+    for (int i = 0; i < EVENTSTREAM_MAX_CLIENTS; i++) {
+        if (subscribers[i].conn != NULL) {
+            n++;
+        }
+    }
+    return n;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "libesphttpd/httpd.h"
+#include "telemetry.h"
+
+#define EVENTSTREAM_MAX_CLIENTS 8
+#define EVENTSTREAM_REPLAY_EVENTS 32        // About 6 s of ticks for Last-Event-ID resume
+#define EVENTSTREAM_EVENT_LEN (TELEMETRY_JSON_LEN + 32)
+#define EVENTSTREAM_RETRY_MS 2000
+
+/*
+*   --------------------------------------------------------------------
+*   eventStream_init
+*   --------------------------------------------------------------------
+*   Allocates the replay ring. pInstance is the server the stream is
+*   routed on, needed to push events outside of a CGI call
+*/
+esp_err_t eventStream_init(HttpdInstance* pInstance);
+
+/*
+*   --------------------------------------------------------------------
+*   eventStream_task
+*   --------------------------------------------------------------------
+*   Woken for every telemetry frame. Wraps the frame as a server-sent
+*   event once, stores it in the replay ring and pushes the same bytes to
+*   every live subscriber
+*/
+void eventStream_task(void* params);
+
+/*
+*   --------------------------------------------------------------------
+*   cgiEventStream
+*   --------------------------------------------------------------------
+*   text/event-stream route. A client sending Last-Event-ID first gets
+*   the events it missed from the replay ring, then joins the live
+*   stream. A subscriber costs a slot of a few bytes rather than a task
+*/
+CgiStatus cgiEventStream(HttpdConnData* connData);
+
+int eventStream_getClientCount(void);
+
+#ifdef __cplusplus
+}
+#endif
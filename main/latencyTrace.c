@@ -0,0 +1,68 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+#include "latencyTrace.h"
+
+static const char* stageNames[lat_nStages] = {
+    [lat_conversion] = "conversion",
+    [lat_queueWait] = "queueWait",
+    [lat_dequeueToActuation] = "dequeueToActuation",
+    [lat_sampleAge] = "sampleAge"
+};
+
+// Only written by the control loop task
+static latencyHist_t histograms[lat_nStages];
+static latencyCounters_t counters;
+
+static void record(latencyStage_t stage, int64_t us)
+{
+    latencyHist_t* hist = &histograms[stage];
+    uint32_t value = us < 0 ? 0 : (us > UINT32_MAX ? UINT32_MAX : us);
+    int bucket = 31 - __builtin_clz(value | 1);
+
+    hist->count++;
+    hist->totalUs += value;
+    hist->buckets[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+    if (value > hist->maxUs) {
+        hist->maxUs = value;
+    }
+}
+
+void latency_recordActuation(const tempSample_t* sample, int64_t actuationUs)
+{
+    if (sample->traceId == 0) {
+        return;         // No reading has arrived yet
+    }
+
+    if (sample->traceId != counters.lastTraceId) {
+        if (counters.lastTraceId != 0 && sample->traceId > counters.lastTraceId + 1) {
+            counters.samplesMissed += sample->traceId - counters.lastTraceId - 1;
+        }
+        counters.lastTraceId = sample->traceId;
+
+        record(lat_conversion, sample->readDoneUs - sample->convStartUs);
+        record(lat_queueWait, sample->dequeueUs - sample->readDoneUs);
+        record(lat_dequeueToActuation, actuationUs - sample->dequeueUs);
+    } else {
+        counters.staleActuations++;
+    }
+
+    record(lat_sampleAge, actuationUs - sample->convStartUs);
+}
+
+const char* latency_getHistogram(latencyStage_t stage, latencyHist_t* hist)
+{
+    memcpy(hist, &histograms[stage], sizeof(latencyHist_t));
+    return stageNames[stage];
+}
+
+latencyCounters_t latency_getCounters(void)
+{
+    return counters;
+}
+
+#ifdef __cplusplus
+}
+#endif
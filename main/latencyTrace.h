@@ -0,0 +1,57 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "sensors.h"
+
+// Bucket i counts latencies of [2^i, 2^(i+1)) us, bucket 0 also holds 0 us
+#define LATENCY_BUCKETS 24
+
+typedef enum {
+    lat_conversion,                     // Conversion start to last sensor read
+    lat_queueWait,                      // Read done to dequeued by the control loop
+    lat_dequeueToActuation,             // Dequeue to pump duty updated
+    lat_sampleAge,                      // Conversion start to every actuation using the sample
+    lat_nStages
+} latencyStage_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t maxUs;
+    uint64_t totalUs;
+    uint32_t buckets[LATENCY_BUCKETS];
+} latencyHist_t;
+
+typedef struct {
+    uint32_t lastTraceId;
+    uint32_t samplesMissed;             // Trace ids never seen by the control loop
+    uint32_t staleActuations;           // Actuations that reused an older sample
+} latencyCounters_t;
+
+/*
+*   --------------------------------------------------------------------
+*   latency_recordActuation
+*   --------------------------------------------------------------------
+*   Called by the control loop once the pumps have been commanded from a
+*   sample. The sensor side stages are recorded once per trace id, the
+*   sample age is recorded for every actuation so a control loop running
+*   on stale readings shows up as dead time
+*/
+void latency_recordActuation(const tempSample_t* sample, int64_t actuationUs);
+
+/*
+*   --------------------------------------------------------------------
+*   latency_getHistogram
+*   --------------------------------------------------------------------
+*   Copies out the histogram of a stage. Returns the stage name
+*/
+const char* latency_getHistogram(latencyStage_t stage, latencyHist_t* hist);
+
+latencyCounters_t latency_getCounters(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -24,6 +24,19 @@ extern "C" {
 #include "webServer.h"
 #include "input.h"
 #include "menu.h"
+#include "runRecorder.h"
+#include "rtosTrace.h"
+#include "sysStats.h"
+#include "telemetry.h"
+#include "mqttTelemetry.h"
+#include "eventStream.h"
+
+static void watchQueue(xQueueHandle queue, const char* name)
+{
+    // Label the queue in scheduler traces and track its depth
+    rtosTrace_nameObject(queue, name);
+    sysStats_watchQueue(queue, name);
+}
 
 void app_main()
 {
@@ -39,6 +52,16 @@ void app_main()
     controller_init(CONTROL_LOOP_FREQUENCY);
     webServer_init();
     init_input();
+    runRecorder_init();
+    sysStats_init();
+    telemetry_init();
+
+    watchQueue(tempQueue, "tempQueue");
+    watchQueue(flowRateQueue, "flowRateQueue");
+    watchQueue(dataQueue, "dataQueue");
+    watchQueue(cmdQueue, "cmdQueue");
+    watchQueue(inputQueue, "inputQueue");
+    watchQueue(recorderQueue, "recorderQueue");
 
     // Schedule tasks
     xTaskCreatePinnedToCore(&temp_sensor_task, "Temperature Sensor", 2048, NULL, 7, NULL, 1);
@@ -46,6 +69,13 @@ void app_main()
     xTaskCreatePinnedToCore(&control_loop, "Controller", 8192, NULL, 6, NULL, 0);
     xTaskCreatePinnedToCore(&menu_task, "LCD task", 2048, NULL, 3, NULL, 0);
     xTaskCreatePinnedToCore(&inputButtonTask, "Input button task", 1024, NULL, 5, NULL, 1);
+    xTaskCreatePinnedToCore(&runRecorder_task, "Run recorder", 3072, NULL, 2, NULL, 1);
+    xTaskCreatePinnedToCore(&telemetry_task, "Telemetry", 3072, NULL, 4, NULL, 1);
+    xTaskCreatePinnedToCore(&mqttTelemetry_task, "MQTT publisher", 4096, NULL, 2, NULL, 1);
+    xTaskCreatePinnedToCore(&eventStream_task, "Event stream", 3072, NULL, 3, NULL, 0);
+#if SYS_STATS_CONSOLE
+    xTaskCreatePinnedToCore(&sysStats_consoleTask, "Stats console", 3072, NULL, 1, NULL, 1);
+#endif
 }
 
 #ifdef __cplusplus
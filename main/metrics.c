@@ -0,0 +1,170 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <math.h>
+#include <esp_timer.h>
+#include "controlLoop.h"
+#include "sensors.h"
+#include "sysStats.h"
+#include "metrics.h"
+
+typedef struct {
+    char* buf;
+    size_t len;
+    size_t used;
+} metricsWriter_t;
+
+static const struct {
+    tempSensor sensor;
+    const char* label;
+} tempLabels[] = {
+    {T_refluxHot, "vapour"},
+    {T_refluxCold, "reflux_inflow"},
+    {T_productHot, "product_inflow"},
+    {T_productCold, "radiator"},
+    {T_boiler, "boiler"}
+};
+
+static void append(metricsWriter_t* w, const char* fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    int n = vsnprintf(&w->buf[w->used], w->len - w->used, fmt, args);
+    va_end(args);
+
+    // Lines that do not fit are dropped whole so the output stays parseable
+    if (n > 0 && w->used + n < w->len) {
+        w->used += n;
+    } else {
+        w->buf[w->used] = '\0';
+    }
+}
+
+static void header(metricsWriter_t* w, const char* name, const char* type, const char* help)
+{
+    append(w, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s %s\n", name, help, name, type);
+}
+
+// Fixed point with six decimals, avoids the float formatter and its allocations
+static void sample(metricsWriter_t* w, const char* name, const char* labels, double value)
+{
+    int64_t micro = llround(value * 1e6);
+    uint64_t mag = micro < 0 ? -micro : micro;
+
+    append(w, METRICS_PREFIX "%s%s %s%u.%06u\n", name, labels, micro < 0 ? "-" : "",
+           (unsigned int) (mag / 1000000), (unsigned int) (mag % 1000000));
+}
+
+static void sampleInt(metricsWriter_t* w, const char* name, const char* labels, uint32_t value)
+{
+    append(w, METRICS_PREFIX "%s%s %u\n", name, labels, value);
+}
+
+static void renderTemperatures(metricsWriter_t* w)
+{
+    float temps[n_tempSensors];
+    char labels[32];
+
+    get_latest_temperatures(temps);
+    header(w, "temperature_celsius", "gauge", "Temperature used by the latest control loop iteration");
+    for (int i = 0; i < sizeof(tempLabels) / sizeof(tempLabels[0]); i++) {
+        snprintf(labels, sizeof(labels), "{sensor=\"%s\"}", tempLabels[i].label);
+        sample(w, "temperature_celsius", labels, getTemperature(temps, tempLabels[i].sensor));
+    }
+}
+
+static void renderController(metricsWriter_t* w)
+{
+    Data settings = get_controller_settings();
+
+    header(w, "setpoint_celsius", "gauge", "Vapour temperature setpoint");
+    sample(w, "setpoint_celsius", "", settings.setpoint);
+    header(w, "pid_gain", "gauge", "PID controller gains");
+    sample(w, "pid_gain", "{term=\"p\"}", settings.P_gain);
+    sample(w, "pid_gain", "{term=\"i\"}", settings.I_gain);
+    sample(w, "pid_gain", "{term=\"d\"}", settings.D_gain);
+    header(w, "pump_duty", "gauge", "Commanded pump PWM duty, 0 to 1024");
+    sampleInt(w, "pump_duty", "{pump=\"reflux\"}", get_refluxPumpSpeed());
+    sampleInt(w, "pump_duty", "{pump=\"product\"}", get_productPumpSpeed());
+    header(w, "element_on", "gauge", "Heating element switched on");
+    sampleInt(w, "element_on", "{element=\"1\"}", get_element1_status());
+    sampleInt(w, "element_on", "{element=\"2\"}", get_element2_status());
+    header(w, "fan_on", "gauge", "Radiator fan switched on");
+    sampleInt(w, "fan_on", "", get_fan_state());
+    header(w, "flush_on", "gauge", "Pumps running at flush speed");
+    sampleInt(w, "flush_on", "", getFlush());
+    header(w, "uptime_seconds", "counter", "Time since boot");
+    sampleInt(w, "uptime_seconds", "", esp_timer_get_time() / 1000000);
+}
+
+static void renderLoopTiming(metricsWriter_t* w)
+{
+    loopTiming_t timing = get_loop_timing();
+
+    header(w, "control_loop_iterations_total", "counter", "Control loop iterations since boot");
+    sampleInt(w, "control_loop_iterations_total", "", timing.iterations);
+    header(w, "control_loop_deadline_misses_total", "counter", "Iterations whose work overran the loop period");
+    sampleInt(w, "control_loop_deadline_misses_total", "", timing.deadlineMisses);
+    header(w, "control_loop_period_seconds", "gauge", "Last measured loop period");
+    sample(w, "control_loop_period_seconds", "", timing.lastPeriodUs / 1e6);
+    header(w, "control_loop_max_late_seconds", "gauge", "Worst wake up after the nominal period");
+    sample(w, "control_loop_max_late_seconds", "", timing.maxLateUs / 1e6);
+    header(w, "control_loop_max_work_seconds", "gauge", "Longest iteration");
+    sample(w, "control_loop_max_work_seconds", "", timing.maxWorkUs / 1e6);
+}
+
+static void renderMemory(metricsWriter_t* w)
+{
+    sysStatsHeap_t heaps[SYS_STATS_N_HEAPS];
+    char labels[SYS_STATS_N_HEAPS][24];
+
+    int n = sysStats_getHeaps(heaps, SYS_STATS_N_HEAPS);
+    for (int i = 0; i < n; i++) {
+        snprintf(labels[i], sizeof(labels[i]), "{heap=\"%s\"}", heaps[i].name);
+    }
+
+    header(w, "heap_free_bytes", "gauge", "Free heap per memory capability");
+    for (int i = 0; i < n; i++) {
+        sampleInt(w, "heap_free_bytes", labels[i], heaps[i].freeBytes);
+    }
+    header(w, "heap_min_free_bytes", "gauge", "Lowest free heap since boot");
+    for (int i = 0; i < n; i++) {
+        sampleInt(w, "heap_min_free_bytes", labels[i], heaps[i].minFreeBytes);
+    }
+    header(w, "heap_largest_block_bytes", "gauge", "Largest allocatable block");
+    for (int i = 0; i < n; i++) {
+        sampleInt(w, "heap_largest_block_bytes", labels[i], heaps[i].largestBlock);
+    }
+}
+
+size_t metrics_render(metricsSection_t section, char* buf, size_t len)
+{
+    metricsWriter_t w = {.buf = buf, .len = len, .used = 0};
+
+    switch (section) {
+        case metrics_temperatures:
+            renderTemperatures(&w);
+            break;
+        case metrics_controller:
+            renderController(&w);
+            break;
+        case metrics_loopTiming:
+            renderLoopTiming(&w);
+            break;
+        case metrics_memory:
+            renderMemory(&w);
+            break;
+        default:
+            break;
+    }
+    return w.used;
+}
+
+#ifdef __cplusplus
+}
+#endif
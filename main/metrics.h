@@ -0,0 +1,33 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#define METRICS_PREFIX "still_"
+#define METRICS_CHUNK_LEN 1024          // Largest section is about 900 bytes
+
+// Sections of the /metrics response, each rendered into one chunk
+typedef enum {
+    metrics_temperatures,
+    metrics_controller,
+    metrics_loopTiming,
+    metrics_memory,
+    metrics_nSections
+} metricsSection_t;
+
+/*
+*   --------------------------------------------------------------------
+*   metrics_render
+*   --------------------------------------------------------------------
+*   Writes one section of the Prometheus text exposition into buf and
+*   returns its length. Values are formatted with integer arithmetic so
+*   a scrape never touches the heap
+*/
+size_t metrics_render(metricsSection_t section, char* buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
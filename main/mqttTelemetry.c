@@ -0,0 +1,312 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "mqtt_client.h"
+#include "controlLoop.h"
+#include "messages.h"
+#include "networking.h"
+#include "telemetry.h"
+#include "mqttTelemetry.h"
+
+#define PAYLOAD_LEN 2048            // Worst case batch with every field at full width
+#define CMD_PAYLOAD_LEN 128
+#define CATCHUP_BATCHES 8           // Batches sent per period while draining a backlog
+
+static const char* tag = "MQTT";
+
+static esp_mqtt_client_handle_t client = NULL;
+static mqttStats_t stats;
+static volatile bool connected = false;
+static volatile int64_t reconnectAtUs = 0;
+static uint32_t backoffMs = MQTT_BACKOFF_MIN_MS;
+
+// Publish start times indexed by msg_id, for PUBACK latency
+static int inflightId[MQTT_INFLIGHT_MAX];
+static int64_t inflightStartUs[MQTT_INFLIGHT_MAX];
+
+static char payload[PAYLOAD_LEN];
+
+#if MQTT_CA_CERT_EMBEDDED
+extern const char mqttCaPem[] asm("_binary_mqtt_ca_pem_start");
+#endif
+
+static int publish(const char* topic, const char* data, int len, int retain)
+{
+    // Latency is measured from before the message is written to the socket
+    int64_t startUs = esp_timer_get_time();
+    int msgId = esp_mqtt_client_publish(client, topic, data, len, 1, retain);
+
+    if (msgId <= 0) {
+        stats.publishFailures++;
+        return msgId;
+    }
+
+    int slot = msgId % MQTT_INFLIGHT_MAX;
+    inflightId[slot] = msgId;
+    inflightStartUs[slot] = startUs;
+    stats.bytesPublished += len;
+    return msgId;
+}
+
+static void onPublished(int msgId)
+{
+    int slot = msgId % MQTT_INFLIGHT_MAX;
+
+    stats.published++;
+    if (inflightId[slot] == msgId) {
+        uint32_t latency = esp_timer_get_time() - inflightStartUs[slot];
+        stats.lastLatencyUs = latency;
+        stats.totalLatencyUs += latency;
+        if (latency > stats.maxLatencyUs) {
+            stats.maxLatencyUs = latency;
+        }
+        inflightId[slot] = 0;
+    }
+}
+
+#if MQTT_COMMANDS
+static void handleCommand(const char* data, int len)
+{
+    // Same "HEADER&message" format as the websocket, see myWebsocketRecv
+    char msg[CMD_PAYLOAD_LEN];
+
+    if (len >= CMD_PAYLOAD_LEN) {
+        ESP_LOGW(tag, "Command of %d bytes dropped", len);
+        return;
+    }
+    memcpy(msg, data, len);
+    msg[len] = '\0';
+    stats.commandsReceived++;
+
+    char* header = strtok(msg, "&");
+    char* message = strtok(NULL, "&");
+    if (header == NULL || message == NULL) {
+        return;
+    }
+
+    if (strncmp(header, "INFO", 4) == 0) {
+        Data* settings = decode_data(message);
+        write_nvs(settings);
+        xQueueSend(dataQueue, settings, 50 / portTICK_PERIOD_MS);
+        free(settings);
+    } else if (strncmp(header, "CMD", 3) == 0) {
+        Cmd_t cmd = decodeCommand(message);
+        if (strncmp(cmd.cmd, "OTA", CMD_LEN) == 0) {
+            ESP_LOGW(tag, "OTA is only accepted from the dashboard");
+        } else {
+            xQueueSend(cmdQueue, &cmd, 50 / portTICK_PERIOD_MS);
+        }
+    }
+}
+#endif
+
+static void mqttEventHandler(void* args, esp_event_base_t base, int32_t eventId, void* eventData)
+{
+    esp_mqtt_event_handle_t event = eventData;
+
+    switch (eventId) {
+        case MQTT_EVENT_CONNECTED:
+            ESP_LOGI(tag, "Connected to %s", MQTT_BROKER_URI);
+            connected = true;
+            backoffMs = MQTT_BACKOFF_MIN_MS;
+            stats.connects++;
+#if MQTT_COMMANDS
+            esp_mqtt_client_subscribe(client, MQTT_TOPIC_CMD, 1);
+#endif
+            esp_mqtt_client_publish(client, MQTT_TOPIC_STATUS, "online", 0, 1, 1);
+            break;
+        case MQTT_EVENT_DISCONNECTED:
+            if (connected) {
+                stats.disconnects++;
+            }
+            connected = false;
+            memset(inflightId, 0, sizeof(inflightId));
+            reconnectAtUs = esp_timer_get_time() + (int64_t) backoffMs * 1000;
+            ESP_LOGW(tag, "Disconnected, retrying in %u ms", backoffMs);
+            backoffMs = backoffMs * 2 > MQTT_BACKOFF_MAX_MS ? MQTT_BACKOFF_MAX_MS : backoffMs * 2;
+            break;
+        case MQTT_EVENT_PUBLISHED:
+            onPublished(event->msg_id);
+            break;
+#if MQTT_COMMANDS
+        case MQTT_EVENT_DATA:
+            if (event->topic_len == strlen(MQTT_TOPIC_CMD) &&
+                strncmp(event->topic, MQTT_TOPIC_CMD, event->topic_len) == 0) {
+                handleCommand(event->data, event->data_len);
+            }
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
+/*
+*   Batches are {"seq":first,"t0":ms,"rows":[[dt,T0..T4,reflux,product],..]}
+*   with dt in ms since the previous row, temperatures in 1/100 degC in
+*   tempSensor order and pump duties out of 1024
+*/
+static int encodeBatch(const telemetrySample_t* samples, int n)
+{
+    int len = snprintf(payload, PAYLOAD_LEN, "{\"seq\":%u,\"t0\":%u,\"rows\":[", samples[0].seq, samples[0].timeMs);
+
+    for (int i = 0; i < n && len < PAYLOAD_LEN; i++) {
+        const telemetrySample_t* s = &samples[i];
+        len += snprintf(&payload[len], PAYLOAD_LEN - len, "%s[%u,%d,%d,%d,%d,%d,%u,%u]", i ? "," : "",
+                        i ? s->timeMs - samples[i - 1].timeMs : 0,
+                        s->temps[0], s->temps[1], s->temps[2], s->temps[3], s->temps[4],
+                        s->refluxPump, s->productPump);
+    }
+    if (len < PAYLOAD_LEN) {
+        len += snprintf(&payload[len], PAYLOAD_LEN - len, "]}");
+    }
+    return len < PAYLOAD_LEN ? len : -1;
+}
+
+static void publishEvents(const telemetrySample_t* samples, int n, telemetrySample_t* prev, bool* havePrev)
+{
+    static const struct {
+        uint8_t flag;
+        const char* name;
+    } flagNames[] = {
+        {TELEMETRY_ELEMENT1, "element1"},
+        {TELEMETRY_ELEMENT2, "element2"},
+        {TELEMETRY_FAN, "fan"},
+        {TELEMETRY_FLUSH, "flush"}
+    };
+
+    for (int i = 0; i < n; i++) {
+        const telemetrySample_t* s = &samples[i];
+        if (*havePrev && s->flags == prev->flags && s->setpoint == prev->setpoint) {
+            *prev = *s;
+            continue;
+        }
+
+        // The first sample after boot reports the whole state
+        int len = snprintf(payload, PAYLOAD_LEN, "{\"seq\":%u,\"t\":%u", s->seq, s->timeMs);
+        for (int f = 0; f < sizeof(flagNames) / sizeof(flagNames[0]); f++) {
+            if (!*havePrev || ((s->flags ^ prev->flags) & flagNames[f].flag)) {
+                len += snprintf(&payload[len], PAYLOAD_LEN - len, ",\"%s\":%s", flagNames[f].name,
+                                (s->flags & flagNames[f].flag) ? "true" : "false");
+            }
+        }
+        if (!*havePrev || s->setpoint != prev->setpoint) {
+            len += snprintf(&payload[len], PAYLOAD_LEN - len, ",\"setpoint\":%d.%02d", s->setpoint / 100, abs(s->setpoint % 100));
+        }
+        len += snprintf(&payload[len], PAYLOAD_LEN - len, "}");
+        publish(MQTT_TOPIC_EVENT, payload, len, 0);
+
+        *prev = *s;
+        *havePrev = true;
+    }
+}
+
+static void publishStats(uint32_t periodMs, uint32_t publishedBefore, uint32_t bytesBefore)
+{
+    int len = snprintf(payload, PAYLOAD_LEN,
+        "{\"connects\":%u,\"disconnects\":%u,\"published\":%u,\"failures\":%u,\"samples\":%u,\"dropped\":%u,"
+        "\"backlog\":%u,\"commands\":%u,\"latencyLastUs\":%u,\"latencyMaxUs\":%u,\"latencyMeanUs\":%u,"
+        "\"msgPerMin\":%u,\"bytesPerMin\":%u}",
+        stats.connects, stats.disconnects, stats.published, stats.publishFailures, stats.samplesPublished,
+        stats.samplesDropped, stats.backlog, stats.commandsReceived, stats.lastLatencyUs, stats.maxLatencyUs,
+        stats.published ? (uint32_t) (stats.totalLatencyUs / stats.published) : 0,
+        (stats.published - publishedBefore) * 60000 / periodMs,
+        (uint32_t) ((stats.bytesPublished - bytesBefore) * 60000ull / periodMs));
+    publish(MQTT_TOPIC_STATS, payload, len, 0);
+}
+
+void mqttTelemetry_task(void* params)
+{
+    static telemetrySample_t batch[MQTT_BATCH_MAX_SAMPLES];
+    telemetrySample_t prev;
+    bool havePrev = false;
+    uint32_t nextSeq = 1;
+    int64_t lastStatsUs = esp_timer_get_time();
+    uint32_t publishedBefore = 0, bytesBefore = 0;
+
+    esp_mqtt_client_config_t config = {
+        .uri = MQTT_BROKER_URI,
+        .username = MQTT_USERNAME,
+        .password = MQTT_PASSWORD,
+#if MQTT_CA_CERT_EMBEDDED
+        .cert_pem = mqttCaPem,
+#endif
+        .lwt_topic = MQTT_TOPIC_STATUS,
+        .lwt_msg = "offline",
+        .lwt_qos = 1,
+        .lwt_retain = 1,
+        .keepalive = 30,
+        .buffer_size = PAYLOAD_LEN + 64,
+        .disable_auto_reconnect = true
+    };
+#if !MQTT_AUTHENTICATED
+    ESP_LOGW(tag, "No broker credentials, build with -DMQTT_USERNAME and -DMQTT_PASSWORD");
+#endif
+    client = esp_mqtt_client_init(&config);
+    if (client == NULL) {
+        ESP_LOGE(tag, "Failed to create MQTT client");
+        vTaskDelete(NULL);
+    }
+    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqttEventHandler, NULL);
+    esp_mqtt_client_start(client);
+
+    portTickType xLastWakeTime = xTaskGetTickCount();
+    while (true) {
+        vTaskDelayUntil(&xLastWakeTime, MQTT_BATCH_PERIOD_MS / portTICK_PERIOD_MS);
+        stats.backlog = telemetry_getSeq() + 1 - nextSeq;
+
+        if (!connected) {
+            if (reconnectAtUs != 0 && esp_timer_get_time() >= reconnectAtUs) {
+                reconnectAtUs = 0;
+                esp_mqtt_client_reconnect(client);
+            }
+            continue;
+        }
+
+        // Samples published while offline are still in the telemetry ring,
+        // a backlog drains a few batches per period
+        for (int b = 0; b < CATCHUP_BATCHES && connected; b++) {
+            int n = telemetry_readSamples(nextSeq, batch, MQTT_BATCH_MAX_SAMPLES);
+            if (n == 0) {
+                break;
+            }
+
+            int len = encodeBatch(batch, n);
+            if (len < 0 || publish(MQTT_TOPIC_TELEMETRY, payload, len, 0) <= 0) {
+                break;      // Retried from the same sample next period
+            }
+            stats.samplesDropped += batch[0].seq - nextSeq;
+            stats.samplesPublished += n;
+            publishEvents(batch, n, &prev, &havePrev);
+            nextSeq = batch[n - 1].seq + 1;
+        }
+
+        int64_t now = esp_timer_get_time();
+        if (now - lastStatsUs >= MQTT_STATS_PERIOD_MS * 1000ll) {
+            publishStats((now - lastStatsUs) / 1000, publishedBefore, bytesBefore);
+            lastStatsUs = now;
+            publishedBefore = stats.published;
+            bytesBefore = stats.bytesPublished;
+        }
+    }
+}
+
+mqttStats_t mqttTelemetry_getStats(void)
+{
+    mqttStats_t copy = stats;
+    copy.connected = connected;
+    return copy;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,86 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Broker and topics. Override the broker at configure time with
+// -DMQTT_BROKER_URI=mqtt://host, tools/mqttHarness.sh prints the line to use
+#ifndef MQTT_BROKER_URI
+#define MQTT_BROKER_URI "mqtt://192.168.1.2"
+#endif
+
+// Broker credentials, -DMQTT_USERNAME=name -DMQTT_PASSWORD=secret. The
+// broker is shared by the plant, so set these and deny anonymous clients.
+// An mqtts:// broker is verified against -DMQTT_CA_CERT=ca.pem when given
+#ifdef MQTT_USERNAME
+#define MQTT_AUTHENTICATED 1
+#else
+#define MQTT_AUTHENTICATED 0
+#define MQTT_USERNAME NULL
+#define MQTT_PASSWORD NULL
+#endif
+#ifndef MQTT_CA_CERT_EMBEDDED
+#define MQTT_CA_CERT_EMBEDDED 0
+#endif
+
+// Commands on MQTT_TOPIC_CMD write settings and drive the elements and
+// pumps, so they are only subscribed to when built with -DMQTT_COMMANDS=1.
+// Restrict the topic to the controller's user in the broker's ACL
+#ifndef MQTT_COMMANDS
+#define MQTT_COMMANDS 0
+#endif
+#define MQTT_TOPIC_ROOT "still/"
+#define MQTT_TOPIC_TELEMETRY MQTT_TOPIC_ROOT "telemetry"
+#define MQTT_TOPIC_EVENT MQTT_TOPIC_ROOT "event"
+#define MQTT_TOPIC_STATUS MQTT_TOPIC_ROOT "status"
+#define MQTT_TOPIC_STATS MQTT_TOPIC_ROOT "stats"
+#define MQTT_TOPIC_CMD MQTT_TOPIC_ROOT "cmd"
+
+#define MQTT_BATCH_PERIOD_MS 1000
+#define MQTT_BATCH_MAX_SAMPLES 25           // Per message, about 1 KB of payload
+#define MQTT_STATS_PERIOD_MS 30000
+#define MQTT_BACKOFF_MIN_MS 1000
+#define MQTT_BACKOFF_MAX_MS 60000
+#define MQTT_INFLIGHT_MAX 8                 // Publishes tracked for ack latency
+
+typedef struct {
+    bool connected;
+    uint32_t connects;
+    uint32_t disconnects;
+    uint32_t published;                     // Messages acknowledged by the broker
+    uint32_t publishFailures;
+    uint32_t bytesPublished;
+    uint32_t samplesPublished;
+    uint32_t samplesDropped;                // Overwritten in the telemetry ring while offline
+    uint32_t commandsReceived;
+    uint32_t lastLatencyUs;                 // Publish to PUBACK
+    uint32_t maxLatencyUs;
+    uint64_t totalLatencyUs;
+    uint32_t backlog;                       // Samples waiting to be published
+} mqttStats_t;
+
+/*
+*   --------------------------------------------------------------------
+*   mqttTelemetry_task
+*   --------------------------------------------------------------------
+*   Publishes the telemetry sample ring in batches every
+*   MQTT_BATCH_PERIOD_MS, plus an event whenever an element, the fan,
+*   flush or the setpoint changes. With MQTT_COMMANDS, commands received
+*   on MQTT_TOPIC_CMD use the websocket message format and are fed to
+*   dataQueue/cmdQueue.
+*   While the broker is unreachable samples stay in the telemetry ring,
+*   which bounds the offline buffer, and reconnects back off
+*   exponentially up to MQTT_BACKOFF_MAX_MS
+*/
+void mqttTelemetry_task(void* params);
+
+mqttStats_t mqttTelemetry_getStats(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -41,17 +41,94 @@
 static char tag[] = "socket server";
 bool wifiConnected = false;
 
+static wifiLinkStats_t linkStats = {.rssiMin = INT8_MAX, .rssiMax = INT8_MIN};
+static int64_t droppedAtUs = 0;            // Non zero while reconnecting
+static esp_timer_handle_t rssiTimer = NULL;
+
+static wifi_config_t staConfig = {
+    .sta = {
+        // .ssid="vodafoneB1100A_2GEXT",
+        .ssid="vodafoneB1100A",
+        .password="@leadership room 11",
+        .bssid_set=false
+    }
+};
+static bool apCached = false;
+static uint8_t cachedBssid[6];
+static uint8_t cachedChannel = 0;
+static bool fastAttempt = false;            // Current attempt targets the cached AP
+static int failedAttempts = 0;              // Since the link was last up
+
+static void loadApCache(void)
+{
+    nvs_handle nvs;
+    size_t len = sizeof(cachedBssid);
+
+    if (nvs_open("wifi", NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    apCached = nvs_get_blob(nvs, "bssid", cachedBssid, &len) == ESP_OK && len == sizeof(cachedBssid) &&
+               nvs_get_u8(nvs, "channel", &cachedChannel) == ESP_OK;
+    nvs_close(nvs);
+}
+
+static void saveApCache(const uint8_t* bssid, uint8_t channel)
+{
+    nvs_handle nvs;
+
+    if (apCached && channel == cachedChannel && memcmp(bssid, cachedBssid, sizeof(cachedBssid)) == 0) {
+        return;
+    }
+    memcpy(cachedBssid, bssid, sizeof(cachedBssid));
+    cachedChannel = channel;
+    apCached = true;
+
+    if (nvs_open("wifi", NVS_READWRITE, &nvs) != ESP_OK) {
+        ESP_LOGW(tag, "Could not cache AP");
+        return;
+    }
+    nvs_set_blob(nvs, "bssid", cachedBssid, sizeof(cachedBssid));
+    nvs_set_u8(nvs, "channel", cachedChannel);
+    nvs_commit(nvs);
+    nvs_close(nvs);
+    ESP_LOGI(tag, "Cached AP " MACSTR " on channel %u", MAC2STR(cachedBssid), cachedChannel);
+}
+
+static void selectAp(void)
+{
+    // With the BSSID and channel set the driver probes that one channel
+    // instead of scanning all of them
+    fastAttempt = apCached && failedAttempts < WIFI_FAST_RECONNECT_ATTEMPTS;
+    staConfig.sta.bssid_set = fastAttempt;
+    staConfig.sta.channel = fastAttempt ? cachedChannel : 0;
+    if (fastAttempt) {
+        memcpy(staConfig.sta.bssid, cachedBssid, sizeof(cachedBssid));
+    }
+    esp_wifi_set_config(WIFI_IF_STA, &staConfig);
+}
+
+static void sampleRssi(void* arg)
+{
+    wifi_ap_record_t ap;
+
+    if (!wifiConnected || esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return;
+    }
+    linkStats.rssi = ap.rssi;
+    linkStats.channel = ap.primary;
+    linkStats.rssiSamples++;
+    if (ap.rssi < linkStats.rssiMin) {
+        linkStats.rssiMin = ap.rssi;
+    }
+    if (ap.rssi > linkStats.rssiMax) {
+        linkStats.rssiMax = ap.rssi;
+    }
+}
+
 void wifi_connect(void)
 {
     tcpip_adapter_ip_info_t ipInfo;
-    wifi_config_t staConfig = {
-        .sta = {
-            // .ssid="vodafoneB1100A_2GEXT",
-            .ssid="vodafoneB1100A",
-            .password="@leadership room 11",
-            .bssid_set=false
-        }
-    };
+
     tcpip_adapter_init();
 
     //For using of static IP
@@ -69,9 +146,18 @@ void wifi_connect(void)
     wifi_init_config_t config = WIFI_INIT_CONFIG_DEFAULT();
     esp_wifi_init(&config);
     esp_wifi_set_mode(WIFI_MODE_STA);
-    esp_wifi_set_config(WIFI_IF_STA, &staConfig);
+    loadApCache();
+    selectAp();
     ESP_ERROR_CHECK(esp_wifi_start());
     ESP_ERROR_CHECK(esp_wifi_connect());
+
+    esp_timer_create_args_t timerArgs = {
+        .callback = &sampleRssi,
+        .name = "wifiRssi"
+    };
+    if (esp_timer_create(&timerArgs, &rssiTimer) == ESP_OK) {
+        esp_timer_start_periodic(rssiTimer, WIFI_RSSI_PERIOD_MS * 1000);
+    }
 }
 
 void uart_initialize(void)
@@ -94,16 +180,50 @@ esp_err_t WiFi_event_handler(void *ctx, system_event_t *event)
     if (event->event_id == SYSTEM_EVENT_STA_GOT_IP) {
         ESP_LOGI(tag, "Our IP address is " IPSTR, IP2STR(&event->event_info.got_ip.ip_info.ip));
         ESP_LOGI(tag, "We have now connected to a station and can serve the dashboard");
+        if (droppedAtUs != 0) {
+            uint32_t reconnectMs = (esp_timer_get_time() - droppedAtUs) / 1000;
+            linkStats.reconnects++;
+            linkStats.lastReconnectMs = reconnectMs;
+            linkStats.totalReconnectMs += reconnectMs;
+            if (reconnectMs > linkStats.maxReconnectMs) {
+                linkStats.maxReconnectMs = reconnectMs;
+            }
+            linkStats.lastReconnectFast = fastAttempt;
+            if (fastAttempt) {
+                linkStats.fastReconnects++;
+            }
+            droppedAtUs = 0;
+            ESP_LOGI(tag, "Link restored after %u ms%s", reconnectMs, fastAttempt ? " on the cached AP" : "");
+        }
     } else if (event->event_id == SYSTEM_EVENT_STA_CONNECTED) {
         // Blink LED 
         flash_pin(LED_PIN, 100);
         ESP_LOGI(tag, "Connected to WiFi!");
         wifiConnected = true;
+        failedAttempts = 0;
+        saveApCache(event->event_info.connected.bssid, event->event_info.connected.channel);
     } else if (event->event_id ==SYSTEM_EVENT_STA_DISCONNECTED) {
         // This is a workaround as ESP32 WiFi libs don't currently auto-reassociate.
         flash_pin(LED_PIN, 100);
         ESP_LOGI(tag, "disconnect reason: %d", event->event_info.disconnected.reason);
+        // Retries raise this event again, only the first one starts the clock
+        if (wifiConnected || droppedAtUs == 0) {
+            linkStats.disconnects++;
+            linkStats.lastReason = event->event_info.disconnected.reason;
+            if (droppedAtUs == 0) {
+                droppedAtUs = esp_timer_get_time();
+            }
+        }
+        // A drop from a working link retries the cached AP first, a failed
+        // attempt counts towards falling back to a full scan
+        if (!wifiConnected) {
+            failedAttempts++;
+            if (fastAttempt) {
+                linkStats.fastFailures++;
+            }
+        }
         wifiConnected = false;
+        selectAp();
         esp_err_t eet = esp_wifi_connect();
         ESP_LOGI(tag, "reconnected Ok or error: %d, authmode: %d", eet, event->event_info.connected.authmode);
     }
@@ -111,6 +231,13 @@ esp_err_t WiFi_event_handler(void *ctx, system_event_t *event)
     return ESP_OK;
 }
 
+wifiLinkStats_t get_wifi_link_stats(void)
+{
+    wifiLinkStats_t stats = linkStats;
+    stats.connected = wifiConnected;
+    return stats;
+}
+
 void write_nvs(Data* data)
 {
     nvs_handle nvs;
@@ -6,6 +6,26 @@
 
 #define MAX_MESSAGE_LEN 100
 #define get_time_ms() (esp_timer_get_time() / 1000000.0)
+#define WIFI_RSSI_PERIOD_MS 1000
+#define WIFI_FAST_RECONNECT_ATTEMPTS 2      // Tries on the cached AP before a full scan
+
+typedef struct {
+    bool connected;
+    int8_t rssi;                            // dBm, latest sample
+    int8_t rssiMin;                         // Since boot
+    int8_t rssiMax;
+    uint8_t channel;
+    uint32_t rssiSamples;
+    uint32_t disconnects;
+    uint32_t reconnects;                    // Connections regained after a drop
+    uint32_t fastReconnects;                // Regained on the cached BSSID and channel
+    uint32_t fastFailures;                  // Attempts on the cached AP that failed
+    bool lastReconnectFast;
+    uint32_t lastReason;                    // wifi_err_reason_t of the last drop
+    uint32_t lastReconnectMs;               // Drop to IP address
+    uint32_t maxReconnectMs;
+    uint64_t totalReconnectMs;
+} wifiLinkStats_t;
 
 extern bool wifiConnected;
 
@@ -16,6 +36,10 @@ extern bool wifiConnected;
 *   Initializes the WiFi driver and connects to the local network. Since
 *   new web interface WiFi is no longer needed on the ESP32. This will
 *   eventually be deprecated.
+*
+*   The BSSID and channel of the last AP joined are cached in NVS. Connects
+*   and reconnects go straight to that AP without scanning, and fall back
+*   to a full scan after WIFI_FAST_RECONNECT_ATTEMPTS failed attempts
 */
 void wifi_connect(void);
 
@@ -30,6 +54,16 @@ void wifi_connect(void);
 */
 esp_err_t WiFi_event_handler(void *ctx, system_event_t *event);
 
+/*
+*   --------------------------------------------------------------------  
+*   get_wifi_link_stats
+*   --------------------------------------------------------------------
+*   RSSI sampled every WIFI_RSSI_PERIOD_MS while associated, plus drop
+*   and reconnect counters from the event handler. A reconnect is timed
+*   from the disconnect event until an IP address is held again
+*/
+wifiLinkStats_t get_wifi_link_stats(void);
+
 /*
 *   --------------------------------------------------------------------  
 *   uart_initialize
@@ -0,0 +1,49 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+#include "profiler.h"
+
+static const char* zoneNames[prof_nZones] = {
+    [prof_controlTick] = "controlTick",
+    [prof_pumpUpdate] = "updatePumpSpeed",
+    [prof_readTemps] = "readTemps",
+    [prof_wsSerialise] = "wsSerialise",
+    [prof_lcdRedraw] = "lcdRedraw"
+};
+
+static profHistogram_t histograms[prof_nZones];
+
+void profiler_record(profZone_t zone, uint32_t cycles)
+{
+    profHistogram_t* hist = &histograms[zone];
+    int bucket = 31 - __builtin_clz(cycles | 1);
+
+    hist->count++;
+    hist->totalCycles += cycles;
+    hist->buckets[bucket]++;
+    if (cycles > hist->maxCycles) {
+        hist->maxCycles = cycles;
+    }
+}
+
+void profiler_endScope(profScope_t* scope)
+{
+    profiler_record(scope->zone, esp_cpu_get_ccount() - scope->start);
+}
+
+const char* profiler_getHistogram(profZone_t zone, profHistogram_t* hist)
+{
+    memcpy(hist, &histograms[zone], sizeof(profHistogram_t));
+    return zoneNames[zone];
+}
+
+void profiler_reset(void)
+{
+    memset(histograms, 0, sizeof(histograms));
+}
+
+#ifdef __cplusplus
+}
+#endif
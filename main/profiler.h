@@ -0,0 +1,97 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "soc/cpu.h"
+
+// Set to 0 to compile every zone out of the build
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+// Bucket i counts zones that took [2^i, 2^(i+1)) CPU cycles
+#define PROFILER_N_BUCKETS 32
+
+typedef enum {
+    prof_controlTick,
+    prof_pumpUpdate,
+    prof_readTemps,
+    prof_wsSerialise,
+    prof_lcdRedraw,
+    prof_nZones
+} profZone_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t maxCycles;
+    uint64_t totalCycles;
+    uint32_t buckets[PROFILER_N_BUCKETS];
+} profHistogram_t;
+
+typedef struct {
+    profZone_t zone;
+    uint32_t start;
+} profScope_t;
+
+/*
+*   --------------------------------------------------------------------
+*   PROFILE_ZONE
+*   --------------------------------------------------------------------
+*   Times the rest of the enclosing block and adds the elapsed CPU cycles
+*   to the zone's histogram when the block exits. Cycle counts are per
+*   core, so zones must only be used in tasks pinned to a core. The
+*   histograms are not locked, a zone entered from two tasks at once may
+*   occasionally lose a count
+*/
+#if PROFILER_ENABLED
+#define PROFILER_CONCAT_(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_(a, b)
+#define PROFILE_ZONE(z) \
+    profScope_t PROFILER_CONCAT(profScope_, __LINE__) __attribute__((cleanup(profiler_endScope))) = \
+        {.zone = (z), .start = esp_cpu_get_ccount()}
+#else
+#define PROFILE_ZONE(z) do {} while (0)
+#endif
+
+/*
+*   --------------------------------------------------------------------
+*   PROFILE_BEGIN / PROFILE_END
+*   --------------------------------------------------------------------
+*   Unscoped form of PROFILE_ZONE for spans that cannot be wrapped in a
+*   block of their own. Both must appear in the same scope
+*/
+#if PROFILER_ENABLED
+#define PROFILE_BEGIN(z) uint32_t PROFILER_CONCAT(profStart_, z) = esp_cpu_get_ccount()
+#define PROFILE_END(z) profiler_record((z), esp_cpu_get_ccount() - PROFILER_CONCAT(profStart_, z))
+#else
+#define PROFILE_BEGIN(z) do {} while (0)
+#define PROFILE_END(z) do {} while (0)
+#endif
+
+/*
+*   --------------------------------------------------------------------
+*   profiler_record
+*   --------------------------------------------------------------------
+*   Adds a cycle count to a zone's histogram. Allocation free, a handful
+*   of instructions
+*/
+void profiler_record(profZone_t zone, uint32_t cycles);
+
+void profiler_endScope(profScope_t* scope);
+
+/*
+*   --------------------------------------------------------------------
+*   profiler_getHistogram
+*   --------------------------------------------------------------------
+*   Copies out a zone's histogram. Returns the zone name
+*/
+const char* profiler_getHistogram(profZone_t zone, profHistogram_t* hist);
+
+void profiler_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,278 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "rtosTrace.h"
+
+#if RTOS_TRACE_ENABLED
+
+// Worst case size of one JSON event
+#define JSON_EVENT_MAX 160
+
+enum {
+    stage_header,
+    stage_names,
+    stage_events,
+    stage_footer,
+    stage_done
+};
+
+static DRAM_ATTR rtosTraceEvent_t events[RTOS_TRACE_EVENTS];
+static DRAM_ATTR rtosTraceName_t names[RTOS_TRACE_MAX_NAMES];
+static volatile uint32_t eventHead = 0;         // Total events ever written
+static volatile uint32_t nameCount = 0;
+static volatile bool frozen = false;
+
+static inline void IRAM_ATTR record(uint8_t type, uint32_t obj)
+{
+    if (frozen) {
+        return;
+    }
+
+    // Both cores record, so claim the slot atomically
+    uint32_t i = __atomic_fetch_add(&eventHead, 1, __ATOMIC_RELAXED);
+    rtosTraceEvent_t* ev = &events[i % RTOS_TRACE_EVENTS];
+    ev->timeUs = esp_timer_get_time();
+    ev->type = type;
+    ev->core = xPortGetCoreID();
+    ev->obj = obj;
+}
+
+static void IRAM_ATTR addName(const void* obj, const char* name)
+{
+    uint32_t i = __atomic_fetch_add(&nameCount, 1, __ATOMIC_RELAXED);
+    if (i >= RTOS_TRACE_MAX_NAMES) {
+        return;
+    }
+
+    names[i].obj = (uint32_t) obj;
+    for (int c = 0; c < RTOS_TRACE_NAME_LEN; c++) {
+        names[i].name[c] = name[c];
+        if (name[c] == '\0') {
+            break;
+        }
+    }
+    names[i].name[RTOS_TRACE_NAME_LEN - 1] = '\0';
+}
+
+void IRAM_ATTR rtosTrace_taskSwitchedIn(const void* task)
+{
+    record(RTOS_TRACE_SWITCH_IN, (uint32_t) task);
+}
+
+void IRAM_ATTR rtosTrace_taskCreated(const void* task, const char* name)
+{
+    addName(task, name);
+    record(RTOS_TRACE_TASK_CREATE, (uint32_t) task);
+}
+
+void IRAM_ATTR rtosTrace_taskDeleted(const void* task)
+{
+    record(RTOS_TRACE_TASK_DELETE, (uint32_t) task);
+}
+
+void IRAM_ATTR rtosTrace_queueEvent(uint8_t type, const void* queue)
+{
+    record(type, (uint32_t) queue);
+}
+
+void IRAM_ATTR rtosTrace_isrEnter(uint32_t n)
+{
+    record(RTOS_TRACE_ISR_ENTER, n);
+}
+
+void IRAM_ATTR rtosTrace_isrExit(void)
+{
+    record(RTOS_TRACE_ISR_EXIT, 0);
+}
+
+void rtosTrace_nameObject(const void* obj, const char* name)
+{
+    addName(obj, name);
+}
+
+// Latest name registered for a handle. Handles of deleted tasks can be reused
+static const char* lookupName(uint32_t obj, char* fallback, size_t len)
+{
+    uint32_t n = nameCount < RTOS_TRACE_MAX_NAMES ? nameCount : RTOS_TRACE_MAX_NAMES;
+    for (int i = n - 1; i >= 0; i--) {
+        if (names[i].obj == obj) {
+            return names[i].name;
+        }
+    }
+    snprintf(fallback, len, "0x%08x", (unsigned int) obj);
+    return fallback;
+}
+
+bool rtosTrace_exportBegin(rtosTraceExport_t* ex, bool raw)
+{
+    frozen = true;
+
+    memset(ex, 0, sizeof(rtosTraceExport_t));
+    ex->raw = raw;
+    ex->stage = stage_header;
+    ex->first = true;
+    ex->end = eventHead;
+    ex->next = ex->end > RTOS_TRACE_EVENTS ? ex->end - RTOS_TRACE_EVENTS : 0;
+    ex->startUs = (ex->next != ex->end) ? events[ex->next % RTOS_TRACE_EVENTS].timeUs : 0;
+    return true;
+}
+
+void rtosTrace_exportAbort(rtosTraceExport_t* ex)
+{
+    ex->stage = stage_done;
+    frozen = false;
+}
+
+static size_t rawChunk(rtosTraceExport_t* ex, char* buf, size_t len)
+{
+    size_t used = 0;
+    uint32_t n_names = nameCount < RTOS_TRACE_MAX_NAMES ? nameCount : RTOS_TRACE_MAX_NAMES;
+
+    if (ex->stage == stage_header) {
+        rtosTraceDumpHeader_t header = {
+            .magic = RTOS_TRACE_MAGIC,
+            .version = RTOS_TRACE_VERSION,
+            .n_names = n_names,
+            .n_events = ex->end - ex->next
+        };
+        memcpy(buf, &header, sizeof(header));
+        used = sizeof(header);
+        ex->stage = stage_names;
+    }
+
+    if (ex->stage == stage_names) {
+        memcpy(&buf[used], names, n_names * sizeof(rtosTraceName_t));
+        used += n_names * sizeof(rtosTraceName_t);
+        ex->stage = stage_events;
+        return used;
+    }
+
+    while (ex->stage == stage_events && used + sizeof(rtosTraceEvent_t) <= len) {
+        if (ex->next == ex->end) {
+            ex->stage = stage_done;
+            break;
+        }
+        memcpy(&buf[used], &events[ex->next++ % RTOS_TRACE_EVENTS], sizeof(rtosTraceEvent_t));
+        used += sizeof(rtosTraceEvent_t);
+    }
+    return used;
+}
+
+static int jsonEvent(rtosTraceExport_t* ex, const rtosTraceEvent_t* ev, char* buf, size_t len)
+{
+    char fallback[12];
+    uint32_t ts = ev->timeUs - ex->startUs;
+    uint8_t core = ev->core & 1;
+    const char* sep = ex->first ? "" : ",";
+
+    switch (ev->type) {
+        case RTOS_TRACE_SWITCH_IN: {
+            // The previous task on this core ran until now
+            int n = 0;
+            if (ex->lastTask[core] != 0) {
+                n = snprintf(buf, len, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%u,\"dur\":%u,\"pid\":0,\"tid\":%d}",
+                             sep, lookupName(ex->lastTask[core], fallback, sizeof(fallback)),
+                             ex->lastSwitchUs[core], ts - ex->lastSwitchUs[core], core * 2);
+            }
+            ex->lastTask[core] = ev->obj;
+            ex->lastSwitchUs[core] = ts;
+            return n;
+        }
+        case RTOS_TRACE_TASK_CREATE:
+        case RTOS_TRACE_TASK_DELETE:
+            return snprintf(buf, len, "%s{\"name\":\"%s %s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%u,\"pid\":0,\"tid\":%d}",
+                            sep, ev->type == RTOS_TRACE_TASK_CREATE ? "create" : "delete",
+                            lookupName(ev->obj, fallback, sizeof(fallback)), ts, core * 2);
+        case RTOS_TRACE_QUEUE_SEND:
+        case RTOS_TRACE_QUEUE_RECEIVE:
+        case RTOS_TRACE_QUEUE_BLOCK_SEND:
+        case RTOS_TRACE_QUEUE_BLOCK_RECEIVE: {
+            static const char* ops[] = {"send", "receive", "block send", "block receive"};
+            return snprintf(buf, len, "%s{\"name\":\"%s %s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%u,\"pid\":0,\"tid\":%d}",
+                            sep, ops[ev->type - RTOS_TRACE_QUEUE_SEND],
+                            lookupName(ev->obj, fallback, sizeof(fallback)), ts, core * 2);
+        }
+        case RTOS_TRACE_ISR_ENTER:
+            return snprintf(buf, len, "%s{\"name\":\"ISR %u\",\"ph\":\"B\",\"ts\":%u,\"pid\":0,\"tid\":%d}",
+                            sep, (unsigned int) ev->obj, ts, core * 2 + 1);
+        case RTOS_TRACE_ISR_EXIT:
+            return snprintf(buf, len, "%s{\"ph\":\"E\",\"ts\":%u,\"pid\":0,\"tid\":%d}", sep, ts, core * 2 + 1);
+        default:
+            return 0;
+    }
+}
+
+static size_t jsonChunk(rtosTraceExport_t* ex, char* buf, size_t len)
+{
+    size_t used = 0;
+
+    if (ex->stage == stage_header) {
+        used = snprintf(buf, len, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":["
+                        "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,\"args\":{\"name\":\"Core 0\"}},"
+                        "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":1,\"args\":{\"name\":\"Core 0 ISRs\"}},"
+                        "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":2,\"args\":{\"name\":\"Core 1\"}},"
+                        "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":3,\"args\":{\"name\":\"Core 1 ISRs\"}}");
+        ex->first = false;
+        ex->stage = stage_events;
+    }
+
+    while (ex->stage == stage_events && used + JSON_EVENT_MAX <= len) {
+        if (ex->next == ex->end) {
+            ex->stage = stage_footer;
+            break;
+        }
+        int n = jsonEvent(ex, &events[ex->next++ % RTOS_TRACE_EVENTS], &buf[used], len - used);
+        if (n > 0) {
+            used += n;
+            ex->first = false;
+        }
+    }
+
+    if (ex->stage == stage_footer && used + 3 <= len) {
+        used += snprintf(&buf[used], len - used, "]}");
+        ex->stage = stage_done;
+    }
+    return used;
+}
+
+size_t rtosTrace_exportChunk(rtosTraceExport_t* ex, char* buf, size_t len)
+{
+    if (ex->stage == stage_done) {
+        frozen = false;
+        return 0;
+    }
+    return ex->raw ? rawChunk(ex, buf, len) : jsonChunk(ex, buf, len);
+}
+
+#else
+
+void rtosTrace_nameObject(const void* obj, const char* name)
+{
+}
+
+bool rtosTrace_exportBegin(rtosTraceExport_t* ex, bool raw)
+{
+    return false;
+}
+
+size_t rtosTrace_exportChunk(rtosTraceExport_t* ex, char* buf, size_t len)
+{
+    return 0;
+}
+
+void rtosTrace_exportAbort(rtosTraceExport_t* ex)
+{
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,97 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Set by the build when configured with -DRTOS_TRACE=1
+#ifndef RTOS_TRACE_ENABLED
+#define RTOS_TRACE_ENABLED 0
+#endif
+
+#include "rtosTraceHooks.h"
+
+#define RTOS_TRACE_EVENTS 2048          // 12 bytes each, kept in internal RAM
+#define RTOS_TRACE_MAX_NAMES 48
+#define RTOS_TRACE_NAME_LEN 16
+#define RTOS_TRACE_MAGIC 0x52545452     // "RTTR"
+#define RTOS_TRACE_VERSION 1
+#define RTOS_TRACE_CHUNK_MIN 1024       // Export buffers must hold the header and name table
+
+typedef struct {
+    uint32_t timeUs;
+    uint8_t type;
+    uint8_t core;
+    uint16_t reserved;
+    uint32_t obj;                       // Task or queue handle, or interrupt number
+} rtosTraceEvent_t;
+
+typedef struct {
+    uint32_t obj;
+    char name[RTOS_TRACE_NAME_LEN];
+} rtosTraceName_t;
+
+// Header of the raw dump read by tools/rtosTrace.py. Followed by
+// n_names rtosTraceName_t and n_events rtosTraceEvent_t, oldest first
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t n_names;
+    uint32_t n_events;
+    uint32_t reserved;
+} rtosTraceDumpHeader_t;
+
+typedef struct {
+    bool raw;
+    uint8_t stage;
+    bool first;
+    uint32_t next;
+    uint32_t end;
+    uint32_t startUs;
+    uint32_t lastSwitchUs[2];
+    uint32_t lastTask[2];
+} rtosTraceExport_t;
+
+/*
+*   --------------------------------------------------------------------
+*   rtosTrace_nameObject
+*   --------------------------------------------------------------------
+*   Gives a queue or semaphore a name in exported traces. Tasks are named
+*   automatically when they are created
+*/
+void rtosTrace_nameObject(const void* obj, const char* name);
+
+/*
+*   --------------------------------------------------------------------
+*   rtosTrace_exportBegin
+*   --------------------------------------------------------------------
+*   Freezes the event ring and prepares to export it, either as Chrome
+*   trace event JSON for Perfetto or as a raw dump for tools/rtosTrace.py.
+*   Returns false if tracing was not built in
+*/
+bool rtosTrace_exportBegin(rtosTraceExport_t* ex, bool raw);
+
+/*
+*   --------------------------------------------------------------------
+*   rtosTrace_exportChunk
+*   --------------------------------------------------------------------
+*   Writes the next part of the export into buf. Returns 0 once the export
+*   is complete, at which point recording resumes
+*/
+size_t rtosTrace_exportChunk(rtosTraceExport_t* ex, char* buf, size_t len);
+
+/*
+*   --------------------------------------------------------------------
+*   rtosTrace_exportAbort
+*   --------------------------------------------------------------------
+*   Resumes recording after an export that was not read to the end
+*/
+void rtosTrace_exportAbort(rtosTraceExport_t* ex);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+/*
+*   FreeRTOS trace hooks for rtosTrace. This header is force-included into
+*   every C file when the project is configured with -DRTOS_TRACE=1, so the
+*   macros below replace the empty defaults in FreeRTOS.h. They expand to
+*   calls into rtosTrace.c, which must stay in IRAM as the hooks run inside
+*   the scheduler with interrupts disabled.
+*/
+
+#ifndef __ASSEMBLER__
+
+#include <stdint.h>
+
+void rtosTrace_taskSwitchedIn(const void* task);
+void rtosTrace_taskCreated(const void* task, const char* name);
+void rtosTrace_taskDeleted(const void* task);
+void rtosTrace_queueEvent(uint8_t type, const void* queue);
+void rtosTrace_isrEnter(uint32_t n);
+void rtosTrace_isrExit(void);
+void sysStats_queueDepth(const void* queue, uint32_t waiting);
+
+// Event types, shared with rtosTrace.c and tools/rtosTrace.py
+#define RTOS_TRACE_SWITCH_IN 1
+#define RTOS_TRACE_TASK_CREATE 2
+#define RTOS_TRACE_TASK_DELETE 3
+#define RTOS_TRACE_QUEUE_SEND 4
+#define RTOS_TRACE_QUEUE_RECEIVE 5
+#define RTOS_TRACE_QUEUE_BLOCK_SEND 6
+#define RTOS_TRACE_QUEUE_BLOCK_RECEIVE 7
+#define RTOS_TRACE_ISR_ENTER 8
+#define RTOS_TRACE_ISR_EXIT 9
+
+#if RTOS_TRACE_ENABLED
+
+// Only expanded inside tasks.c, where pxCurrentTCB is visible
+#define traceTASK_SWITCHED_IN() rtosTrace_taskSwitchedIn(pxCurrentTCB[xPortGetCoreID()])
+#define traceTASK_CREATE(pxNewTCB) rtosTrace_taskCreated(pxNewTCB, (pxNewTCB)->pcTaskName)
+#define traceTASK_DELETE(pxTCB) rtosTrace_taskDeleted(pxTCB)
+
+// Only expanded inside queue.c, just before the item is copied in, so the
+// depth after the send is one more than uxMessagesWaiting
+#define traceQUEUE_SEND(pxQueue) do { \
+        rtosTrace_queueEvent(RTOS_TRACE_QUEUE_SEND, pxQueue); \
+        sysStats_queueDepth(pxQueue, (pxQueue)->uxMessagesWaiting + 1); \
+    } while (0)
+#define traceQUEUE_SEND_FROM_ISR(pxQueue) do { \
+        rtosTrace_queueEvent(RTOS_TRACE_QUEUE_SEND, pxQueue); \
+        sysStats_queueDepth(pxQueue, (pxQueue)->uxMessagesWaiting + 1); \
+    } while (0)
+#define traceQUEUE_RECEIVE(pxQueue) rtosTrace_queueEvent(RTOS_TRACE_QUEUE_RECEIVE, pxQueue)
+#define traceQUEUE_RECEIVE_FROM_ISR(pxQueue) rtosTrace_queueEvent(RTOS_TRACE_QUEUE_RECEIVE, pxQueue)
+#define traceBLOCKING_ON_QUEUE_SEND(pxQueue) rtosTrace_queueEvent(RTOS_TRACE_QUEUE_BLOCK_SEND, pxQueue)
+#define traceBLOCKING_ON_QUEUE_RECEIVE(pxQueue) rtosTrace_queueEvent(RTOS_TRACE_QUEUE_BLOCK_RECEIVE, pxQueue)
+
+// Called by the port around interrupt handlers
+#define traceISR_ENTER(n) rtosTrace_isrEnter(n)
+#define traceISR_EXIT() rtosTrace_isrExit()
+#define traceISR_EXIT_TO_SCHEDULER() rtosTrace_isrExit()
+
+#endif
+
+#endif
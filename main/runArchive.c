@@ -0,0 +1,386 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include "heatshrink_encoder.h"
+#include "main.h"
+#include "tsCodec.h"
+#include "runLog.h"
+#include "runRecorder.h"
+#include "runArchive.h"
+
+static const char* tag = "Run Archive";
+
+static const char* channelNames[n_tempSensors] = {
+    [T_refluxHot] = "T_refluxHot",
+    [T_boiler] = "T_boiler",
+    [T_productHot] = "T_productHot",
+    [T_productCold] = "T_productCold",
+    [T_refluxCold] = "T_refluxCold"
+};
+
+typedef struct {
+    heatshrink_encoder* hse;
+    uint32_t runId;
+    uint32_t offset;                    // Stream bytes already written to the log
+    uint32_t n_samples;
+    size_t len;
+    uint8_t buf[RUNLOG_BLOCK_PAYLOAD];
+} archiveWriter_t;
+
+// Only used from the recorder task
+static archiveWriter_t writer;
+static uint8_t samplePayload[RUNLOG_MAX_PAYLOAD];
+
+static esp_err_t appendBlock(archiveWriter_t* w, runLogBlockType_t type)
+{
+    runLogBlockInfo_t info = {
+        .type = type,
+        .n_channels = n_tempSensors,
+        .len = w->len,
+        .runId = w->runId,
+        .n_samples = w->n_samples,
+        .firstTime = w->offset          // Stream offset of the block, lets readers spot gaps
+    };
+
+    runLog_t* log = runRecorder_lockLog(recorderLog_archives);
+    if (log == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = runLog_append(log, &info, w->buf);
+    // An archive larger than the archive log wraps over its own first blocks
+    if (err == ESP_OK && !runLog_holdsRun(log, w->runId)) {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    runRecorder_unlockLog();
+
+    w->offset += w->len;
+    w->len = 0;
+    return err;
+}
+
+// Moves compressed output into the block buffer, appending full blocks
+static esp_err_t drain(archiveWriter_t* w)
+{
+    HSE_poll_res pres;
+
+    do {
+        size_t n;
+        pres = heatshrink_encoder_poll(w->hse, &w->buf[w->len], sizeof(w->buf) - w->len, &n);
+        if (pres < 0) {
+            return ESP_FAIL;
+        }
+        w->len += n;
+        if (w->len == sizeof(w->buf)) {
+            esp_err_t err = appendBlock(w, runLogBlock_archive);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+    } while (pres == HSER_POLL_MORE);
+
+    return ESP_OK;
+}
+
+static esp_err_t sink(archiveWriter_t* w, const void* data, size_t len)
+{
+    const uint8_t* p = data;
+
+    while (len > 0) {
+        size_t sunk;
+        if (heatshrink_encoder_sink(w->hse, (uint8_t*) p, len, &sunk) < 0) {
+            return ESP_FAIL;
+        }
+        p += sunk;
+        len -= sunk;
+
+        esp_err_t err = drain(w);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t finish(archiveWriter_t* w)
+{
+    esp_err_t err = ESP_OK;
+
+    while (err == ESP_OK && heatshrink_encoder_finish(w->hse) == HSER_FINISH_MORE) {
+        err = drain(w);
+    }
+    if (err == ESP_OK && w->len > 0) {
+        err = appendBlock(w, runLogBlock_archive);
+    }
+    if (err == ESP_OK) {
+        err = appendBlock(w, runLogBlock_archiveEnd);
+    }
+    return err;
+}
+
+// The sample blocks go into the archive as they are, tsCodec already packs
+// steady readings into a bit each and heatshrink finds the repeats between
+// samples. A 16 bit little endian sample count and length lead each block
+static esp_err_t sinkBlock(archiveWriter_t* w, const runLogBlockInfo_t* info, const uint8_t* payload)
+{
+    uint8_t header[4] = {
+        info->n_samples & 0xFF, info->n_samples >> 8,
+        info->len & 0xFF, info->len >> 8
+    };
+
+    w->n_samples += info->n_samples;
+    esp_err_t err = sink(w, header, sizeof(header));
+    return (err == ESP_OK) ? sink(w, payload, info->len) : err;
+}
+
+static esp_err_t sinkHeader(archiveWriter_t* w)
+{
+    char line[48 + n_tempSensors * 16];
+    int len = snprintf(line, sizeof(line), "# run %u, tsCodec blocks, 1/%d degC\ntime_ms",
+                       w->runId, TSCODEC_FIXED_SCALE);
+
+    for (int i = 0; i < n_tempSensors; i++) {
+        len += snprintf(&line[len], sizeof(line) - len, ",%s", channelNames[i]);
+    }
+    line[len++] = '\n';
+    return sink(w, line, len);
+}
+
+static esp_err_t nextSampleBlock(runLogCursor_t* cursor, runLogBlockInfo_t* info)
+{
+    esp_err_t err;
+
+    do {
+        runLog_t* log = runRecorder_lockLog(recorderLog_samples);
+        if (log == NULL) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        err = runLog_nextBlock(log, cursor, info, samplePayload);
+        runRecorder_unlockLog();
+    } while (err == ESP_OK && (info->type != runLogBlock_samples || info->n_channels != n_tempSensors));
+
+    return err;
+}
+
+// Checks that every sample block of runId is still held
+static bool samplesHeld(uint32_t runId)
+{
+    runLog_t* log = runRecorder_lockLog(recorderLog_samples);
+    if (log == NULL) {
+        return false;
+    }
+    bool held = runLog_holdsRun(log, runId);
+    runRecorder_unlockLog();
+    return held;
+}
+
+// Reads the next block of an archive. Every block carries its offset in
+// the stream, so a block lost to a bad CRC or to the log wrapping while
+// the archive is read is a gap rather than silently missing data
+static esp_err_t nextArchiveBlock(runLogCursor_t* cursor, uint32_t* offset, runLogBlockInfo_t* info, uint8_t* payload)
+{
+    esp_err_t err;
+
+    do {
+        runLog_t* log = runRecorder_lockLog(recorderLog_archives);
+        if (log == NULL) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        err = runLog_nextBlock(log, cursor, info, payload);
+        runRecorder_unlockLog();
+    } while (err == ESP_OK && info->type != runLogBlock_archive && info->type != runLogBlock_archiveEnd);
+
+    if (err == ESP_ERR_NOT_FOUND) {
+        // Out of blocks before the end marker
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (err == ESP_OK && info->firstTime != *offset) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (err == ESP_OK) {
+        *offset += info->len;
+    }
+    return err;
+}
+
+esp_err_t runArchive_create(uint32_t runId)
+{
+    runLogCursor_t cursor;
+    runLogBlockInfo_t info;
+    esp_err_t err;
+
+    // A run longer than the sample log has lost its first blocks
+    if (!samplesHeld(runId)) {
+        ESP_LOGW(tag, "Run %u no longer fits in the sample log, not archiving it", runId);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Archives are appended in run order so the sector index can find them
+    runLog_t* log = runRecorder_lockLog(recorderLog_archives);
+    if (log == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    bool inOrder = log->lastRunId < runId;
+    runRecorder_unlockLog();
+    if (!inOrder) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    log = runRecorder_lockLog(recorderLog_samples);
+    err = runLog_findRun(log, runId, &cursor);
+    runRecorder_unlockLog();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    memset(&writer, 0, sizeof(writer));
+    writer.runId = runId;
+    writer.hse = heatshrink_encoder_alloc(RUNARCHIVE_WINDOW_BITS, RUNARCHIVE_LOOKAHEAD_BITS);
+    if (writer.hse == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    err = sinkHeader(&writer);
+    while (err == ESP_OK) {
+        err = nextSampleBlock(&cursor, &info);
+        if (err != ESP_OK) {
+            err = (err == ESP_ERR_NOT_FOUND) ? ESP_OK : err;
+            break;
+        }
+        err = sinkBlock(&writer, &info, samplePayload);
+    }
+
+    // The recorder is the only writer of the sample log, this only guards
+    // against that changing
+    if (err == ESP_OK && !samplesHeld(runId)) {
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    if (err == ESP_OK) {
+        err = finish(&writer);
+    }
+    heatshrink_encoder_free(writer.hse);
+
+    if (err == ESP_OK) {
+        ESP_LOGI(tag, "Run %u: %u samples compressed to %u bytes", runId, writer.n_samples, writer.offset);
+    } else if (err == ESP_ERR_INVALID_SIZE) {
+        ESP_LOGW(tag, "Run %u: archive does not fit in the archive log", runId);
+    }
+    return err;
+}
+
+esp_err_t runArchive_open(runArchiveReader_t* reader, uint32_t runId)
+{
+    runLogBlockInfo_t info;
+    esp_err_t err;
+
+    runLog_t* log = runRecorder_lockLog(recorderLog_archives);
+    if (log == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    err = runLog_findRun(log, runId, &reader->cursor);
+    runRecorder_unlockLog();
+
+    // Walk the archive first so an interrupted or partly overwritten one
+    // is never served
+    reader->offset = 0;
+    while (err == ESP_OK) {
+        err = nextArchiveBlock(&reader->cursor, &reader->offset, &info, reader->payload);
+        if (err == ESP_OK && info.type == runLogBlock_archiveEnd) {
+            reader->size = reader->offset;
+            reader->n_samples = info.n_samples;
+            break;
+        }
+    }
+    if (err != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    log = runRecorder_lockLog(recorderLog_archives);
+    err = runLog_findRun(log, runId, &reader->cursor);
+    runRecorder_unlockLog();
+    reader->offset = 0;
+    return err;
+}
+
+esp_err_t runArchive_read(runArchiveReader_t* reader, const uint8_t** data, size_t* len)
+{
+    runLogBlockInfo_t info;
+
+    if (reader->cursor.sectorsLeft == 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    esp_err_t err = nextArchiveBlock(&reader->cursor, &reader->offset, &info, reader->payload);
+    if (err != ESP_OK || info.type == runLogBlock_archiveEnd) {
+        reader->cursor.sectorsLeft = 0;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (info.type == runLogBlock_archiveEnd) {
+        return (reader->offset == reader->size) ? ESP_ERR_NOT_FOUND : ESP_ERR_INVALID_STATE;
+    }
+
+    *data = reader->payload;
+    *len = info.len;
+    return ESP_OK;
+}
+
+esp_err_t runArchive_list(runArchiveFound_t found, void* ctx)
+{
+    runLogCursor_t cursor;
+    runLogBlockInfo_t info;
+    uint32_t runId = RUNLOG_NO_RUN;
+    uint32_t offset = 0;
+    bool intact = false;
+    esp_err_t err;
+
+    uint8_t* payload = malloc(RUNLOG_MAX_PAYLOAD);
+    if (payload == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    runLog_t* log = runRecorder_lockLog(recorderLog_archives);
+    if (log == NULL) {
+        free(payload);
+        return ESP_ERR_INVALID_STATE;
+    }
+    err = runLog_findAll(log, &cursor);
+    runRecorder_unlockLog();
+
+    while (err == ESP_OK) {
+        log = runRecorder_lockLog(recorderLog_archives);
+        err = runLog_nextBlock(log, &cursor, &info, payload);
+        runRecorder_unlockLog();
+        if (err != ESP_OK || (info.type != runLogBlock_archive && info.type != runLogBlock_archiveEnd)) {
+            continue;
+        }
+
+        // Same checks as reading the archive, in a single pass over the log
+        if (info.runId != runId) {
+            runId = info.runId;
+            offset = 0;
+            intact = true;
+        }
+        intact = intact && info.firstTime == offset;
+        if (info.type == runLogBlock_archiveEnd) {
+            if (intact) {
+                found(runId, offset, info.n_samples, ctx);
+            }
+            intact = false;
+        } else {
+            offset += info.len;
+        }
+    }
+
+    free(payload);
+    return (err == ESP_ERR_NOT_FOUND) ? ESP_OK : err;
+}
+
+#ifdef __cplusplus
+}
+#endif
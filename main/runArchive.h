@@ -0,0 +1,72 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include "runLog.h"
+
+// Heatshrink parameters of the archive stream. An 8 bit window keeps the
+// encoder under 2 KB of heap while the run is being compressed
+#define RUNARCHIVE_WINDOW_BITS 8
+#define RUNARCHIVE_LOOKAHEAD_BITS 4
+
+typedef struct {
+    runLogCursor_t cursor;
+    uint32_t size;                      // Total compressed bytes
+    uint32_t offset;                    // Compressed bytes read so far
+    uint32_t n_samples;
+    uint8_t payload[RUNLOG_MAX_PAYLOAD];
+} runArchiveReader_t;
+
+typedef void (*runArchiveFound_t)(uint32_t runId, uint32_t size, uint32_t n_samples, void* ctx);
+
+/*
+*   --------------------------------------------------------------------
+*   runArchive_create
+*   --------------------------------------------------------------------
+*   Compresses the sample blocks of a completed run and appends the
+*   result to the archive log. The archive is a heatshrink stream of a
+*   two line CSV header followed by the run's tsCodec blocks, which the
+*   browser decodes back into a CSV. Called from the recorder task, the
+*   logs are only locked for one block at a time. Returns
+*   ESP_ERR_INVALID_SIZE if the run outgrew the sample log or the
+*   archive outgrew the archive log
+*/
+esp_err_t runArchive_create(uint32_t runId);
+
+/*
+*   --------------------------------------------------------------------
+*   runArchive_open
+*   --------------------------------------------------------------------
+*   Positions a reader at the start of the archive of runId. Returns
+*   ESP_ERR_NOT_FOUND if the run has no complete archive, or if any of its
+*   blocks are missing
+*/
+esp_err_t runArchive_open(runArchiveReader_t* reader, uint32_t runId);
+
+/*
+*   --------------------------------------------------------------------
+*   runArchive_read
+*   --------------------------------------------------------------------
+*   Points *data at the next chunk of the archive stream. Returns
+*   ESP_ERR_NOT_FOUND once the whole archive has been read, and
+*   ESP_ERR_INVALID_STATE if a block went missing since it was opened
+*/
+esp_err_t runArchive_read(runArchiveReader_t* reader, const uint8_t** data, size_t* len);
+
+/*
+*   --------------------------------------------------------------------
+*   runArchive_list
+*   --------------------------------------------------------------------
+*   Calls found for every complete archive held, oldest first, with its
+*   compressed size and sample count. Reads the archive log once
+*/
+esp_err_t runArchive_list(runArchiveFound_t found, void* ctx);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,343 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+#include "runLog.h"
+
+/*
+*   On-flash layout
+*
+*   The storage is split into RUNLOG_SECTOR_SIZE sectors which are filled
+*   in round robin order, so every sector sees the same number of erase
+*   cycles. Each sector starts with a sectorHeader_t carrying a sequence
+*   number (newest sector has the highest) and the run id of its first
+*   block. Blocks follow back to back, each with a blockHeader_t and a
+*   4 byte aligned payload. The commit word of a block is written after
+*   the rest of the block, so a block torn by a reset is skipped.
+*/
+
+#define SECTOR_MAGIC 0x674c7552         // "RuLg"
+#define BLOCK_MAGIC 0xB10C
+#define BLOCK_ERASED 0xFFFF
+#define BLOCK_COMMITTED 0x00000000
+#define ALIGN4(x) (((x) + 3) & ~3)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t runId;
+    uint32_t crc;
+} sectorHeader_t;
+
+typedef struct {
+    uint16_t magic;
+    uint8_t type;
+    uint8_t n_channels;
+    uint16_t len;
+    uint16_t reserved;
+    uint32_t runId;
+    uint32_t n_samples;
+    uint32_t firstTime;
+    uint32_t crc;                       // Covers all fields above and the payload
+    uint32_t commit;
+} blockHeader_t;
+
+static uint32_t crc32Update(uint32_t crc, const void* data, size_t len)
+{
+    const uint8_t* p = data;
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+static size_t sectorAddr(uint16_t sector)
+{
+    return (size_t) sector * RUNLOG_SECTOR_SIZE;
+}
+
+static uint32_t blockCrc(const blockHeader_t* h, const void* payload)
+{
+    uint32_t crc = crc32Update(0, h, offsetof(blockHeader_t, crc));
+    return crc32Update(crc, payload, h->len);
+}
+
+static bool blockHeaderValid(const blockHeader_t* h, uint32_t offset)
+{
+    return h->magic == BLOCK_MAGIC && h->len <= RUNLOG_MAX_PAYLOAD &&
+           offset + ALIGN4(sizeof(blockHeader_t) + h->len) <= RUNLOG_SECTOR_SIZE;
+}
+
+static esp_err_t writeSectorHeader(runLog_t* log, uint16_t sector, uint32_t seq, uint32_t runId)
+{
+    sectorHeader_t h = {.magic = SECTOR_MAGIC, .seq = seq, .runId = runId};
+    h.crc = crc32Update(0, &h, offsetof(sectorHeader_t, crc));
+
+    esp_err_t err = log->storage.erase(log->storage.ctx, sectorAddr(sector), RUNLOG_SECTOR_SIZE);
+    if (err == ESP_OK) {
+        err = log->storage.write(log->storage.ctx, sectorAddr(sector), &h, sizeof(h));
+    }
+
+    log->index[sector].seq = (err == ESP_OK) ? seq : 0;
+    log->index[sector].runId = runId;
+    return err;
+}
+
+// Oldest sector of the contiguous chain of valid sectors ending at head
+static uint16_t tailSector(const runLog_t* log)
+{
+    uint16_t tail = log->head;
+    for (int i = 1; i < log->n_sectors; i++) {
+        uint16_t prev = (tail + log->n_sectors - 1) % log->n_sectors;
+        if (log->index[prev].seq == 0 || log->index[prev].seq != log->index[tail].seq - 1) {
+            break;
+        }
+        tail = prev;
+    }
+    return tail;
+}
+
+// Finds the end of the data in the head sector and the highest run id in it
+static esp_err_t scanHeadSector(runLog_t* log)
+{
+    uint32_t offset = sizeof(sectorHeader_t);
+    blockHeader_t h;
+
+    while (offset + sizeof(blockHeader_t) <= RUNLOG_SECTOR_SIZE) {
+        esp_err_t err = log->storage.read(log->storage.ctx, sectorAddr(log->head) + offset, &h, sizeof(h));
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (h.magic == BLOCK_ERASED) {
+            break;
+        }
+        if (!blockHeaderValid(&h, offset)) {
+            // Header torn mid-write. Nothing after it can be trusted
+            offset = RUNLOG_SECTOR_SIZE;
+            break;
+        }
+        if (h.commit == BLOCK_COMMITTED && h.runId > log->lastRunId) {
+            log->lastRunId = h.runId;
+        }
+        offset += ALIGN4(sizeof(blockHeader_t) + h.len);
+    }
+
+    log->headOffset = offset;
+    return ESP_OK;
+}
+
+esp_err_t runLog_mount(runLog_t* log, const runLogStorage_t* storage)
+{
+    sectorHeader_t h;
+    bool found = false;
+
+    memset(log, 0, sizeof(runLog_t));
+    log->storage = *storage;
+    log->n_sectors = storage->size / RUNLOG_SECTOR_SIZE;
+    if (log->n_sectors > RUNLOG_MAX_SECTORS) {
+        log->n_sectors = RUNLOG_MAX_SECTORS;
+    }
+    if (log->n_sectors < 2) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    for (uint16_t i = 0; i < log->n_sectors; i++) {
+        esp_err_t err = storage->read(storage->ctx, sectorAddr(i), &h, sizeof(h));
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (h.magic != SECTOR_MAGIC || h.crc != crc32Update(0, &h, offsetof(sectorHeader_t, crc))) {
+            continue;
+        }
+
+        log->index[i].seq = h.seq;
+        log->index[i].runId = h.runId;
+        if (h.runId > log->lastRunId) {
+            log->lastRunId = h.runId;
+        }
+        if (!found || h.seq > log->seq) {
+            log->seq = h.seq;
+            log->head = i;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        log->head = 0;
+        log->seq = 1;
+        log->headOffset = sizeof(sectorHeader_t);
+        return writeSectorHeader(log, 0, log->seq, RUNLOG_NO_RUN);
+    }
+
+    return scanHeadSector(log);
+}
+
+uint32_t runLog_newRun(runLog_t* log)
+{
+    return ++log->lastRunId;
+}
+
+esp_err_t runLog_append(runLog_t* log, const runLogBlockInfo_t* info, const void* payload)
+{
+    blockHeader_t h;
+    esp_err_t err;
+
+    if (info->len > RUNLOG_MAX_PAYLOAD) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    uint32_t blockSize = ALIGN4(sizeof(blockHeader_t) + info->len);
+    if (log->headOffset + blockSize > RUNLOG_SECTOR_SIZE) {
+        uint16_t next = (log->head + 1) % log->n_sectors;
+        err = writeSectorHeader(log, next, log->seq + 1, info->runId);
+        if (err != ESP_OK) {
+            return err;
+        }
+        log->head = next;
+        log->seq++;
+        log->headOffset = sizeof(sectorHeader_t);
+    }
+
+    memset(&h, 0xFF, sizeof(h));
+    h.magic = BLOCK_MAGIC;
+    h.type = info->type;
+    h.n_channels = info->n_channels;
+    h.len = info->len;
+    h.runId = info->runId;
+    h.n_samples = info->n_samples;
+    h.firstTime = info->firstTime;
+    h.crc = blockCrc(&h, payload);
+
+    // Space is consumed even if a write fails, the block is then skipped as uncommitted
+    size_t addr = sectorAddr(log->head) + log->headOffset;
+    log->headOffset += blockSize;
+    if (info->runId > log->lastRunId) {
+        log->lastRunId = info->runId;
+    }
+
+    err = log->storage.write(log->storage.ctx, addr, &h, sizeof(h));
+    if (err == ESP_OK && info->len) {
+        err = log->storage.write(log->storage.ctx, addr + sizeof(h), payload, info->len);
+    }
+    if (err == ESP_OK) {
+        uint32_t commit = BLOCK_COMMITTED;
+        err = log->storage.write(log->storage.ctx, addr + offsetof(blockHeader_t, commit), &commit, sizeof(commit));
+    }
+
+    return err;
+}
+
+uint32_t runLog_oldestRun(const runLog_t* log)
+{
+    if (log->lastRunId == RUNLOG_NO_RUN) {
+        return RUNLOG_NO_RUN;
+    }
+
+    uint32_t oldest = log->index[tailSector(log)].runId;
+    return oldest == RUNLOG_NO_RUN ? 1 : oldest;
+}
+
+bool runLog_holdsRun(const runLog_t* log, uint32_t runId)
+{
+    return log->index[tailSector(log)].runId < runId;
+}
+
+esp_err_t runLog_findRun(const runLog_t* log, uint32_t runId, runLogCursor_t* cursor)
+{
+    if (runId == RUNLOG_NO_RUN || runId > log->lastRunId || runId < runLog_oldestRun(log)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // The run starts in the last sector that opened with an older run, or
+    // in the tail sector if the run is the oldest in the log
+    uint16_t tail = tailSector(log);
+    uint16_t start = tail;
+    uint16_t sector = tail;
+    uint16_t n_valid = (log->head + log->n_sectors - tail) % log->n_sectors + 1;
+
+    for (uint16_t i = 0; i < n_valid; i++) {
+        if (log->index[sector].runId >= runId) {
+            break;
+        }
+        start = sector;
+        sector = (sector + 1) % log->n_sectors;
+    }
+
+    cursor->runId = runId;
+    cursor->sector = start;
+    cursor->offset = sizeof(sectorHeader_t);
+    cursor->sectorsLeft = (log->head + log->n_sectors - start) % log->n_sectors + 1;
+    return ESP_OK;
+}
+
+esp_err_t runLog_findAll(const runLog_t* log, runLogCursor_t* cursor)
+{
+    uint16_t tail = tailSector(log);
+
+    cursor->runId = RUNLOG_NO_RUN;
+    cursor->sector = tail;
+    cursor->offset = sizeof(sectorHeader_t);
+    cursor->sectorsLeft = (log->head + log->n_sectors - tail) % log->n_sectors + 1;
+    return ESP_OK;
+}
+
+esp_err_t runLog_nextBlock(const runLog_t* log, runLogCursor_t* cursor, runLogBlockInfo_t* info, void* payload)
+{
+    blockHeader_t h;
+
+    while (cursor->sectorsLeft > 0) {
+        bool endOfSector = cursor->offset + sizeof(blockHeader_t) > RUNLOG_SECTOR_SIZE;
+        size_t addr = sectorAddr(cursor->sector) + cursor->offset;
+
+        if (!endOfSector) {
+            esp_err_t err = log->storage.read(log->storage.ctx, addr, &h, sizeof(h));
+            if (err != ESP_OK) {
+                return err;
+            }
+            endOfSector = !blockHeaderValid(&h, cursor->offset);
+        }
+
+        if (endOfSector) {
+            cursor->sector = (cursor->sector + 1) % log->n_sectors;
+            cursor->offset = sizeof(sectorHeader_t);
+            cursor->sectorsLeft--;
+            continue;
+        }
+
+        cursor->offset += ALIGN4(sizeof(blockHeader_t) + h.len);
+        if (h.commit != BLOCK_COMMITTED || h.runId < cursor->runId) {
+            continue;
+        }
+        if (h.runId > cursor->runId && cursor->runId != RUNLOG_NO_RUN) {
+            break;
+        }
+
+        esp_err_t err = log->storage.read(log->storage.ctx, addr + sizeof(h), payload, h.len);
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (blockCrc(&h, payload) != h.crc) {
+            continue;
+        }
+
+        info->type = h.type;
+        info->n_channels = h.n_channels;
+        info->len = h.len;
+        info->runId = h.runId;
+        info->n_samples = h.n_samples;
+        info->firstTime = h.firstTime;
+        return ESP_OK;
+    }
+
+    cursor->sectorsLeft = 0;
+    return ESP_ERR_NOT_FOUND;
+}
+
+#ifdef __cplusplus
+}
+#endif
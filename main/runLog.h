@@ -0,0 +1,146 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#define RUNLOG_SECTOR_SIZE 4096
+#define RUNLOG_MAX_SECTORS 128
+#define RUNLOG_MAX_PAYLOAD 1024
+#define RUNLOG_NO_RUN 0
+
+typedef enum {
+    runLogBlock_samples = 1,            // tsCodec encoded sensor samples
+    runLogBlock_archive = 2,            // Compressed archive of a completed run
+    runLogBlock_archiveEnd = 3          // Empty block marking a complete archive
+} runLogBlockType_t;
+
+// Storage backend. Must behave like NOR flash: writes can only clear
+// bits and erase sets a whole sector back to 0xFF
+typedef struct {
+    esp_err_t (*read)(void* ctx, size_t offset, void* dst, size_t len);
+    esp_err_t (*write)(void* ctx, size_t offset, const void* src, size_t len);
+    esp_err_t (*erase)(void* ctx, size_t offset, size_t len);
+    size_t size;
+    void* ctx;
+} runLogStorage_t;
+
+// Sector level index entry. Kept in RAM so runs can be located without
+// reading the whole partition
+typedef struct {
+    uint32_t seq;                       // 0 if sector is erased or invalid
+    uint32_t runId;                     // Run of the first block in the sector
+} runLogSectorInfo_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t n_channels;
+    uint16_t len;                       // Payload length in bytes
+    uint32_t runId;
+    uint32_t n_samples;
+    uint32_t firstTime;                 // ms
+} runLogBlockInfo_t;
+
+typedef struct {
+    runLogStorage_t storage;
+    uint16_t n_sectors;
+    uint16_t head;                      // Sector currently being appended to
+    uint32_t headOffset;                // Next free byte within head sector
+    uint32_t seq;                       // Sequence number of head sector
+    uint32_t lastRunId;
+    runLogSectorInfo_t index[RUNLOG_MAX_SECTORS];
+} runLog_t;
+
+// Cursor used to iterate the blocks of a run
+typedef struct {
+    uint32_t runId;                     // RUNLOG_NO_RUN iterates every run
+    uint16_t sector;
+    uint32_t offset;
+    uint16_t sectorsLeft;
+} runLogCursor_t;
+
+/*
+*   --------------------------------------------------------------------
+*   runLog_mount
+*   --------------------------------------------------------------------
+*   Mounts the run log on the given storage. Only the sector headers and
+*   the blocks of the newest sector are read. A blank or corrupt storage
+*   is formatted on first use
+*/
+esp_err_t runLog_mount(runLog_t* log, const runLogStorage_t* storage);
+
+/*
+*   --------------------------------------------------------------------
+*   runLog_newRun
+*   --------------------------------------------------------------------
+*   Returns a new run id. Run ids increase monotonically so the runs
+*   held in the log are always a contiguous range of ids
+*/
+uint32_t runLog_newRun(runLog_t* log);
+
+/*
+*   --------------------------------------------------------------------
+*   runLog_append
+*   --------------------------------------------------------------------
+*   Appends a block to the log. The block is committed with a final
+*   word write, so a block torn by a reset is never read back. When the
+*   log is full the oldest sector is erased
+*/
+esp_err_t runLog_append(runLog_t* log, const runLogBlockInfo_t* info, const void* payload);
+
+/*
+*   --------------------------------------------------------------------
+*   runLog_oldestRun
+*   --------------------------------------------------------------------
+*   Returns the id of the oldest run still (at least partially) held in
+*   the log, or RUNLOG_NO_RUN if the log is empty
+*/
+uint32_t runLog_oldestRun(const runLog_t* log);
+
+/*
+*   --------------------------------------------------------------------
+*   runLog_holdsRun
+*   --------------------------------------------------------------------
+*   Returns true if no block of runId has been erased to make room, ie
+*   the oldest sector still held opened with an older run. Conservative:
+*   a run starting exactly at the beginning of the oldest sector counts
+*   as partially erased
+*/
+bool runLog_holdsRun(const runLog_t* log, uint32_t runId);
+
+/*
+*   --------------------------------------------------------------------
+*   runLog_findRun
+*   --------------------------------------------------------------------
+*   Positions a cursor at the first sector that can hold blocks of runId
+*   using the sector index
+*/
+esp_err_t runLog_findRun(const runLog_t* log, uint32_t runId, runLogCursor_t* cursor);
+
+/*
+*   --------------------------------------------------------------------
+*   runLog_findAll
+*   --------------------------------------------------------------------
+*   Positions a cursor at the oldest sector held. runLog_nextBlock then
+*   returns the blocks of every run in the order they were appended
+*/
+esp_err_t runLog_findAll(const runLog_t* log, runLogCursor_t* cursor);
+
+/*
+*   --------------------------------------------------------------------
+*   runLog_nextBlock
+*   --------------------------------------------------------------------
+*   Reads the next committed block of the cursor's run. payload must
+*   hold RUNLOG_MAX_PAYLOAD bytes. Returns ESP_ERR_NOT_FOUND once the
+*   run has been exhausted
+*/
+esp_err_t runLog_nextBlock(const runLog_t* log, runLogCursor_t* cursor, runLogBlockInfo_t* info, void* payload);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,281 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+#include <esp_log.h>
+#include <esp_err.h>
+#include <esp_timer.h>
+#include <esp_partition.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "main.h"
+#include "sensors.h"
+#include "tsCodec.h"
+#include "runLog.h"
+#include "runArchive.h"
+#include "runRecorder.h"
+
+static const char* tag = "Run Recorder";
+
+xQueueHandle recorderQueue;
+static SemaphoreHandle_t logMutex;
+static runLog_t runLog;
+static runLog_t archiveLog;
+static bool logMounted = false;
+
+// Part of the runlog partition holding one of the logs
+typedef struct {
+    const esp_partition_t* partition;
+    size_t offset;
+} logRegion_t;
+
+static logRegion_t samplesRegion;
+static logRegion_t archivesRegion;
+
+// Block currently being filled
+static uint8_t blockBuf[RUNLOG_BLOCK_PAYLOAD];
+static tsEncoder_t encoder;
+static uint32_t blockFirstTime;
+static uint32_t currentRun = RUNLOG_NO_RUN;
+static volatile bool runOpen = false;
+
+static esp_err_t partitionRead(void* ctx, size_t offset, void* dst, size_t len)
+{
+    const logRegion_t* region = ctx;
+    return esp_partition_read(region->partition, region->offset + offset, dst, len);
+}
+
+static esp_err_t partitionWrite(void* ctx, size_t offset, const void* src, size_t len)
+{
+    const logRegion_t* region = ctx;
+    return esp_partition_write(region->partition, region->offset + offset, src, len);
+}
+
+static esp_err_t partitionErase(void* ctx, size_t offset, size_t len)
+{
+    const logRegion_t* region = ctx;
+    return esp_partition_erase_range(region->partition, region->offset + offset, len);
+}
+
+static esp_err_t mountRegion(runLog_t* log, logRegion_t* region, const esp_partition_t* partition,
+                             size_t offset, size_t size)
+{
+    region->partition = partition;
+    region->offset = offset;
+
+    runLogStorage_t storage = {
+        .read = partitionRead,
+        .write = partitionWrite,
+        .erase = partitionErase,
+        .size = size,
+        .ctx = region
+    };
+    return runLog_mount(log, &storage);
+}
+
+esp_err_t runRecorder_init(void)
+{
+    recorderQueue = xQueueCreate(RECORDER_QUEUE_LEN, sizeof(recorderMsg_t));
+    logMutex = xSemaphoreCreateMutex();
+
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                RUNLOG_PARTITION_SUBTYPE,
+                                                                RUNLOG_PARTITION_LABEL);
+    if (partition == NULL) {
+        ESP_LOGW(tag, "No %s partition found. Runs will not be recorded", RUNLOG_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (partition->size <= RUNLOG_ARCHIVE_SIZE) {
+        ESP_LOGE(tag, "%s partition is too small to hold %d bytes of archives", RUNLOG_PARTITION_LABEL,
+                 RUNLOG_ARCHIVE_SIZE);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    int64_t startTime = esp_timer_get_time();
+    size_t samplesSize = partition->size - RUNLOG_ARCHIVE_SIZE;
+    esp_err_t err = mountRegion(&runLog, &samplesRegion, partition, 0, samplesSize);
+    if (err == ESP_OK) {
+        err = mountRegion(&archiveLog, &archivesRegion, partition, samplesSize, RUNLOG_ARCHIVE_SIZE);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(tag, "Error (%s) mounting run log", esp_err_to_name(err));
+        return err;
+    }
+
+    // New runs must sort after every archive, archives are appended in run order
+    if (archiveLog.lastRunId > runLog.lastRunId) {
+        runLog.lastRunId = archiveLog.lastRunId;
+    }
+
+    logMounted = true;
+    ESP_LOGI(tag, "Run log mounted in %lld us. Holding samples of runs %u to %u, archives of runs %u to %u",
+             esp_timer_get_time() - startTime, runLog_oldestRun(&runLog), runLog.lastRunId,
+             runLog_oldestRun(&archiveLog), archiveLog.lastRunId);
+    return ESP_OK;
+}
+
+static void flushBlock(void)
+{
+    if (encoder.n_samples == 0) {
+        return;
+    }
+
+    runLogBlockInfo_t info = {
+        .type = runLogBlock_samples,
+        .n_channels = n_tempSensors,
+        .len = tsEncoder_bytes(&encoder),
+        .runId = currentRun,
+        .n_samples = encoder.n_samples,
+        .firstTime = blockFirstTime
+    };
+
+    xSemaphoreTake(logMutex, portMAX_DELAY);
+    esp_err_t err = runLog_append(&runLog, &info, blockBuf);
+    xSemaphoreGive(logMutex);
+
+    if (err != ESP_OK) {
+        ESP_LOGW(tag, "Error (%s) writing block to run log", esp_err_to_name(err));
+    }
+    tsEncoder_init(&encoder, blockBuf, sizeof(blockBuf), n_tempSensors);
+}
+
+static void recordSample(const recorderMsg_t* msg)
+{
+    if (encoder.n_samples == 0) {
+        blockFirstTime = msg->time;
+    }
+
+    if (!tsEncoder_append(&encoder, msg->time, msg->temps)) {
+        flushBlock();
+        blockFirstTime = msg->time;
+        tsEncoder_append(&encoder, msg->time, msg->temps);
+    }
+}
+
+static void archiveRun(uint32_t runId)
+{
+    int64_t startTime = esp_timer_get_time();
+    esp_err_t err = runArchive_create(runId);
+
+    if (err != ESP_OK) {
+        ESP_LOGW(tag, "Error (%s) archiving run %u", esp_err_to_name(err), runId);
+    } else {
+        ESP_LOGI(tag, "Run %u archived in %lld ms", runId, (esp_timer_get_time() - startTime) / 1000);
+    }
+}
+
+void runRecorder_task(void* params)
+{
+    recorderMsg_t msg;
+    tsEncoder_init(&encoder, blockBuf, sizeof(blockBuf), n_tempSensors);
+
+    while (true) {
+        if (!xQueueReceive(recorderQueue, &msg, RUNLOG_FLUSH_PERIOD_MS / portTICK_PERIOD_MS)) {
+            // Nothing arrived for a whole flush period
+            flushBlock();
+            continue;
+        }
+
+        if (!logMounted) {
+            continue;
+        }
+
+        switch (msg.type) {
+            case recorderMsg_sample:
+                if (currentRun != RUNLOG_NO_RUN) {
+                    recordSample(&msg);
+                    if (msg.time - blockFirstTime >= RUNLOG_FLUSH_PERIOD_MS) {
+                        flushBlock();
+                    }
+                }
+                break;
+            case recorderMsg_startRun:
+                flushBlock();
+                xSemaphoreTake(logMutex, portMAX_DELAY);
+                currentRun = runLog_newRun(&runLog);
+                xSemaphoreGive(logMutex);
+                ESP_LOGI(tag, "Recording run %u", currentRun);
+                break;
+            case recorderMsg_endRun:
+                if (currentRun == RUNLOG_NO_RUN) {
+                    break;
+                }
+                flushBlock();
+                ESP_LOGI(tag, "Finished recording run %u", currentRun);
+                archiveRun(currentRun);
+                currentRun = RUNLOG_NO_RUN;
+                break;
+        }
+    }
+}
+
+static bool sendMessage(recorderMsg_t* msg)
+{
+    if (recorderQueue == NULL) {
+        return false;
+    }
+    // Samples may be dropped while the recorder is stalled on flash, run
+    // boundaries must not be. Samples leave the last slots free for them.
+    // Everything is sent from the control loop, so this can't race
+    if (msg->type == recorderMsg_sample && uxQueueSpacesAvailable(recorderQueue) <= RECORDER_BOUNDARY_SLOTS) {
+        return false;
+    }
+    msg->time = esp_timer_get_time() / 1000;
+    return xQueueSend(recorderQueue, msg, 0) == pdTRUE;
+}
+
+void runRecorder_logSample(float temps[])
+{
+    recorderMsg_t msg = {.type = recorderMsg_sample};
+
+    // Nothing is recorded between runs, so keep the queue free for run
+    // start messages while a finished run is being archived
+    if (!runOpen) {
+        return;
+    }
+
+    // Store in fixed sensor order so the log survives sensor reassignment
+    for (int i = 0; i < n_tempSensors; i++) {
+        msg.temps[i] = getTemperature(temps, (tempSensor) i);
+    }
+    sendMessage(&msg);
+}
+
+void runRecorder_startRun(void)
+{
+    recorderMsg_t msg = {.type = recorderMsg_startRun};
+    runOpen = true;
+    if (!sendMessage(&msg) && recorderQueue != NULL) {
+        ESP_LOGE(tag, "Run start lost, more than %d run boundaries queued", RECORDER_BOUNDARY_SLOTS);
+    }
+}
+
+void runRecorder_endRun(void)
+{
+    recorderMsg_t msg = {.type = recorderMsg_endRun};
+    runOpen = false;
+    if (!sendMessage(&msg) && recorderQueue != NULL) {
+        ESP_LOGE(tag, "Run end lost, more than %d run boundaries queued", RECORDER_BOUNDARY_SLOTS);
+    }
+}
+
+runLog_t* runRecorder_lockLog(recorderLog_t which)
+{
+    if (!logMounted) {
+        return NULL;
+    }
+    xSemaphoreTake(logMutex, portMAX_DELAY);
+    return (which == recorderLog_archives) ? &archiveLog : &runLog;
+}
+
+void runRecorder_unlockLog(void)
+{
+    xSemaphoreGive(logMutex);
+}
+
+#ifdef __cplusplus
+}
+#endif
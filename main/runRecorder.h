@@ -0,0 +1,95 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "main.h"
+#include "runLog.h"
+
+#define RUNLOG_PARTITION_LABEL "runlog"
+#define RUNLOG_PARTITION_SUBTYPE 0x40
+#define RUNLOG_FLUSH_PERIOD_MS 60000        // Longest a sample waits in RAM before hitting flash
+#define RUNLOG_BLOCK_PAYLOAD 512
+#define RUNLOG_ARCHIVE_SIZE (128 * 1024)    // End of the partition holding archives, the rest holds samples
+#define RECORDER_QUEUE_LEN 32
+#define RECORDER_BOUNDARY_SLOTS 4           // Queue slots samples leave free for run starts and ends
+
+// The partition holds two logs. Samples are recorded into a ring that only
+// has to outlast the run being recorded, completed runs live on as
+// archives in a ring of their own
+typedef enum {
+    recorderLog_samples,
+    recorderLog_archives
+} recorderLog_t;
+
+typedef enum {
+    recorderMsg_sample,
+    recorderMsg_startRun,
+    recorderMsg_endRun
+} recorderMsgType_t;
+
+typedef struct {
+    recorderMsgType_t type;
+    uint32_t time;
+    float temps[n_tempSensors];
+} recorderMsg_t;
+
+extern xQueueHandle recorderQueue;
+
+/*
+*   --------------------------------------------------------------------
+*   runRecorder_init
+*   --------------------------------------------------------------------
+*   Mounts the sample and archive logs on the runlog flash partition and
+*   creates the queue feeding the recorder task
+*/
+esp_err_t runRecorder_init(void);
+
+/*
+*   --------------------------------------------------------------------
+*   runRecorder_task
+*   --------------------------------------------------------------------
+*   Low priority task that compresses samples into blocks and appends
+*   full blocks to the run log. Partially filled blocks are flushed every
+*   RUNLOG_FLUSH_PERIOD_MS so a reset loses at most that much history.
+*   When a run ends it is compressed into a downloadable archive, after
+*   which its sample blocks are left for the next runs to overwrite
+*/
+void runRecorder_task(void* params);
+
+/*
+*   --------------------------------------------------------------------
+*   runRecorder_logSample
+*   --------------------------------------------------------------------
+*   Hands a set of raw sensor readings to the recorder. Never blocks, the
+*   sample is dropped if the recorder has fallen behind
+*/
+void runRecorder_logSample(float temps[]);
+
+/*
+*   --------------------------------------------------------------------
+*   runRecorder_startRun / runRecorder_endRun
+*   --------------------------------------------------------------------
+*   Opens and closes a run. Samples are only recorded while a run is open
+*/
+void runRecorder_startRun(void);
+
+void runRecorder_endRun(void);
+
+/*
+*   --------------------------------------------------------------------
+*   runRecorder_lockLog / runRecorder_unlockLog
+*   --------------------------------------------------------------------
+*   Gives other tasks exclusive access to one of the logs for reading. Both
+*   logs share a lock. Returns NULL if the logs could not be mounted
+*/
+runLog_t* runRecorder_lockLog(recorderLog_t which);
+
+void runRecorder_unlockLog(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -16,6 +16,7 @@ extern "C" {
 #include "driver/timer.h"
 #include "ds18b20.h" 
 #include "sensors.h"
+#include "profiler.h"
 #include "controlLoop.h"
 #include "main.h"
 #include "pinDefs.h"
@@ -134,7 +135,7 @@ esp_err_t sensor_init(uint8_t ds_pin, DS18B20_RESOLUTION res)
     }
 
     ESP_LOGI(tag, "Setting up tempQueue");
-    tempQueue = xQueueCreate(10, sizeof(float[5]));
+    tempQueue = xQueueCreate(10, sizeof(tempSample_t));
     flowRateQueue = xQueueCreate(10, sizeof(float));
     ESP_LOGI(tag, "TempQueue initialized");
     ESP_LOGI(tag, "Sensor network initialized");
@@ -176,19 +177,22 @@ esp_err_t init_timer(void)
 
 void temp_sensor_task(void *pvParameters) 
 {
-    float sensorTemps[5] = {0};
+    tempSample_t sample = {0};
     portTickType xLastWakeTime = xTaskGetTickCount();
     BaseType_t ret;
 
     while (1) 
     {
         // Zero temperature array
-        for (int i = 0; i < 5; i++) {
-            sensorTemps[i] = 0;
+        for (int i = 0; i < n_tempSensors; i++) {
+            sample.temps[i] = 0;
         }
 
-        readTemps(sensorTemps);
-        ret = xQueueSend(tempQueue, sensorTemps, 100 / portTICK_PERIOD_MS);
+        sample.traceId++;
+        sample.convStartUs = esp_timer_get_time();
+        readTemps(sample.temps);
+        sample.readDoneUs = esp_timer_get_time();
+        ret = xQueueSend(tempQueue, &sample, 100 / portTICK_PERIOD_MS);
         if (ret == errQUEUE_FULL) {
             ESP_LOGI(tag, "Flow rate queue full");
         }
@@ -231,6 +235,8 @@ void IRAM_ATTR flowmeter_ISR(void* arg)
 
 void readTemps(float sensorTemps[])
 {
+    PROFILE_ZONE(prof_readTemps);
+
     // Read temperatures more efficiently by starting conversions on all devices at the same time
     if (num_devices > 0) {
         ds18b20_convert_all(owb);
@@ -17,6 +17,17 @@ extern xQueueHandle hotSideTempQueue;
 extern xQueueHandle coldSideTempQueue;
 extern xQueueHandle flowRateQueue;
 extern OneWireBus_ROMCode saved_rom_codes[MAX_DEVICES];
+
+// Item passed through tempQueue. Timestamps are esp_timer us and let the
+// age of a reading be traced up to the pump actuation that used it
+typedef struct {
+    float temps[n_tempSensors];
+    uint32_t traceId;
+    int64_t convStartUs;                // Conversion started on all sensors
+    int64_t readDoneUs;                 // Last sensor read back
+    int64_t dequeueUs;                  // Set by the receiver
+} tempSample_t;
+
 /*
 *   --------------------------------------------------------------------  
 *   temp_sensor_task
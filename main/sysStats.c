@@ -0,0 +1,301 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "rtosTrace.h"
+#include "sysStats.h"
+
+#if SYS_STATS_CONSOLE
+#include "driver/uart.h"
+#endif
+
+typedef struct {
+    xQueueHandle queue;
+    const char* name;
+    uint32_t length;
+    volatile uint32_t highWater;
+} watchedQueue_t;
+
+static const char* tag = "System stats";
+
+static const sysStatsHeap_t heapCaps[SYS_STATS_N_HEAPS] = {
+    {.name = "internal", .caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT},
+    {.name = "dma", .caps = MALLOC_CAP_DMA},
+    {.name = "spiram", .caps = MALLOC_CAP_SPIRAM},
+    {.name = "exec", .caps = MALLOC_CAP_EXEC}
+};
+
+static watchedQueue_t queues[SYS_STATS_MAX_QUEUES];
+static volatile int n_queues = 0;
+static volatile uint32_t wsConnects = 0;
+static volatile uint32_t wsDisconnects = 0;
+
+// Task snapshot buffers, shared by the web server and the console
+static SemaphoreHandle_t snapshotMutex;
+static TaskStatus_t taskStatus[SYS_STATS_MAX_TASKS];
+static TaskHandle_t prevHandles[SYS_STATS_MAX_TASKS];
+static uint32_t prevRunTime[SYS_STATS_MAX_TASKS];
+static int n_prev = 0;
+static uint32_t prevTotalRunTime = 0;
+
+#if RTOS_TRACE_ENABLED
+
+// Called from the queue send hook inside the queue's critical section, so
+// it must stay in IRAM and only scan the short watch list
+void IRAM_ATTR sysStats_queueDepth(const void* queue, uint32_t waiting)
+{
+    int n = n_queues;
+
+    for (int i = 0; i < n; i++) {
+        if (queues[i].queue == queue) {
+            if (waiting > queues[i].length) {
+                waiting = queues[i].length;         // Overwrites of a full queue
+            }
+            if (waiting > queues[i].highWater) {
+                queues[i].highWater = waiting;
+            }
+            return;
+        }
+    }
+}
+
+#else
+
+static void sampleQueues(void* arg)
+{
+    for (int i = 0; i < n_queues; i++) {
+        uint32_t waiting = uxQueueMessagesWaiting(queues[i].queue);
+        if (waiting > queues[i].highWater) {
+            queues[i].highWater = waiting;
+        }
+    }
+}
+
+#endif
+
+esp_err_t sysStats_init(void)
+{
+    snapshotMutex = xSemaphoreCreateMutex();
+    if (snapshotMutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+#if RTOS_TRACE_ENABLED
+    return ESP_OK;
+#else
+    esp_timer_handle_t timer;
+    esp_timer_create_args_t timerArgs = {
+        .callback = sampleQueues,
+        .name = "queueSampler"
+    };
+
+    esp_err_t err = esp_timer_create(&timerArgs, &timer);
+    if (err == ESP_OK) {
+        err = esp_timer_start_periodic(timer, SYS_STATS_QUEUE_SAMPLE_US);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(tag, "Failed to start queue sampling (%s)", esp_err_to_name(err));
+    }
+    return err;
+#endif
+}
+
+void sysStats_watchQueue(xQueueHandle queue, const char* name)
+{
+    if (queue == NULL || n_queues >= SYS_STATS_MAX_QUEUES) {
+        return;
+    }
+
+    watchedQueue_t* watched = &queues[n_queues];
+    watched->queue = queue;
+    watched->name = name;
+    watched->length = uxQueueMessagesWaiting(queue) + uxQueueSpacesAvailable(queue);
+    watched->highWater = 0;
+    n_queues++;         // Published last, the sampler or send hook may already be running
+}
+
+int sysStats_getTasks(sysStatsTask_t* tasks, int maxTasks, uint32_t* intervalUs)
+{
+    uint32_t totalRunTime = 0;
+
+    if (snapshotMutex == NULL) {
+        return 0;
+    }
+    xSemaphoreTake(snapshotMutex, portMAX_DELAY);
+
+    int n = uxTaskGetSystemState(taskStatus, SYS_STATS_MAX_TASKS, &totalRunTime);
+    if (n == 0) {
+        ESP_LOGW(tag, "More than %d tasks, raise SYS_STATS_MAX_TASKS", SYS_STATS_MAX_TASKS);
+    }
+    uint32_t interval = totalRunTime - prevTotalRunTime;
+    *intervalUs = interval;
+
+    for (int i = 0; i < n && i < maxTasks; i++) {
+        TaskStatus_t* status = &taskStatus[i];
+        sysStatsTask_t* task = &tasks[i];
+
+        strlcpy(task->name, status->pcTaskName, sizeof(task->name));
+        task->priority = status->uxCurrentPriority;
+        task->state = status->eCurrentState;
+        task->stackFree = status->usStackHighWaterMark;     // StackType_t is a byte on this port
+#if configTASKLIST_INCLUDE_COREID
+        task->core = status->xCoreID == tskNO_AFFINITY ? -1 : status->xCoreID;
+#else
+        task->core = -1;
+#endif
+
+        // Tasks created since the last call are measured from their creation
+        uint32_t runTime = 0;
+#if configGENERATE_RUN_TIME_STATS
+        runTime = status->ulRunTimeCounter;
+        for (int p = 0; p < n_prev; p++) {
+            if (prevHandles[p] == status->xHandle) {
+                runTime -= prevRunTime[p];
+                break;
+            }
+        }
+#endif
+        task->cpuPermille = interval ? (uint64_t) runTime * 1000 / interval : 0;
+    }
+
+    for (int i = 0; i < n; i++) {
+        prevHandles[i] = taskStatus[i].xHandle;
+#if configGENERATE_RUN_TIME_STATS
+        prevRunTime[i] = taskStatus[i].ulRunTimeCounter;
+#endif
+    }
+    n_prev = n;
+    prevTotalRunTime = totalRunTime;
+
+    xSemaphoreGive(snapshotMutex);
+    return n < maxTasks ? n : maxTasks;
+}
+
+int sysStats_getHeaps(sysStatsHeap_t* heaps, int maxHeaps)
+{
+    int n = 0;
+
+    for (int i = 0; i < SYS_STATS_N_HEAPS && n < maxHeaps; i++) {
+        heaps[n] = heapCaps[i];
+        heaps[n].freeBytes = heap_caps_get_free_size(heapCaps[i].caps);
+        heaps[n].minFreeBytes = heap_caps_get_minimum_free_size(heapCaps[i].caps);
+        heaps[n].largestBlock = heap_caps_get_largest_free_block(heapCaps[i].caps);
+        n++;
+    }
+    return n;
+}
+
+int sysStats_getQueues(sysStatsQueue_t* out, int maxQueues)
+{
+    int n = n_queues < maxQueues ? n_queues : maxQueues;
+
+    for (int i = 0; i < n; i++) {
+        out[i].name = queues[i].name;
+        out[i].length = queues[i].length;
+        out[i].waiting = uxQueueMessagesWaiting(queues[i].queue);
+        out[i].highWater = queues[i].highWater;
+    }
+    return n;
+}
+
+void sysStats_websocketConnected(void)
+{
+    __atomic_fetch_add(&wsConnects, 1, __ATOMIC_RELAXED);
+}
+
+void sysStats_websocketClosed(void)
+{
+    __atomic_fetch_add(&wsDisconnects, 1, __ATOMIC_RELAXED);
+}
+
+sysStatsWebsockets_t sysStats_getWebsockets(void)
+{
+    sysStatsWebsockets_t ws = {
+        .connects = wsConnects,
+        .disconnects = wsDisconnects
+    };
+    ws.sendTasks = ws.connects - ws.disconnects;
+    return ws;
+}
+
+#if SYS_STATS_CONSOLE
+
+#define CONSOLE_UART UART_NUM_0
+#define CONSOLE_LINE_LEN 32
+
+static void printStats(void)
+{
+    static const char stateChars[] = "XRBSD";       // Running, ready, blocked, suspended, deleted
+    static sysStatsTask_t tasks[SYS_STATS_MAX_TASKS];
+    sysStatsHeap_t heaps[SYS_STATS_N_HEAPS];
+    sysStatsQueue_t queueStats[SYS_STATS_MAX_QUEUES];
+    uint32_t intervalUs;
+
+    int n = sysStats_getTasks(tasks, SYS_STATS_MAX_TASKS, &intervalUs);
+    printf("%-16s %4s %4s %5s %6s %8s\n", "task", "prio", "core", "state", "cpu%", "stack");
+    for (int i = 0; i < n; i++) {
+        printf("%-16s %4u %4d %5c %3u.%u %8u\n", tasks[i].name, tasks[i].priority, tasks[i].core,
+               tasks[i].state < sizeof(stateChars) - 1 ? stateChars[tasks[i].state] : '?',
+               tasks[i].cpuPermille / 10, tasks[i].cpuPermille % 10, tasks[i].stackFree);
+    }
+    printf("CPU share over the last %u ms\n\n", intervalUs / 1000);
+
+    n = sysStats_getHeaps(heaps, SYS_STATS_N_HEAPS);
+    printf("%-16s %8s %8s %8s\n", "heap", "free", "minFree", "largest");
+    for (int i = 0; i < n; i++) {
+        printf("%-16s %8u %8u %8u\n", heaps[i].name, heaps[i].freeBytes, heaps[i].minFreeBytes, heaps[i].largestBlock);
+    }
+
+    n = sysStats_getQueues(queueStats, SYS_STATS_MAX_QUEUES);
+    printf("\n%-16s %8s %8s %8s\n", "queue", "length", "waiting", "max");
+    for (int i = 0; i < n; i++) {
+        printf("%-16s %8u %8u %8u\n", queueStats[i].name, queueStats[i].length, queueStats[i].waiting, queueStats[i].highWater);
+    }
+
+    sysStatsWebsockets_t ws = sysStats_getWebsockets();
+    printf("\nwebsockets: %u connects, %u closed, %u send tasks\n", ws.connects, ws.disconnects, ws.sendTasks);
+}
+
+void sysStats_consoleTask(void* params)
+{
+    char line[CONSOLE_LINE_LEN];
+    int len = 0;
+    uint8_t c;
+
+    uart_driver_install(CONSOLE_UART, 256, 0, 0, NULL, 0);
+    while (true) {
+        if (uart_read_bytes(CONSOLE_UART, &c, 1, portMAX_DELAY) != 1) {
+            continue;
+        }
+
+        if (c != '\r' && c != '\n') {
+            if (len < CONSOLE_LINE_LEN - 1) {
+                line[len++] = c;
+            }
+            continue;
+        }
+
+        line[len] = '\0';
+        if (strcmp(line, "stats") == 0) {
+            printStats();
+        } else if (len > 0) {
+            printf("Unknown command '%s', try 'stats'\n", line);
+        }
+        len = 0;
+    }
+}
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,111 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#define SYS_STATS_MAX_TASKS 24
+#define SYS_STATS_MAX_QUEUES 8
+#define SYS_STATS_N_HEAPS 4                 // internal, dma, spiram, exec
+#define SYS_STATS_QUEUE_SAMPLE_US 100000    // Queue depth sampling period without trace hooks
+
+// Set to 1 to print the statistics on the UART0 console with "stats"
+#ifndef SYS_STATS_CONSOLE
+#define SYS_STATS_CONSOLE 0
+#endif
+
+typedef struct {
+    char name[configMAX_TASK_NAME_LEN];
+    uint8_t priority;
+    int8_t core;                            // -1 when not pinned
+    uint8_t state;                          // eTaskState
+    uint32_t stackFree;                     // Stack high-water mark in bytes
+    uint16_t cpuPermille;                   // Share of one core since the previous call
+} sysStatsTask_t;
+
+typedef struct {
+    const char* name;
+    uint32_t caps;
+    uint32_t freeBytes;
+    uint32_t minFreeBytes;
+    uint32_t largestBlock;
+} sysStatsHeap_t;
+
+typedef struct {
+    const char* name;
+    uint32_t length;
+    uint32_t waiting;
+    uint32_t highWater;
+} sysStatsQueue_t;
+
+typedef struct {
+    uint32_t connects;
+    uint32_t disconnects;
+    uint32_t sendTasks;                     // Websocket send tasks currently alive
+} sysStatsWebsockets_t;
+
+/*
+*   --------------------------------------------------------------------
+*   sysStats_init
+*   --------------------------------------------------------------------
+*   Starts the timer that samples the depth of watched queues. Builds
+*   configured with -DRTOS_TRACE=1 take the depth from the queue send hook
+*   instead and start no timer
+*/
+esp_err_t sysStats_init(void);
+
+/*
+*   --------------------------------------------------------------------
+*   sysStats_watchQueue
+*   --------------------------------------------------------------------
+*   Adds a queue to the depth high-water tracking. With the trace hooks
+*   every send is seen and the high-water mark is exact. Otherwise depths
+*   are sampled every SYS_STATS_QUEUE_SAMPLE_US and the mark is a lower
+*   bound, as bursts drained within a period are missed
+*/
+void sysStats_watchQueue(xQueueHandle queue, const char* name);
+
+/*
+*   --------------------------------------------------------------------
+*   sysStats_getTasks
+*   --------------------------------------------------------------------
+*   Fills tasks with every task in the system and returns how many were
+*   written. CPU shares cover the time since the previous call, which is
+*   returned in intervalUs
+*/
+int sysStats_getTasks(sysStatsTask_t* tasks, int maxTasks, uint32_t* intervalUs);
+
+/*
+*   --------------------------------------------------------------------
+*   sysStats_getHeaps
+*   --------------------------------------------------------------------
+*   Free, minimum ever free and largest free block for each memory
+*   capability of interest. Returns the number of entries written
+*/
+int sysStats_getHeaps(sysStatsHeap_t* heaps, int maxHeaps);
+
+int sysStats_getQueues(sysStatsQueue_t* queues, int maxQueues);
+
+void sysStats_websocketConnected(void);
+void sysStats_websocketClosed(void);
+sysStatsWebsockets_t sysStats_getWebsockets(void);
+
+#if SYS_STATS_CONSOLE
+/*
+*   --------------------------------------------------------------------
+*   sysStats_consoleTask
+*   --------------------------------------------------------------------
+*   Reads lines from UART0 and prints the statistics when "stats" is
+*   entered
+*/
+void sysStats_consoleTask(void* params);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,193 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "controlLoop.h"
+#include "sensors.h"
+#include "networking.h"
+#include "webServer.h"
+#include "telemetry.h"
+
+static const char* tag = "Telemetry";
+
+static telemetryFrame_t frames[2];
+static volatile int front = 0;
+static volatile uint32_t publishedSeq = 0;
+static SemaphoreHandle_t frameMutex = NULL;
+static TaskHandle_t telemetryTaskHandle = NULL;
+static telemetrySample_t* samples = NULL;
+static TaskHandle_t listeners[TELEMETRY_MAX_LISTENERS];
+static volatile int n_listeners = 0;
+
+esp_err_t telemetry_init(void)
+{
+    frameMutex = xSemaphoreCreateMutex();
+    samples = heap_caps_malloc(TELEMETRY_SAMPLE_RING * sizeof(telemetrySample_t), MALLOC_CAP_SPIRAM);
+    if (samples == NULL) {
+        samples = malloc(TELEMETRY_SAMPLE_RING * sizeof(telemetrySample_t));
+    }
+    if (frameMutex == NULL || samples == NULL) {
+        ESP_LOGE(tag, "Failed to allocate telemetry buffers");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static int16_t centi(float value)
+{
+    float scaled = value * 100;
+    return scaled > INT16_MAX ? INT16_MAX : (scaled < INT16_MIN ? INT16_MIN : (int16_t) scaled);
+}
+
+static void recordSample(uint32_t seq, int64_t timeUs)
+{
+    telemetrySample_t* sample = &samples[seq % TELEMETRY_SAMPLE_RING];
+    float temps[n_tempSensors];
+
+    get_latest_temperatures(temps);
+    sample->seq = seq;
+    sample->timeMs = timeUs / 1000;
+    for (int i = 0; i < n_tempSensors; i++) {
+        sample->temps[i] = centi(getTemperature(temps, (tempSensor) i));
+    }
+    sample->setpoint = centi(get_setpoint());
+    sample->refluxPump = get_refluxPumpSpeed();
+    sample->productPump = get_productPumpSpeed();
+    sample->flags = (get_element1_status() ? TELEMETRY_ELEMENT1 : 0) |
+                    (get_element2_status() ? TELEMETRY_ELEMENT2 : 0) |
+                    (get_fan_state() ? TELEMETRY_FAN : 0) |
+                    (getFlush() ? TELEMETRY_FLUSH : 0);
+}
+
+static void serialise(telemetryFrame_t* frame)
+{
+    float temps[n_tempSensors];
+    Data settings = get_controller_settings();
+    loopTiming_t timing = get_loop_timing();
+    wifiLinkStats_t link = get_wifi_link_stats();
+    wsLinkSummary_t ws = webServer_getLinkSummary();
+
+    get_latest_temperatures(temps);
+    int n = snprintf(frame->json, TELEMETRY_JSON_LEN,
+        "{\"seq\":%u,\"uptimeMs\":%lld,"
+        "\"T_vapour\":%.2f,\"T_refluxInflow\":%.2f,\"T_productInflow\":%.2f,\"T_radiator\":%.2f,\"T_boiler\":%.2f,"
+        "\"boilerConc\":%.4f,\"vapourConc\":%.4f,"
+        "\"setpoint\":%.2f,\"P_gain\":%.3f,\"I_gain\":%.3f,\"D_gain\":%.3f,"
+        "\"refluxPump\":%u,\"productPump\":%u,\"element1\":%s,\"element2\":%s,\"fan\":%s,\"flush\":%s,"
+        "\"loopPeriodUs\":%u,\"loopDeadlineMisses\":%u,"
+        "\"rssi\":%d,\"wifiReconnects\":%u,\"wifiReconnectLastMs\":%u,"
+        "\"wsClients\":%u,\"wsRttUs\":%u,\"wsSendUs\":%u,\"wsSendFailures\":%u}",
+        frame->seq, frame->timeUs / 1000,
+        getTemperature(temps, T_refluxHot), getTemperature(temps, T_refluxCold),
+        getTemperature(temps, T_productHot), getTemperature(temps, T_productCold),
+        getTemperature(temps, T_boiler),
+        getBoilerConcentration(getTemperature(temps, T_boiler)),
+        getVapourConcentration(getTemperature(temps, T_refluxHot)),
+        settings.setpoint, settings.P_gain, settings.I_gain, settings.D_gain,
+        get_refluxPumpSpeed(), get_productPumpSpeed(),
+        get_element1_status() ? "true" : "false", get_element2_status() ? "true" : "false",
+        get_fan_state() ? "true" : "false", getFlush() ? "true" : "false",
+        timing.lastPeriodUs, timing.deadlineMisses,
+        link.connected ? link.rssi : 0, link.reconnects, link.lastReconnectMs,
+        ws.clients, ws.lastRttUs, ws.lastSendUs, ws.sendFailures);
+
+    if (n < 0 || n >= TELEMETRY_JSON_LEN) {
+        ESP_LOGW(tag, "Frame truncated, raise TELEMETRY_JSON_LEN");
+        n = snprintf(frame->json, TELEMETRY_JSON_LEN, "{\"seq\":%u}", frame->seq);
+    }
+    frame->len = n;
+}
+
+void telemetry_task(void* params)
+{
+    uint32_t seq = 0;
+
+    telemetryTaskHandle = xTaskGetCurrentTaskHandle();
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        // Readers only ever touch the front buffer while holding the lock,
+        // so the back buffer can be written without it
+        telemetryFrame_t* back = &frames[!front];
+        back->seq = ++seq;
+        back->timeUs = esp_timer_get_time();
+        serialise(back);
+
+        xSemaphoreTake(frameMutex, portMAX_DELAY);
+        recordSample(seq, back->timeUs);
+        front = !front;
+        publishedSeq = seq;
+        xSemaphoreGive(frameMutex);
+
+        for (int i = 0; i < n_listeners; i++) {
+            xTaskNotifyGive(listeners[i]);
+        }
+    }
+}
+
+void telemetry_notifyTick(void)
+{
+    if (telemetryTaskHandle != NULL) {
+        xTaskNotifyGive(telemetryTaskHandle);
+    }
+}
+
+esp_err_t telemetry_addListener(TaskHandle_t task)
+{
+    if (n_listeners >= TELEMETRY_MAX_LISTENERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    listeners[n_listeners] = task;
+    n_listeners++;
+    return ESP_OK;
+}
+
+const telemetryFrame_t* telemetry_lockFrame(void)
+{
+    if (frameMutex == NULL || publishedSeq == 0) {
+        return NULL;
+    }
+    xSemaphoreTake(frameMutex, portMAX_DELAY);
+    return &frames[front];
+}
+
+void telemetry_unlockFrame(void)
+{
+    xSemaphoreGive(frameMutex);
+}
+
+uint32_t telemetry_getSeq(void)
+{
+    return publishedSeq;
+}
+
+int telemetry_readSamples(uint32_t fromSeq, telemetrySample_t* out, int maxSamples)
+{
+    int n = 0;
+
+    if (frameMutex == NULL) {
+        return 0;
+    }
+
+    xSemaphoreTake(frameMutex, portMAX_DELAY);
+    uint32_t oldest = publishedSeq >= TELEMETRY_SAMPLE_RING ? publishedSeq - TELEMETRY_SAMPLE_RING + 1 : 1;
+    uint32_t seq = fromSeq < oldest ? oldest : fromSeq;
+    while (seq <= publishedSeq && n < maxSamples) {
+        out[n++] = samples[seq++ % TELEMETRY_SAMPLE_RING];
+    }
+    xSemaphoreGive(frameMutex);
+    return n;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,114 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "main.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TELEMETRY_JSON_LEN 768
+#define TELEMETRY_SAMPLE_RING 1024          // About 3.4 minutes of ticks at 5 Hz
+#define TELEMETRY_MAX_LISTENERS 4
+
+// Flags in telemetrySample_t
+#define TELEMETRY_ELEMENT1 (1 << 0)
+#define TELEMETRY_ELEMENT2 (1 << 1)
+#define TELEMETRY_FAN (1 << 2)
+#define TELEMETRY_FLUSH (1 << 3)
+
+typedef struct {
+    uint32_t seq;                       // Increments once per control tick, used as the ETag
+    int64_t timeUs;                     // When the tick that produced the frame ended
+    size_t len;
+    char json[TELEMETRY_JSON_LEN];
+} telemetryFrame_t;
+
+// Compact per tick record kept in a ring for consumers that batch or
+// replay, such as the MQTT publisher
+typedef struct {
+    uint32_t seq;
+    uint32_t timeMs;
+    int16_t temps[n_tempSensors];       // 1/100 degC, in tempSensor order
+    int16_t setpoint;                   // 1/100 degC
+    uint16_t refluxPump;
+    uint16_t productPump;
+    uint8_t flags;
+} telemetrySample_t;
+
+/*
+*   --------------------------------------------------------------------
+*   telemetry_init
+*   --------------------------------------------------------------------
+*   Creates the lock guarding the published frame and allocates the
+*   sample ring, in SPIRAM when available
+*/
+esp_err_t telemetry_init(void);
+
+/*
+*   --------------------------------------------------------------------
+*   telemetry_task
+*   --------------------------------------------------------------------
+*   Serialises the controller state once per control tick into the back
+*   buffer of a double buffered frame, then publishes it. Runs outside the
+*   control task so neither serialisation nor readers can delay the loop
+*/
+void telemetry_task(void* params);
+
+/*
+*   --------------------------------------------------------------------
+*   telemetry_notifyTick
+*   --------------------------------------------------------------------
+*   Called by the control loop at the end of every iteration. Only wakes
+*   the telemetry task
+*/
+void telemetry_notifyTick(void);
+
+/*
+*   --------------------------------------------------------------------
+*   telemetry_addListener
+*   --------------------------------------------------------------------
+*   Registers a task to receive a task notification each time a new frame
+*   has been published
+*/
+esp_err_t telemetry_addListener(TaskHandle_t task);
+
+/*
+*   --------------------------------------------------------------------
+*   telemetry_lockFrame / telemetry_unlockFrame
+*   --------------------------------------------------------------------
+*   Gives a reader the latest published frame. The frame stays valid
+*   until unlocked, so hold the lock only for as long as a copy takes.
+*   Returns NULL before the first tick has been published
+*/
+const telemetryFrame_t* telemetry_lockFrame(void);
+
+void telemetry_unlockFrame(void);
+
+/*
+*   --------------------------------------------------------------------
+*   telemetry_getSeq
+*   --------------------------------------------------------------------
+*   Sequence number of the latest frame, without locking. Lets a reader
+*   skip the copy when its client already has that frame
+*/
+uint32_t telemetry_getSeq(void);
+
+/*
+*   --------------------------------------------------------------------
+*   telemetry_readSamples
+*   --------------------------------------------------------------------
+*   Copies up to maxSamples samples starting at sequence number fromSeq,
+*   oldest first, and returns how many were copied. If fromSeq has already
+*   dropped out of the ring the copy starts at the oldest sample held, so
+*   callers can spot the gap from the sequence numbers
+*/
+int telemetry_readSamples(uint32_t fromSeq, telemetrySample_t* samples, int maxSamples);
+
+#ifdef __cplusplus
+}
+#endif
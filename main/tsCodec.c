@@ -0,0 +1,209 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+#include <math.h>
+#include "tsCodec.h"
+
+// Variable length buckets. Each bucket is a unary prefix followed by a
+// fixed number of payload bits. The last bucket of each table is the
+// escape which stores the full 32 bit value.
+static const uint8_t timeBucketBits[] = {0, 7, 9, 12, 32};
+static const uint8_t valueBucketBits[] = {0, 3, 6, 12, 32};
+#define N_BUCKETS 5
+
+static inline uint32_t zigzagEncode(int32_t v)
+{
+    return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+static inline int32_t zigzagDecode(uint32_t v)
+{
+    return (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+}
+
+static inline int32_t toFixed(float value)
+{
+    return (int32_t) lroundf(value * TSCODEC_FIXED_SCALE);
+}
+
+static void writeBits(tsEncoder_t* enc, uint32_t value, uint8_t nBits)
+{
+    while (nBits > 0) {
+        size_t byte = enc->bitPos >> 3;
+        uint8_t space = 8 - (enc->bitPos & 7);
+        uint8_t take = nBits < space ? nBits : space;
+        uint8_t chunk = (value >> (nBits - take)) & ((1u << take) - 1);
+
+        if (space == 8) {
+            enc->buf[byte] = 0;
+        }
+        enc->buf[byte] |= chunk << (space - take);
+        enc->bitPos += take;
+        nBits -= take;
+    }
+}
+
+static bool readBits(tsDecoder_t* dec, uint8_t nBits, uint32_t* value)
+{
+    uint32_t result = 0;
+
+    if (dec->bitPos + nBits > dec->bitLen) {
+        return false;
+    }
+
+    while (nBits > 0) {
+        uint8_t avail = 8 - (dec->bitPos & 7);
+        uint8_t take = nBits < avail ? nBits : avail;
+        uint8_t chunk = (dec->buf[dec->bitPos >> 3] >> (avail - take)) & ((1u << take) - 1);
+
+        result = (result << take) | chunk;
+        dec->bitPos += take;
+        nBits -= take;
+    }
+
+    *value = result;
+    return true;
+}
+
+// Writes zigzagged value using the smallest bucket that fits it
+static void writeBucketed(tsEncoder_t* enc, const uint8_t bucketBits[], uint32_t zz, uint32_t raw)
+{
+    if (zz == 0) {
+        writeBits(enc, 0, 1);
+        return;
+    }
+
+    for (int i = 1; i < N_BUCKETS - 1; i++) {
+        if (zz < (1u << bucketBits[i])) {
+            // Prefix is i ones followed by a zero
+            writeBits(enc, ((1u << i) - 1) << 1, i + 1);
+            writeBits(enc, zz, bucketBits[i]);
+            return;
+        }
+    }
+
+    writeBits(enc, (1u << (N_BUCKETS - 1)) - 1, N_BUCKETS - 1);
+    writeBits(enc, raw, 32);
+}
+
+// Returns the bucket index read, or -1 if the stream is truncated
+static int readBucketed(tsDecoder_t* dec, const uint8_t bucketBits[], uint32_t* payload)
+{
+    uint32_t bit;
+    int bucket = 0;
+
+    while (bucket < N_BUCKETS - 1) {
+        if (!readBits(dec, 1, &bit)) {
+            return -1;
+        }
+        if (bit == 0) {
+            break;
+        }
+        bucket++;
+    }
+
+    *payload = 0;
+    if (bucketBits[bucket] && !readBits(dec, bucketBits[bucket], payload)) {
+        return -1;
+    }
+
+    return bucket;
+}
+
+void tsEncoder_init(tsEncoder_t* enc, uint8_t* buf, size_t capacity, uint8_t n_channels)
+{
+    memset(enc, 0, sizeof(tsEncoder_t));
+    enc->buf = buf;
+    enc->capacity = capacity;
+    enc->n_channels = n_channels > TSCODEC_MAX_CHANNELS ? TSCODEC_MAX_CHANNELS : n_channels;
+}
+
+bool tsEncoder_append(tsEncoder_t* enc, uint32_t time_ms, const float values[])
+{
+    // Check against the worst case so a sample is never partially written
+    if (enc->bitPos + TSCODEC_MAX_SAMPLE_BITS(enc->n_channels) > enc->capacity * 8) {
+        return false;
+    }
+
+    if (enc->n_samples == 0) {
+        writeBits(enc, time_ms, 32);
+    } else {
+        int32_t delta = (int32_t) (time_ms - enc->prevTime);
+        int32_t dod = delta - enc->prevTimeDelta;
+        writeBucketed(enc, timeBucketBits, zigzagEncode(dod), (uint32_t) dod);
+        enc->prevTimeDelta = delta;
+    }
+    enc->prevTime = time_ms;
+
+    for (int i = 0; i < enc->n_channels; i++) {
+        int32_t value = toFixed(values[i]);
+        int32_t delta = value - enc->prevValue[i];
+        writeBucketed(enc, valueBucketBits, zigzagEncode(delta), (uint32_t) value);
+        enc->prevValue[i] = value;
+    }
+
+    enc->n_samples++;
+    return true;
+}
+
+size_t tsEncoder_bytes(const tsEncoder_t* enc)
+{
+    return (enc->bitPos + 7) / 8;
+}
+
+void tsDecoder_init(tsDecoder_t* dec, const uint8_t* buf, size_t len, uint8_t n_channels, uint32_t n_samples)
+{
+    memset(dec, 0, sizeof(tsDecoder_t));
+    dec->buf = buf;
+    dec->bitLen = len * 8;
+    dec->n_channels = n_channels > TSCODEC_MAX_CHANNELS ? TSCODEC_MAX_CHANNELS : n_channels;
+    dec->n_samples = n_samples;
+}
+
+bool tsDecoder_next(tsDecoder_t* dec, uint32_t* time_ms, float values[])
+{
+    uint32_t payload;
+    int bucket;
+
+    if (dec->n_samples == 0) {
+        return false;
+    }
+
+    if (dec->bitPos == 0) {
+        if (!readBits(dec, 32, &payload)) {
+            return false;
+        }
+        dec->prevTime = payload;
+    } else {
+        bucket = readBucketed(dec, timeBucketBits, &payload);
+        if (bucket < 0) {
+            return false;
+        }
+        int32_t dod = (bucket == N_BUCKETS - 1) ? (int32_t) payload : zigzagDecode(payload);
+        dec->prevTimeDelta += dod;
+        dec->prevTime += dec->prevTimeDelta;
+    }
+    *time_ms = dec->prevTime;
+
+    for (int i = 0; i < dec->n_channels; i++) {
+        bucket = readBucketed(dec, valueBucketBits, &payload);
+        if (bucket < 0) {
+            return false;
+        }
+        if (bucket == N_BUCKETS - 1) {
+            dec->prevValue[i] = (int32_t) payload;
+        } else {
+            dec->prevValue[i] += zigzagDecode(payload);
+        }
+        values[i] = (float) dec->prevValue[i] / TSCODEC_FIXED_SCALE;
+    }
+
+    dec->n_samples--;
+    return true;
+}
+
+#ifdef __cplusplus
+}
+#endif
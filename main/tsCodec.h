@@ -0,0 +1,89 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TSCODEC_MAX_CHANNELS 8
+#define TSCODEC_FIXED_SCALE 16          // DS18B20 LSB is 1/16 degC, 11 bit reads step in 2 LSBs
+
+// Worst case encoded size of a single sample, used to size buffers
+#define TSCODEC_MAX_SAMPLE_BITS(n_channels) (36 + (n_channels) * 36)
+#define TSCODEC_MAX_SAMPLE_BYTES(n_channels) ((TSCODEC_MAX_SAMPLE_BITS(n_channels) + 7) / 8)
+
+typedef struct {
+    uint8_t* buf;
+    size_t capacity;                            // Size of buf in bytes
+    size_t bitPos;                              // Number of bits written so far
+    uint8_t n_channels;
+    uint32_t n_samples;
+    uint32_t prevTime;
+    int32_t prevTimeDelta;
+    int32_t prevValue[TSCODEC_MAX_CHANNELS];
+} tsEncoder_t;
+
+typedef struct {
+    const uint8_t* buf;
+    size_t bitLen;                              // Number of valid bits in buf
+    size_t bitPos;
+    uint8_t n_channels;
+    uint32_t n_samples;
+    uint32_t prevTime;
+    int32_t prevTimeDelta;
+    int32_t prevValue[TSCODEC_MAX_CHANNELS];
+} tsDecoder_t;
+
+/*
+*   --------------------------------------------------------------------
+*   tsEncoder_init
+*   --------------------------------------------------------------------
+*   Prepares an encoder to write a compressed time series of n_channels
+*   temperatures into buf. Timestamps are stored as delta-of-delta and
+*   temperatures as deltas of fixed point (1/16 degC) values, so a
+*   steady sensor costs a single bit per sample
+*/
+void tsEncoder_init(tsEncoder_t* enc, uint8_t* buf, size_t capacity, uint8_t n_channels);
+
+/*
+*   --------------------------------------------------------------------
+*   tsEncoder_append
+*   --------------------------------------------------------------------
+*   Appends a single sample in constant time. Timestamps are in ms and
+*   must be non-decreasing. Returns false without modifying the stream
+*   if there is not enough room left in the buffer for the sample
+*/
+bool tsEncoder_append(tsEncoder_t* enc, uint32_t time_ms, const float values[]);
+
+/*
+*   --------------------------------------------------------------------
+*   tsEncoder_bytes
+*   --------------------------------------------------------------------
+*   Returns the number of bytes of buf holding encoded data
+*/
+size_t tsEncoder_bytes(const tsEncoder_t* enc);
+
+/*
+*   --------------------------------------------------------------------
+*   tsDecoder_init
+*   --------------------------------------------------------------------
+*   Prepares a decoder to read back n_samples samples from a buffer
+*   produced by tsEncoder_append
+*/
+void tsDecoder_init(tsDecoder_t* dec, const uint8_t* buf, size_t len, uint8_t n_channels, uint32_t n_samples);
+
+/*
+*   --------------------------------------------------------------------
+*   tsDecoder_next
+*   --------------------------------------------------------------------
+*   Sequentially decodes the next sample. Returns false once all samples
+*   have been read or the stream is truncated
+*/
+bool tsDecoder_next(tsDecoder_t* dec, uint32_t* time_ms, float values[]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -38,41 +38,220 @@ extern "C" {
 #include "ota.h"
 #include "webServer.h"
 #include "sensors.h"
+#include "runRecorder.h"
+#include "runArchive.h"
+#include "profiler.h"
+#include "latencyTrace.h"
+#include "rtosTrace.h"
+#include "sysStats.h"
+#include "metrics.h"
+#include "telemetry.h"
+#include "mqttTelemetry.h"
+#include "eventStream.h"
+#include "espfsRoute.h"
 
 #define LED_PIN GPIO_NUM_2
 #define GPIO_HIGH   1
 #define GPIO_LOW    0
 #define LISTEN_PORT     80u
 #define MAX_CONNECTIONS 32u
+#if CONFIG_ESPFS_FILE_POOL_SIZE < MAX_CONNECTIONS
+#warning "CONFIG_ESPFS_FILE_POOL_SIZE is below MAX_CONNECTIONS, busy pages will malloc espfs handles"
+#endif
 #define STATIC_IP		"192.168.1.201"
 #define SUBNET_MASK		"255.255.255.0"
 #define GATE_WAY		"192.168.1.1"
 #define DNS_SERVER		"8.8.8.8"
+#define JSON_CHUNK_LEN  1024u           // Per CGI call, half of libesphttpd's send buffer
+
+typedef struct {
+    Websock* ws;                        // NULL when the slot is free
+    bool watchingPongs;
+    uint32_t pingId;                    // Ping awaiting its pong, 0 when none
+    int64_t pingSentUs;
+    // Frame being received, followed only to pick out pongs
+    uint8_t rxHeader[14];
+    uint8_t rxHeaderLen;
+    uint8_t rxOpcode;
+    uint32_t rxPayloadLen;
+    uint32_t rxPayloadLeft;
+    uint8_t rxPong[sizeof(uint32_t)];
+    wsClientStats_t stats;
+} wsClient_t;
+
+// A JSON reply printed once and sent JSON_CHUNK_LEN bytes per CGI call, as
+// libesphttpd refuses a send larger than its buffer
+typedef struct {
+    char* json;
+    size_t len;
+    size_t sent;
+    void (*done)(void);                 // Called once the last byte is sent, if set
+} jsonReply_t;
 
 static char connectionMemory[sizeof(RtosConnType) * MAX_CONNECTIONS];
 static const char *tag = "Webserver";
 static HttpdFreertosInstance httpdFreertosInstance;
+static wsClient_t wsClients[WS_MAX_CLIENTS];
+static uint32_t wsConnectionCount = 0;
+static EspFs* fs = NULL;
+static cgiRecvHandler websocketRecv = NULL;
 xTaskHandle socketSendHandle;
 
 static bool checkWebsocketActive(volatile Websock* ws);
 static void sendStates(Websock* ws);
 
+static wsClient_t* findClient(Websock* ws)
+{
+    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (wsClients[i].ws == ws) {
+            return &wsClients[i];
+        }
+    }
+    return NULL;
+}
+
+static int sendTimed(wsClient_t* client, Websock* ws, const char* data, int len)
+{
+    int64_t start = esp_timer_get_time();
+    int r = cgiWebsocketSend(&httpdFreertosInstance.httpdInstance, ws, data, len, WEBSOCK_FLAG_NONE);
+    uint32_t elapsed = esp_timer_get_time() - start;
+
+    if (client != NULL) {
+        if (r > 0) {
+            client->stats.sends++;
+            client->stats.bytesSent += len;
+        } else {
+            client->stats.sendFailures++;
+        }
+        client->stats.lastSendUs = elapsed;
+        if (elapsed > client->stats.maxSendUs) {
+            client->stats.maxSendUs = elapsed;
+        }
+    }
+    return r;
+}
+
+static void sendPing(wsClient_t* client, Websock* ws)
+{
+    // A protocol ping carrying its id, which the browser answers by itself.
+    // libesphttpd has no call for control frames, so the frame is written
+    // while the connection is held. An unanswered ping is replaced
+    HttpdInstance* instance = &httpdFreertosInstance.httpdInstance;
+    uint8_t frame[2 + sizeof(uint32_t)] = {0x89, sizeof(uint32_t)};
+
+    if (!client->watchingPongs || !httpdConnSendStart(instance, ws->conn)) {
+        return;
+    }
+    client->pingId = ++client->stats.pings;
+    memcpy(&frame[2], &client->pingId, sizeof(uint32_t));
+    client->pingSentUs = esp_timer_get_time();
+    httpdSend(ws->conn, (const char*) frame, sizeof(frame));
+    httpdConnSendFinish(instance, ws->conn);
+}
+
+static void recordPong(wsClient_t* client, uint32_t id)
+{
+    if (id == 0 || id != client->pingId) {
+        return;
+    }
+    uint32_t rtt = esp_timer_get_time() - client->pingSentUs;
+    client->pingId = 0;
+    client->stats.pongs++;
+    client->stats.lastRttUs = rtt;
+    client->stats.totalRttUs += rtt;
+    if (rtt > client->stats.maxRttUs) {
+        client->stats.maxRttUs = rtt;
+    }
+}
+
+// Size of the header of the frame being received, 0 until it is known
+static uint8_t rxHeaderSize(const wsClient_t* client)
+{
+    if (client->rxHeaderLen < 2) {
+        return 0;
+    }
+    uint8_t len7 = client->rxHeader[1] & 0x7F;
+    return 2 + (len7 == 126 ? 2 : len7 == 127 ? 8 : 0) + ((client->rxHeader[1] & 0x80) ? 4 : 0);
+}
+
+// Follows the frames a client sends just far enough to pick out pongs
+static void scanFrames(wsClient_t* client, const uint8_t* data, int len)
+{
+    int i = 0;
+
+    while (i < len) {
+        uint8_t headerSize = rxHeaderSize(client);
+        if (headerSize == 0 || client->rxHeaderLen < headerSize) {
+            client->rxHeader[client->rxHeaderLen++] = data[i++];
+            headerSize = rxHeaderSize(client);
+            if (headerSize == 0 || client->rxHeaderLen < headerSize) {
+                continue;
+            }
+
+            uint8_t len7 = client->rxHeader[1] & 0x7F;
+            uint32_t payloadLen = (len7 < 126) ? len7 : 0;
+            for (int j = 2; len7 >= 126 && j < headerSize - ((client->rxHeader[1] & 0x80) ? 4 : 0); j++) {
+                payloadLen = (payloadLen << 8) | client->rxHeader[j];
+            }
+            client->rxOpcode = client->rxHeader[0] & 0x0F;
+            client->rxPayloadLen = payloadLen;
+            client->rxPayloadLeft = payloadLen;
+        } else {
+            uint32_t pos = client->rxPayloadLen - client->rxPayloadLeft;
+            if (pos < sizeof(client->rxPong)) {
+                uint8_t mask = (client->rxHeader[1] & 0x80) ? client->rxHeader[headerSize - 4 + pos] : 0;
+                client->rxPong[pos] = data[i] ^ mask;
+            }
+            i++;
+            client->rxPayloadLeft--;
+        }
+
+        if (client->rxPayloadLeft == 0) {
+            // Whole frame seen
+            if (client->rxOpcode == 0xA && client->rxPayloadLen == sizeof(client->rxPong)) {
+                uint32_t id;
+                memcpy(&id, client->rxPong, sizeof(id));
+                recordPong(client, id);
+            }
+            client->rxHeaderLen = 0;
+        }
+    }
+}
+
+// Installed in front of libesphttpd's websocket receive handler, which
+// drops pongs without telling the application
+static CgiStatus watchPongs(HttpdInstance* pInstance, HttpdConnData* connData, char* data, int len)
+{
+    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (wsClients[i].ws != NULL && wsClients[i].ws->conn == connData && wsClients[i].watchingPongs) {
+            scanFrames(&wsClients[i], (const uint8_t*) data, len);
+            break;
+        }
+    }
+    return websocketRecv(pInstance, connData, data, len);
+}
+
 void websocket_task(void *pvParameters) 
 {
     Websock *ws = (Websock*) pvParameters;
     cJSON *root;
     float temps[n_tempSensors] = {0};
     float flowRate;
-    char buff[512];
+    char buff[768];
     Data ctrlSet;
+    loopTiming_t loopTiming;
     int64_t uptime_uS;
+    wsClient_t* client = findClient(ws);
+    int64_t nextPingUs = esp_timer_get_time() + WS_PING_PERIOD_MS * 1000ll;
 
     while (true) {
-        updateTemperatures(temps);
+        get_latest_temperatures(temps);
+        PROFILE_BEGIN(prof_wsSerialise);
         root = cJSON_CreateObject();
         ctrlSet = get_controller_settings();
         uptime_uS = esp_timer_get_time() / 1000000;
         flowRate = get_flowRate();
+        loopTiming = get_loop_timing();
 
         // Construct JSON object
         cJSON_AddStringToObject(root, "type", "data");
@@ -89,17 +268,30 @@ void websocket_task(void *pvParameters)
         cJSON_AddNumberToObject(root, "D_gain", ctrlSet.D_gain);
         cJSON_AddNumberToObject(root, "boilerConc", getBoilerConcentration(getTemperature(temps, T_boiler)));
         cJSON_AddNumberToObject(root, "vapourConc", getVapourConcentration(getTemperature(temps, T_refluxHot)));
+        cJSON_AddNumberToObject(root, "loopPeriodUs", loopTiming.lastPeriodUs);
+        cJSON_AddNumberToObject(root, "loopMaxLateUs", loopTiming.maxLateUs);
+        cJSON_AddNumberToObject(root, "loopMaxWorkUs", loopTiming.maxWorkUs);
+        cJSON_AddNumberToObject(root, "loopDeadlineMisses", loopTiming.deadlineMisses);
         char* JSONptr = cJSON_Print(root);
-        strncpy(buff, JSONptr, 512);
+        strncpy(buff, JSONptr, sizeof(buff) - 1);
+        buff[sizeof(buff) - 1] = '\0';
         cJSON_Delete(root);
         free(JSONptr);      // Must free string pointer to avoid memory leak
+        PROFILE_END(prof_wsSerialise);
 
         if ((!checkWebsocketActive(ws))) {
             ESP_LOGW(tag, "Deleting send task");
+            sysStats_websocketClosed();
+            if (client != NULL) {
+                client->ws = NULL;
+            }
             vTaskDelete(NULL);
         } else {
-            cgiWebsocketSend(&httpdFreertosInstance.httpdInstance,
-                        ws, buff, strlen(buff), WEBSOCK_FLAG_NONE);
+            sendTimed(client, ws, buff, strlen(buff));
+            if (client != NULL && esp_timer_get_time() >= nextPingUs) {
+                sendPing(client, ws);
+                nextPingUs += WS_PING_PERIOD_MS * 1000ll;
+            }
         }
 
         vTaskDelay(250 / portTICK_PERIOD_MS);
@@ -158,6 +350,26 @@ static void myWebsocketConnect(Websock *ws)
 	ws->recvCb=myWebsocketRecv;
     ESP_LOGI(tag, "Socket connected!!\n");
     sendStates(ws);
+    sysStats_websocketConnected();
+    wsConnectionCount++;
+    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+        if (wsClients[i].ws == NULL) {
+            memset(&wsClients[i], 0, sizeof(wsClient_t));
+            wsClients[i].stats.id = wsConnectionCount;
+            wsClients[i].ws = ws;
+            if (ws->conn->recvHdl != NULL) {
+                // Every websocket shares libesphttpd's receive handler
+                if (ws->conn->recvHdl != watchPongs) {
+                    websocketRecv = ws->conn->recvHdl;
+                }
+                ws->conn->recvHdl = watchPongs;
+                wsClients[i].watchingPongs = true;
+            } else {
+                ESP_LOGW(tag, "No receive handler to watch, round trips will not be timed");
+            }
+            break;
+        }
+    }
     xTaskCreatePinnedToCore(&websocket_task, "webServer", 8192, ws, 3, &socketSendHandle, 0);
 }
 
@@ -191,9 +403,507 @@ static void sendStates(Websock* ws)
     cgiWebsocketSend(&httpdFreertosInstance.httpdInstance, ws, buff, strlen(buff), WEBSOCK_FLAG_NONE);
 }
 
+// Prints and deletes root, sends the headers and keeps the reply in cgiData
+// for sendJsonReply
+static CgiStatus startJsonReply(HttpdConnData* connData, cJSON* root)
+{
+    jsonReply_t* reply = malloc(sizeof(jsonReply_t));
+    char* json = cJSON_PrintUnformatted(root);
+    char buff[16];
+
+    cJSON_Delete(root);
+    if (reply == NULL || json == NULL) {
+        ESP_LOGE(tag, "No memory for the reply to %s", connData->url);
+        free(reply);
+        free(json);
+        httpdStartResponse(connData, 500);
+        httpdEndHeaders(connData);
+        return HTTPD_CGI_DONE;
+    }
+    reply->json = json;
+    reply->len = strlen(json);
+    reply->sent = 0;
+    reply->done = NULL;
+    connData->cgiData = reply;
+
+    httpdStartResponse(connData, 200);
+    httpdHeader(connData, "Content-Type", "application/json");
+    snprintf(buff, sizeof(buff), "%u", reply->len);
+    httpdHeader(connData, "Content-Length", buff);
+    httpdEndHeaders(connData);
+    return HTTPD_CGI_MORE;
+}
+
+// Sends the next chunk of the reply in cgiData. It is freed after the last
+// chunk, or once the connection closes or a send fails
+static CgiStatus sendJsonReply(HttpdConnData* connData)
+{
+    jsonReply_t* reply = connData->cgiData;
+
+    if (!connData->isConnectionClosed) {
+        size_t len = reply->len - reply->sent < JSON_CHUNK_LEN ? reply->len - reply->sent : JSON_CHUNK_LEN;
+        if (httpdSend(connData, &reply->json[reply->sent], len)) {
+            reply->sent += len;
+            if (reply->sent < reply->len) {
+                return HTTPD_CGI_MORE;
+            }
+            if (reply->done != NULL) {
+                reply->done();
+            }
+        } else {
+            ESP_LOGW(tag, "Reply to %s cut short at %u of %u bytes", connData->url, reply->sent, reply->len);
+        }
+    }
+    free(reply->json);
+    free(reply);
+    connData->cgiData = NULL;
+    return HTTPD_CGI_DONE;
+}
+
+typedef struct {
+    cJSON* runs;
+    uint32_t first;
+} runListCtx_t;
+
+static void addArchiveToRunList(uint32_t runId, uint32_t size, uint32_t n_samples, void* ctx)
+{
+    runListCtx_t* list = ctx;
+    cJSON* run = (runId >= list->first) ? cJSON_GetArrayItem(list->runs, runId - list->first) : NULL;
+    if (run == NULL) {
+        return;
+    }
+    cJSON_AddNumberToObject(run, "samples", n_samples);
+    cJSON_ReplaceItemInObject(run, "archiveBytes", cJSON_CreateNumber(size));
+}
+
+static CgiStatus cgiRunList(HttpdConnData* connData)
+{
+    // Lists the runs held in either log and the size of their archives
+    if (connData->cgiData != NULL) {
+        return sendJsonReply(connData);
+    }
+    if (connData->isConnectionClosed) {
+        return HTTPD_CGI_DONE;
+    }
+
+    uint32_t first = RUNLOG_NO_RUN, last = RUNLOG_NO_RUN;
+    runLog_t* log = runRecorder_lockLog(recorderLog_samples);
+    if (log != NULL) {
+        first = runLog_oldestRun(log);
+        last = log->lastRunId;
+        runRecorder_unlockLog();
+        log = runRecorder_lockLog(recorderLog_archives);
+        uint32_t oldestArchive = runLog_oldestRun(log);
+        if (oldestArchive != RUNLOG_NO_RUN && (first == RUNLOG_NO_RUN || oldestArchive < first)) {
+            first = oldestArchive;
+        }
+        runRecorder_unlockLog();
+    }
+
+    runListCtx_t list = {.runs = cJSON_CreateArray(), .first = first};
+    for (uint32_t id = first; id != RUNLOG_NO_RUN && id <= last; id++) {
+        cJSON* run = cJSON_CreateObject();
+        cJSON_AddNumberToObject(run, "id", id);
+        cJSON_AddNumberToObject(run, "archiveBytes", 0);
+        cJSON_AddItemToArray(list.runs, run);
+    }
+    if (first != RUNLOG_NO_RUN) {
+        runArchive_list(addArchiveToRunList, &list);
+    }
+    return startJsonReply(connData, list.runs);
+}
+
+static CgiStatus cgiRunArchive(HttpdConnData* connData)
+{
+    // Streams the heatshrink compressed archive of a run one log block per call
+    runArchiveReader_t* reader = connData->cgiData;
+    const uint8_t* data;
+    size_t len;
+    char buff[16];
+
+    if (connData->isConnectionClosed) {
+        free(reader);
+        connData->cgiData = NULL;
+        return HTTPD_CGI_DONE;
+    }
+
+    if (reader == NULL) {
+        reader = malloc(sizeof(runArchiveReader_t));
+        if (reader == NULL || httpdFindArg(connData->getArgs, "id", buff, sizeof(buff)) <= 0 ||
+            runArchive_open(reader, strtoul(buff, NULL, 10)) != ESP_OK) {
+            free(reader);
+            httpdStartResponse(connData, 404);
+            httpdEndHeaders(connData);
+            return HTTPD_CGI_DONE;
+        }
+        connData->cgiData = reader;
+
+        httpdStartResponse(connData, 200);
+        httpdHeader(connData, "Content-Type", "application/octet-stream");
+        snprintf(buff, sizeof(buff), "%u", reader->size);
+        httpdHeader(connData, "Content-Length", buff);
+        snprintf(buff, sizeof(buff), "%d", RUNARCHIVE_WINDOW_BITS);
+        httpdHeader(connData, "X-Heatshrink-Window", buff);
+        snprintf(buff, sizeof(buff), "%d", RUNARCHIVE_LOOKAHEAD_BITS);
+        httpdHeader(connData, "X-Heatshrink-Lookahead", buff);
+        httpdEndHeaders(connData);
+        return HTTPD_CGI_MORE;
+    }
+
+    esp_err_t err = runArchive_read(reader, &data, &len);
+    if (err != ESP_OK) {
+        if (err != ESP_ERR_NOT_FOUND) {
+            // Cut the response short of its Content-Length rather than send a gap
+            ESP_LOGW(tag, "Error (%s) reading run archive", esp_err_to_name(err));
+        }
+        free(reader);
+        connData->cgiData = NULL;
+        return HTTPD_CGI_DONE;
+    }
+    httpdSend(connData, (const char*) data, len);
+    return HTTPD_CGI_MORE;
+}
+
+static CgiStatus cgiTrace(HttpdConnData* connData)
+{
+    // Streams the scheduler trace as Chrome trace JSON, or as a raw dump for
+    // tools/rtosTrace.py with /trace?format=raw. Recording pauses meanwhile
+    rtosTraceExport_t* ex = connData->cgiData;
+    char buff[8];
+    size_t len;
+
+    if (connData->isConnectionClosed) {
+        if (ex != NULL) {
+            rtosTrace_exportAbort(ex);
+            free(ex);
+            connData->cgiData = NULL;
+        }
+        return HTTPD_CGI_DONE;
+    }
+
+    if (ex == NULL) {
+        bool raw = httpdFindArg(connData->getArgs, "format", buff, sizeof(buff)) > 0 && strcmp(buff, "raw") == 0;
+        ex = malloc(sizeof(rtosTraceExport_t) + RTOS_TRACE_CHUNK_MIN);
+        if (ex == NULL || !rtosTrace_exportBegin(ex, raw)) {
+            free(ex);
+            httpdStartResponse(connData, 404);
+            httpdEndHeaders(connData);
+            return HTTPD_CGI_DONE;
+        }
+        connData->cgiData = ex;
+
+        httpdStartResponse(connData, 200);
+        httpdHeader(connData, "Content-Type", raw ? "application/octet-stream" : "application/json");
+        httpdEndHeaders(connData);
+        return HTTPD_CGI_MORE;
+    }
+
+    // The chunk buffer lives straight after the export state
+    len = rtosTrace_exportChunk(ex, (char*) (ex + 1), RTOS_TRACE_CHUNK_MIN);
+    if (len == 0) {
+        free(ex);
+        connData->cgiData = NULL;
+        return HTTPD_CGI_DONE;
+    }
+    httpdSend(connData, (const char*) (ex + 1), len);
+    return HTTPD_CGI_MORE;
+}
+
+static CgiStatus cgiProfile(HttpdConnData* connData)
+{
+    // Dumps the profiling zone histograms, control loop timing and sample
+    // latencies. /profile?reset=1 clears the zone histograms once the
+    // whole reply has been sent
+    profHistogram_t hist;
+    char buff[4];
+
+    if (connData->cgiData != NULL) {
+        return sendJsonReply(connData);
+    }
+    if (connData->isConnectionClosed) {
+        return HTTPD_CGI_DONE;
+    }
+
+    cJSON* root = cJSON_CreateObject();
+    cJSON_AddNumberToObject(root, "cpuMHz", CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ);
+    cJSON_AddNumberToObject(root, "enabled", PROFILER_ENABLED);
+    cJSON* zones = cJSON_AddArrayToObject(root, "zones");
+    for (int i = 0; i < prof_nZones; i++) {
+        cJSON* zone = cJSON_CreateObject();
+        cJSON_AddStringToObject(zone, "name", profiler_getHistogram((profZone_t) i, &hist));
+        cJSON_AddNumberToObject(zone, "count", hist.count);
+        cJSON_AddNumberToObject(zone, "meanUs", hist.count ? (double) hist.totalCycles / hist.count / CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ : 0);
+        cJSON_AddNumberToObject(zone, "maxUs", (double) hist.maxCycles / CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ);
+
+        // Bucket i holds zones of 2^i to 2^(i+1) cycles. Trailing empty buckets are dropped
+        int n_buckets = PROFILER_N_BUCKETS;
+        while (n_buckets > 0 && hist.buckets[n_buckets - 1] == 0) {
+            n_buckets--;
+        }
+        cJSON* buckets = cJSON_AddArrayToObject(zone, "buckets");
+        for (int b = 0; b < n_buckets; b++) {
+            cJSON_AddItemToArray(buckets, cJSON_CreateNumber(hist.buckets[b]));
+        }
+        cJSON_AddItemToArray(zones, zone);
+    }
+
+    // Control loop timing, jitter buckets are log2 of |period - nominal| in us
+    loopTiming_t loopTiming = get_loop_timing();
+    cJSON* loop = cJSON_AddObjectToObject(root, "controlLoop");
+    cJSON_AddNumberToObject(loop, "iterations", loopTiming.iterations);
+    cJSON_AddNumberToObject(loop, "deadlineMisses", loopTiming.deadlineMisses);
+    cJSON_AddNumberToObject(loop, "lastPeriodUs", loopTiming.lastPeriodUs);
+    cJSON_AddNumberToObject(loop, "maxLateUs", loopTiming.maxLateUs);
+    cJSON_AddNumberToObject(loop, "maxEarlyUs", loopTiming.maxEarlyUs);
+    cJSON_AddNumberToObject(loop, "maxWorkUs", loopTiming.maxWorkUs);
+    cJSON_AddNumberToObject(loop, "measuredDt", CONTROL_LOOP_MEASURED_DT);
+    cJSON* jitter = cJSON_AddArrayToObject(loop, "jitterHist");
+    for (int b = 0; b < LOOP_JITTER_BUCKETS; b++) {
+        cJSON_AddItemToArray(jitter, cJSON_CreateNumber(loopTiming.jitterHist[b]));
+    }
+
+    // Sample to actuation latency, buckets are log2 of the latency in us
+    latencyHist_t latHist;
+    latencyCounters_t latCounters = latency_getCounters();
+    cJSON* latency = cJSON_AddObjectToObject(root, "latency");
+    cJSON_AddNumberToObject(latency, "samplesMissed", latCounters.samplesMissed);
+    cJSON_AddNumberToObject(latency, "staleActuations", latCounters.staleActuations);
+    cJSON* stages = cJSON_AddArrayToObject(latency, "stages");
+    for (int i = 0; i < lat_nStages; i++) {
+        cJSON* stage = cJSON_CreateObject();
+        cJSON_AddStringToObject(stage, "name", latency_getHistogram((latencyStage_t) i, &latHist));
+        cJSON_AddNumberToObject(stage, "count", latHist.count);
+        cJSON_AddNumberToObject(stage, "meanUs", latHist.count ? (double) latHist.totalUs / latHist.count : 0);
+        cJSON_AddNumberToObject(stage, "maxUs", latHist.maxUs);
+        cJSON* buckets = cJSON_AddArrayToObject(stage, "buckets");
+        for (int b = 0; b < LATENCY_BUCKETS; b++) {
+            cJSON_AddItemToArray(buckets, cJSON_CreateNumber(latHist.buckets[b]));
+        }
+        cJSON_AddItemToArray(stages, stage);
+    }
+
+    CgiStatus status = startJsonReply(connData, root);
+    if (connData->cgiData != NULL && httpdFindArg(connData->getArgs, "reset", buff, sizeof(buff)) > 0 && buff[0] == '1') {
+        ((jsonReply_t*) connData->cgiData)->done = profiler_reset;
+    }
+    return status;
+}
+
+static CgiStatus cgiStats(HttpdConnData* connData)
+{
+    // Reports tasks, heaps, queues and websockets for sizing stacks and
+    // buffers. CPU shares cover the time since the previous request
+    static sysStatsTask_t tasks[SYS_STATS_MAX_TASKS];
+    sysStatsHeap_t heaps[SYS_STATS_N_HEAPS];
+    sysStatsQueue_t queues[SYS_STATS_MAX_QUEUES];
+    uint32_t intervalUs;
+
+    if (connData->cgiData != NULL) {
+        return sendJsonReply(connData);
+    }
+    if (connData->isConnectionClosed) {
+        return HTTPD_CGI_DONE;
+    }
+
+    cJSON* root = cJSON_CreateObject();
+    int n = sysStats_getTasks(tasks, SYS_STATS_MAX_TASKS, &intervalUs);
+    cJSON_AddNumberToObject(root, "intervalMs", intervalUs / 1000);
+    cJSON* taskArray = cJSON_AddArrayToObject(root, "tasks");
+    for (int i = 0; i < n; i++) {
+        cJSON* task = cJSON_CreateObject();
+        cJSON_AddStringToObject(task, "name", tasks[i].name);
+        cJSON_AddNumberToObject(task, "priority", tasks[i].priority);
+        cJSON_AddNumberToObject(task, "core", tasks[i].core);
+        cJSON_AddNumberToObject(task, "state", tasks[i].state);
+        cJSON_AddNumberToObject(task, "cpuPercent", tasks[i].cpuPermille / 10.0);
+        cJSON_AddNumberToObject(task, "stackFree", tasks[i].stackFree);
+        cJSON_AddItemToArray(taskArray, task);
+    }
+
+    n = sysStats_getHeaps(heaps, SYS_STATS_N_HEAPS);
+    cJSON* heapObj = cJSON_AddObjectToObject(root, "heap");
+    for (int i = 0; i < n; i++) {
+        cJSON* heap = cJSON_AddObjectToObject(heapObj, heaps[i].name);
+        cJSON_AddNumberToObject(heap, "free", heaps[i].freeBytes);
+        cJSON_AddNumberToObject(heap, "minFree", heaps[i].minFreeBytes);
+        cJSON_AddNumberToObject(heap, "largestBlock", heaps[i].largestBlock);
+    }
+
+    n = sysStats_getQueues(queues, SYS_STATS_MAX_QUEUES);
+    cJSON* queueArray = cJSON_AddArrayToObject(root, "queues");
+    for (int i = 0; i < n; i++) {
+        cJSON* queue = cJSON_CreateObject();
+        cJSON_AddStringToObject(queue, "name", queues[i].name);
+        cJSON_AddNumberToObject(queue, "length", queues[i].length);
+        cJSON_AddNumberToObject(queue, "waiting", queues[i].waiting);
+        cJSON_AddNumberToObject(queue, "highWater", queues[i].highWater);
+        cJSON_AddItemToArray(queueArray, queue);
+    }
+
+    sysStatsWebsockets_t wsStats = sysStats_getWebsockets();
+    cJSON* websockets = cJSON_AddObjectToObject(root, "websockets");
+    cJSON_AddNumberToObject(websockets, "connects", wsStats.connects);
+    cJSON_AddNumberToObject(websockets, "disconnects", wsStats.disconnects);
+    cJSON_AddNumberToObject(websockets, "sendTasks", wsStats.sendTasks);
+    cJSON_AddNumberToObject(websockets, "maxConnections", MAX_CONNECTIONS);
+    cJSON_AddNumberToObject(websockets, "eventStreamClients", eventStream_getClientCount());
+    wsClientStats_t clients[WS_MAX_CLIENTS];
+    n = webServer_getClientStats(clients, WS_MAX_CLIENTS);
+    cJSON* clientArray = cJSON_AddArrayToObject(websockets, "clients");
+    for (int i = 0; i < n; i++) {
+        cJSON* client = cJSON_CreateObject();
+        cJSON_AddNumberToObject(client, "id", clients[i].id);
+        cJSON_AddNumberToObject(client, "sends", clients[i].sends);
+        cJSON_AddNumberToObject(client, "sendFailures", clients[i].sendFailures);
+        cJSON_AddNumberToObject(client, "bytesSent", clients[i].bytesSent);
+        cJSON_AddNumberToObject(client, "sendLastUs", clients[i].lastSendUs);
+        cJSON_AddNumberToObject(client, "sendMaxUs", clients[i].maxSendUs);
+        cJSON_AddNumberToObject(client, "pings", clients[i].pings);
+        cJSON_AddNumberToObject(client, "pongs", clients[i].pongs);
+        cJSON_AddNumberToObject(client, "rttLastUs", clients[i].lastRttUs);
+        cJSON_AddNumberToObject(client, "rttMaxUs", clients[i].maxRttUs);
+        cJSON_AddNumberToObject(client, "rttMeanUs", clients[i].pongs ? (double) clients[i].totalRttUs / clients[i].pongs : 0);
+        cJSON_AddItemToArray(clientArray, client);
+    }
+
+    wifiLinkStats_t link = get_wifi_link_stats();
+    cJSON* wifi = cJSON_AddObjectToObject(root, "wifi");
+    cJSON_AddBoolToObject(wifi, "connected", link.connected);
+    if (link.rssiSamples) {
+        cJSON_AddNumberToObject(wifi, "rssi", link.rssi);
+        cJSON_AddNumberToObject(wifi, "rssiMin", link.rssiMin);
+        cJSON_AddNumberToObject(wifi, "rssiMax", link.rssiMax);
+        cJSON_AddNumberToObject(wifi, "channel", link.channel);
+    }
+    cJSON_AddNumberToObject(wifi, "disconnects", link.disconnects);
+    cJSON_AddNumberToObject(wifi, "lastReason", link.lastReason);
+    cJSON_AddNumberToObject(wifi, "reconnects", link.reconnects);
+    cJSON_AddNumberToObject(wifi, "fastReconnects", link.fastReconnects);
+    cJSON_AddNumberToObject(wifi, "fastFailures", link.fastFailures);
+    cJSON_AddBoolToObject(wifi, "lastReconnectFast", link.lastReconnectFast);
+    cJSON_AddNumberToObject(wifi, "reconnectLastMs", link.lastReconnectMs);
+    cJSON_AddNumberToObject(wifi, "reconnectMaxMs", link.maxReconnectMs);
+    cJSON_AddNumberToObject(wifi, "reconnectMeanMs", link.reconnects ? (double) link.totalReconnectMs / link.reconnects : 0);
+
+    static const char* integrityNames[] = {"unchecked", "ok", "bad", "noChecksum"};
+    EspFsPoolStats pool;
+    espFsGetPoolStats(&pool);
+    cJSON* espfs = cJSON_AddObjectToObject(root, "espfs");
+    cJSON_AddStringToObject(espfs, "integrity", fs ? integrityNames[espFsIntegrity(fs)] : "unmounted");
+    cJSON_AddNumberToObject(espfs, "handles", pool.handles);
+    cJSON_AddNumberToObject(espfs, "handlesInUse", pool.handlesInUse);
+    cJSON_AddNumberToObject(espfs, "handlesPeak", pool.handlesPeak);
+    cJSON_AddNumberToObject(espfs, "handleFallbacks", pool.handleFallbacks);
+    cJSON_AddNumberToObject(espfs, "decoders", pool.decoders);
+    cJSON_AddNumberToObject(espfs, "decodersInUse", pool.decodersInUse);
+    cJSON_AddNumberToObject(espfs, "decodersPeak", pool.decodersPeak);
+    cJSON_AddNumberToObject(espfs, "decoderFallbacks", pool.decoderFallbacks);
+    espfsRouteStats_t route = espfsRoute_getStats();
+    cJSON_AddNumberToObject(espfs, "served", route.served);
+    cJSON_AddNumberToObject(espfs, "notModified", route.notModified);
+    cJSON_AddNumberToObject(espfs, "bytesSent", route.bytesSent);
+
+    mqttStats_t mqttStats = mqttTelemetry_getStats();
+    cJSON* mqtt = cJSON_AddObjectToObject(root, "mqtt");
+    cJSON_AddBoolToObject(mqtt, "connected", mqttStats.connected);
+    cJSON_AddNumberToObject(mqtt, "connects", mqttStats.connects);
+    cJSON_AddNumberToObject(mqtt, "disconnects", mqttStats.disconnects);
+    cJSON_AddNumberToObject(mqtt, "published", mqttStats.published);
+    cJSON_AddNumberToObject(mqtt, "publishFailures", mqttStats.publishFailures);
+    cJSON_AddNumberToObject(mqtt, "bytesPublished", mqttStats.bytesPublished);
+    cJSON_AddNumberToObject(mqtt, "samplesPublished", mqttStats.samplesPublished);
+    cJSON_AddNumberToObject(mqtt, "samplesDropped", mqttStats.samplesDropped);
+    cJSON_AddNumberToObject(mqtt, "backlog", mqttStats.backlog);
+    cJSON_AddNumberToObject(mqtt, "latencyLastUs", mqttStats.lastLatencyUs);
+    cJSON_AddNumberToObject(mqtt, "latencyMaxUs", mqttStats.maxLatencyUs);
+    cJSON_AddNumberToObject(mqtt, "latencyMeanUs", mqttStats.published ? (double) mqttStats.totalLatencyUs / mqttStats.published : 0);
+
+    return startJsonReply(connData, root);
+}
+
+static CgiStatus cgiMetrics(HttpdConnData* connData)
+{
+    // Prometheus text exposition, one section per call. cgiData holds the
+    // next section rather than a pointer, so a scrape allocates nothing.
+    // All connections are served from the one httpd task, so the chunk
+    // buffer can be shared
+    static char buff[METRICS_CHUNK_LEN];
+    intptr_t section = (intptr_t) connData->cgiData;
+
+    if (connData->isConnectionClosed) {
+        return HTTPD_CGI_DONE;
+    }
+
+    if (section == 0) {
+        httpdStartResponse(connData, 200);
+        httpdHeader(connData, "Content-Type", "text/plain; version=0.0.4");
+        httpdEndHeaders(connData);
+    }
+
+    size_t len = metrics_render((metricsSection_t) section, buff, sizeof(buff));
+    httpdSend(connData, buff, len);
+
+    if (++section >= metrics_nSections) {
+        connData->cgiData = NULL;
+        return HTTPD_CGI_DONE;
+    }
+    connData->cgiData = (void*) section;
+    return HTTPD_CGI_MORE;
+}
+
+static CgiStatus cgiApiState(HttpdConnData* connData)
+{
+    // Serves the frame the telemetry task serialised for the latest control
+    // tick. The ETag is the frame sequence number, so a client polling
+    // faster than the loop runs gets a 304 without the frame being copied
+    const telemetryFrame_t* frame;
+    char etag[16];
+    char buff[16];
+
+    if (connData->isConnectionClosed) {
+        return HTTPD_CGI_DONE;
+    }
+
+    snprintf(etag, sizeof(etag), "\"%u\"", telemetry_getSeq());
+    if (httpdGetHeader(connData, "If-None-Match", buff, sizeof(buff)) && strcmp(buff, etag) == 0) {
+        httpdStartResponse(connData, 304);
+        httpdHeader(connData, "ETag", etag);
+        httpdEndHeaders(connData);
+        return HTTPD_CGI_DONE;
+    }
+
+    frame = telemetry_lockFrame();
+    if (frame == NULL) {
+        httpdStartResponse(connData, 503);
+        httpdEndHeaders(connData);
+        return HTTPD_CGI_DONE;
+    }
+
+    snprintf(etag, sizeof(etag), "\"%u\"", frame->seq);
+    snprintf(buff, sizeof(buff), "%u", frame->len);
+    httpdStartResponse(connData, 200);
+    httpdHeader(connData, "Content-Type", "application/json");
+    httpdHeader(connData, "Content-Length", buff);
+    httpdHeader(connData, "ETag", etag);
+    httpdHeader(connData, "Cache-Control", "no-cache");
+    httpdEndHeaders(connData);
+    httpdSend(connData, frame->json, frame->len);
+    telemetry_unlockFrame();
+    return HTTPD_CGI_DONE;
+}
+
 HttpdBuiltInUrl builtInUrls[]={
 	ROUTE_REDIRECT("/", "index.html"),
     ROUTE_WS("/ws", myWebsocketConnect),
+    ROUTE_CGI("/runs", cgiRunList),
+    ROUTE_CGI("/runs/archive", cgiRunArchive),
+    ROUTE_CGI("/profile", cgiProfile),
+    ROUTE_CGI("/trace", cgiTrace),
+    ROUTE_CGI("/stats", cgiStats),
+    ROUTE_CGI("/metrics", cgiMetrics),
+    ROUTE_CGI("/api/state", cgiApiState),
+    ROUTE_CGI("/events", cgiEventStream),
+    ROUTE_CGI("*", cgiEspFs),
     ROUTE_FILESYSTEM(),
 	ROUTE_END()
 };
@@ -204,8 +914,9 @@ void webServer_init(void)
     EspFsConfig conf = {
 		.memAddr = espfs_image_bin,
 	};
-    EspFs* fs = espFsInit(&conf);
+    fs = espFsInit(&conf);
     httpdRegisterEspfs(fs);
+    espfsRoute_init(fs);
     esp_netif_init();
 	httpdFreertosInit(&httpdFreertosInstance,
 	                  builtInUrls,
@@ -214,9 +925,43 @@ void webServer_init(void)
 	                  MAX_CONNECTIONS,
 	                  HTTPD_FLAG_NONE);
 	httpdFreertosStart(&httpdFreertosInstance);
+    eventStream_init(&httpdFreertosInstance.httpdInstance);
     ESP_LOGI(tag, "Webserver waiting for connections");
 }
 
+int webServer_getClientStats(wsClientStats_t* clients, int maxClients)
+{
+    int n = 0;
+
+    for (int i = 0; i < WS_MAX_CLIENTS && n < maxClients; i++) {
+        if (wsClients[i].ws != NULL) {
+            clients[n++] = wsClients[i].stats;
+        }
+    }
+    return n;
+}
+
+wsLinkSummary_t webServer_getLinkSummary(void)
+{
+    wsLinkSummary_t summary = {0};
+
+    for (int i = 0; i < WS_MAX_CLIENTS; i++) {
+        const wsClientStats_t* stats = &wsClients[i].stats;
+        if (wsClients[i].ws == NULL) {
+            continue;
+        }
+        summary.clients++;
+        summary.sendFailures += stats->sendFailures;
+        if (stats->lastRttUs > summary.lastRttUs) {
+            summary.lastRttUs = stats->lastRttUs;
+        }
+        if (stats->lastSendUs > summary.lastSendUs) {
+            summary.lastSendUs = stats->lastSendUs;
+        }
+    }
+    return summary;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -4,11 +4,42 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WS_MAX_CLIENTS 8                    // Clients with link statistics
+#define WS_PING_PERIOD_MS 2000
+
 typedef struct {
     char ip[16];
     uint8_t len;
 } ota_t;
 
+// Per websocket client. Send times are how long the send task was blocked
+// in cgiWebsocketSend, which includes waiting for the server lock and for
+// room in the connection's send buffer
+typedef struct {
+    uint32_t id;                            // Connection number since boot
+    uint32_t sends;
+    uint32_t sendFailures;
+    uint32_t bytesSent;
+    uint32_t lastSendUs;
+    uint32_t maxSendUs;
+    uint32_t pings;                         // Protocol pings sent
+    uint32_t pongs;                         // Pongs matched to their ping
+    uint32_t lastRttUs;
+    uint32_t maxRttUs;
+    uint64_t totalRttUs;
+} wsClientStats_t;
+
+// Worst values over the connected clients, for the telemetry frame
+typedef struct {
+    uint32_t clients;
+    uint32_t lastRttUs;
+    uint32_t lastSendUs;
+    uint32_t sendFailures;
+} wsLinkSummary_t;
+
 /*
 *   --------------------------------------------------------------------  
 *   websocket_task
@@ -26,6 +57,18 @@ void websocket_task(void *pvParameters);
 */
 void webServer_init(void);
 
+/*
+*   --------------------------------------------------------------------  
+*   webServer_getClientStats
+*   --------------------------------------------------------------------
+*   Copies the statistics of up to maxClients connected websocket
+*   clients and returns how many were copied. Round trip times are only
+*   measured for clients that answer the periodic ping
+*/
+int webServer_getClientStats(wsClientStats_t* clients, int maxClients);
+
+wsLinkSummary_t webServer_getLinkSummary(void);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
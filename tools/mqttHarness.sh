@@ -0,0 +1,46 @@
+#!/bin/bash
+# Runs a local Mosquitto broker for testing the MQTT publisher and prints
+# everything the controller publishes with receive timestamps. The broker
+# only accepts the "still" user, and only that user may write still/cmd,
+# as a plant broker should be set up.
+#
+#   tools/mqttHarness.sh [port] [password]
+#
+# Build the firmware against this broker with
+#   idf.py -DMQTT_BROKER_URI=mqtt://<this host>:<port> -DMQTT_USERNAME=still \
+#          -DMQTT_PASSWORD=<password> -DMQTT_COMMANDS=1 build flash
+#
+# Useful checks while it runs, from another shell:
+#   mosquitto_pub -p <port> -u still -P <password> -t still/cmd -m 'CMD&<command>'
+#   feeds cmdQueue, the same without -u/-P is refused
+#   stop this script for a minute, restart it: the backlog is replayed and
+#   still/stats reports any samples dropped from the telemetry ring
+# still/stats carries PUBACK latency and messages/bytes per minute.
+
+PORT=${1:-1883}
+PASSWORD=${2:-still}
+DIR=$(mktemp -d)
+trap 'kill $BROKER 2>/dev/null; rm -rf "$DIR"' EXIT
+
+mosquitto_passwd -b -c "$DIR/passwd" still "$PASSWORD"
+
+cat > "$DIR/acl" <<EOF
+user still
+topic readwrite still/#
+EOF
+
+cat > "$DIR/mosquitto.conf" <<EOF
+listener $PORT 0.0.0.0
+allow_anonymous false
+password_file $DIR/passwd
+acl_file $DIR/acl
+persistence false
+EOF
+
+mosquitto -c "$DIR/mosquitto.conf" &
+BROKER=$!
+sleep 1
+
+HOST=$(hostname -I 2>/dev/null | awk '{print $1}')
+echo "Broker on mqtt://${HOST:-localhost}:$PORT as still/$PASSWORD, waiting for still/#"
+mosquitto_sub -p "$PORT" -u still -P "$PASSWORD" -v -t 'still/#' -F '%I %t %p'
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+"""Converts a raw scheduler trace dump to Chrome trace event JSON.
+
+Usage:
+    rtosTrace.py <dump file or http://device/trace?format=raw> [out.json]
+
+The output opens in ui.perfetto.dev or chrome://tracing. The device can
+produce the same JSON itself from /trace; the raw dump is about a fifth of the
+size, so it is quicker to pull over a weak WiFi link. Layouts mirror
+rtosTraceDumpHeader_t, rtosTraceName_t and rtosTraceEvent_t in main/rtosTrace.h
+"""
+
+import json
+import struct
+import sys
+import urllib.request
+
+MAGIC = 0x52545452
+VERSION = 1
+HEADER = struct.Struct("<IHHII")
+NAME = struct.Struct("<I16s")
+EVENT = struct.Struct("<IBBHI")
+
+SWITCH_IN, TASK_CREATE, TASK_DELETE = 1, 2, 3
+QUEUE_OPS = {4: "send", 5: "receive", 6: "block send", 7: "block receive"}
+ISR_ENTER, ISR_EXIT = 8, 9
+
+
+def load(source):
+    if source.startswith("http://") or source.startswith("https://"):
+        with urllib.request.urlopen(source) as response:
+            return response.read()
+    with open(source, "rb") as f:
+        return f.read()
+
+
+def convert(data):
+    magic, version, n_names, n_events, _ = HEADER.unpack_from(data, 0)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a version %d trace dump" % VERSION)
+
+    offset = HEADER.size
+    names = {}
+    for _ in range(n_names):
+        obj, name = NAME.unpack_from(data, offset)
+        names[obj] = name.split(b"\0", 1)[0].decode("ascii", "replace")
+        offset += NAME.size
+
+    def name_of(obj):
+        return names.get(obj, "0x%08x" % obj)
+
+    out = []
+    for core in range(2):
+        out.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": core * 2,
+                    "args": {"name": "Core %d" % core}})
+        out.append({"name": "thread_name", "ph": "M", "pid": 0, "tid": core * 2 + 1,
+                    "args": {"name": "Core %d ISRs" % core}})
+
+    start = None
+    last_task = [None, None]
+    last_switch = [0, 0]
+    for _ in range(n_events):
+        time_us, kind, core, _, obj = EVENT.unpack_from(data, offset)
+        offset += EVENT.size
+        if start is None:
+            start = time_us
+        ts = (time_us - start) & 0xFFFFFFFF
+        core &= 1
+
+        if kind == SWITCH_IN:
+            if last_task[core] is not None:
+                out.append({"name": name_of(last_task[core]), "ph": "X", "ts": last_switch[core],
+                            "dur": ts - last_switch[core], "pid": 0, "tid": core * 2})
+            last_task[core] = obj
+            last_switch[core] = ts
+        elif kind in (TASK_CREATE, TASK_DELETE):
+            op = "create" if kind == TASK_CREATE else "delete"
+            out.append({"name": "%s %s" % (op, name_of(obj)), "ph": "i", "s": "t", "ts": ts,
+                        "pid": 0, "tid": core * 2})
+        elif kind in QUEUE_OPS:
+            out.append({"name": "%s %s" % (QUEUE_OPS[kind], name_of(obj)), "ph": "i", "s": "t",
+                        "ts": ts, "pid": 0, "tid": core * 2})
+        elif kind == ISR_ENTER:
+            out.append({"name": "ISR %d" % obj, "ph": "B", "ts": ts, "pid": 0, "tid": core * 2 + 1})
+        elif kind == ISR_EXIT:
+            out.append({"ph": "E", "ts": ts, "pid": 0, "tid": core * 2 + 1})
+
+    return {"displayTimeUnit": "ms", "traceEvents": out}
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        sys.exit(1)
+
+    trace = convert(load(sys.argv[1]))
+    if len(sys.argv) > 2:
+        with open(sys.argv[2], "w") as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()